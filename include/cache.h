@@ -0,0 +1,47 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include "wire.h"    // for DNS_MAX_NAME
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint16_t, uint32_t
+
+#define CACHE_WAYS 4                  // 每组的条目数
+#define CACHE_LOCKS 64                // 按组分段加锁
+#define CACHE_DATA_MAX 512            // 更大的响应不缓存
+#define CACHE_SIZE_MAX 262144
+#define CACHE_TTL_MAX 600             // 不超过 Docker 内置 DNS 的 TTL
+#define CACHE_NEG_TTL 10              // 没有可用 TTL 的否定应答
+#define CACHE_SAVE_INTERVAL 300       // 秒
+
+// 缓存文件：文件头之后是变长记录，过期时间为绝对时间，本机字节序
+#define CACHE_FILE_MAGIC 0x444e5343   // "DNSC"
+#define CACHE_FILE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t count;
+    uint32_t pad;
+    int64_t saved;                    // 保存时间（Unix 秒）
+} cache_file_header_t;
+
+typedef struct {
+    int64_t expire;                   // 过期时间（Unix 秒）
+    int64_t stored;                   // 写入时间，用于递减 TTL
+    uint16_t key_len;
+    uint16_t data_len;
+    uint32_t pad;
+    // 之后依次是键和响应报文
+} cache_file_record_t;
+
+int init_cache(size_t entries);
+int cache_enabled(void);
+size_t cache_lookup(const uint8_t *query, size_t len, size_t qname_end, uint8_t *resp, size_t cap);
+void cache_store(const uint8_t *query, size_t len, size_t qname_end, const uint8_t *resp, size_t rlen);
+void cache_flush(void);
+size_t cache_entries(void);
+int cache_save(const char *path);
+int cache_load(const char *path);
+int start_cache_persistence(const char *path);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef CHAOS_H
+#define CHAOS_H
+#include <netinet/in.h>  // for in_addr
+#include <stddef.h>      // for size_t
+#include <stdint.h>      // for uint8_t
+
+#define CHAOS_MAX_ALLOW 16
+#define CHAOS_MAX_LINES 8
+#define CHAOS_LINE_MAX 255               // 单个 TXT 字符串的最大长度
+#define CHAOS_DOMAIN "docker-dns."
+
+int init_chaos(const char *allow);
+int handle_chaos_query(uint8_t *buf, size_t *len, size_t cap, struct in_addr client);
+
+#endif
@@ -12,6 +12,20 @@
 #define KEEP_SUFFIX_ENV "KEEP_SUFFIX"
 #define MAX_HOPS_ENV "MAX_HOPS"
 #define NUM_WORKERS_ENV "NUM_WORKERS"
+#define ROUTES_ENV "ROUTES"
+#define HOSTS_ENV "HOSTS_FILE"
+#define DOCKER_SOCKET_ENV "DOCKER_SOCKET"
+#define MINIMAL_RESPONSES_ENV "MINIMAL_RESPONSES"
+#define QUERY_LOG_ENV "QUERY_LOG"
+#define QUERY_LOG_SIZE_ENV "QUERY_LOG_SIZE"
+#define METRICS_ENV "METRICS_LISTEN"
+#define STATS_ALLOW_ENV "STATS_ALLOW"
+#define SLOW_QUERY_ENV "SLOW_QUERY_MS"
+#define ENV_FILE_ENV "ENV_FILE"
+#define UPGRADE_SOCKET_ENV "UPGRADE_SOCKET"
+#define CACHE_SIZE_ENV "CACHE_SIZE"
+#define CACHE_FILE_ENV "CACHE_FILE"
+#define HEDGE_PERCENT_ENV "HEDGE_PERCENT"
 
 #define LISTEN_PORT_DEFAULT 53
 #define FORWARD_DNS_DEFAULT "127.0.0.11"
@@ -20,21 +34,46 @@
 #define SUFFIX_DEFAULT ".docker"
 #define LOG_LEVEL_DEFAULT LOG_INFO
 #define KEEP_SUFFIX_DEFAULT 0
+#define MINIMAL_RESPONSES_DEFAULT 0
 #define MAX_HOPS_DEFAULT 3
 #define NUM_WORKERS_DEFAULT 4
+#define QUERY_LOG_SIZE_DEFAULT 64
+#define STATS_ALLOW_DEFAULT "127.0.0.0/8"
+#define SLOW_QUERY_DEFAULT 0
+#define CACHE_SIZE_DEFAULT 0
+#define HEDGE_PERCENT_DEFAULT 0
+#define ENV_FILE_MAX_SIZE 65536
+#define ENV_FILE_MAX_ENTRIES 128
 
 extern int max_hops;
 extern int num_workers;
 extern int keep_suffix;
+extern int minimal_responses;
 extern int foreground;
 extern int listen_port;
+extern int query_log_size;
+extern int slow_query_ms;
+extern int cache_size;
+extern int hedge_percent;
 extern char forward_dns[16];
 extern char container_name[256];
 extern char gateway_name[64];
 extern char suffix_domain[64];
+extern char hosts_file[256];
+extern char docker_socket_path[108];
+extern char query_log_path[256];
+extern char metrics_listen[32];
+extern char stats_allow[256];
+extern char env_file[256];
+extern char upgrade_socket[108];
+extern char cache_file[256];
 
+struct snapshot;
+
+void init_config_file(int argc, char *argv[]);
 void init_config_env(void);
 void init_config_argc(int argc, char *argv[]);
+struct snapshot* reload_config(void);
 int* str2int(const char *nptr);
 void read_env(const char *env_name, const char *default_val, char *dest, size_t dest_size);
 
@@ -6,17 +6,43 @@
 // #include <ldns/rdata.h>     // for ldns_rdf
 // #include <ldns/resolver.h>  // for ldns_resolver
 #include <ldns/ldns.h>
+#include "queue.h"          // for BUF_SIZE
+#include "route.h"          // for route_t
+#include "wire.h"           // for DNS_MAX_NAME
 
 struct sockaddr_in;
 
 #define QUEUE_SIZE 1024
+#define UPSTREAM_TIMEOUT_MS 2000
+// 请求对冲：上游超过最近往返时间的 p95 仍未应答时再发一份
+#define HEDGE_QUANTILE 0.95
+#define HEDGE_MIN_SAMPLES 50
+#define HEDGE_UPDATE_MS 1000
+#define HEDGE_DELAY_MIN_US 2000
+#define HEDGE_DELAY_MAX_US (UPSTREAM_TIMEOUT_MS * 1000 / 2)
+#define HEDGE_DELAY_DEFAULT_US 50000     // 样本不足时
+#define HEDGE_BURST 10                   // 最多积累的对冲次数
+// 恢复后缀时需要额外的空间
+#define WIRE_BUF_SIZE (BUF_SIZE + DNS_MAX_NAME)
+
+// 一次查询各阶段的单调时钟（纳秒），未经过的阶段为 0
+typedef struct {
+    uint64_t recv;              // 接收线程收到
+    uint64_t dequeue;           // 工作线程取出
+    uint64_t parsed;            // 解析完问题段
+    uint64_t upstream_send;     // 第一次发往上游
+    uint64_t upstream_recv;     // 收到上游响应
+    uint64_t answer;            // 响应生成完毕
+    uint64_t reply;             // 响应已发出
+    int upstream_tries;
+} query_trace_t;
 
 int test_forward_dns(void);
-int is_match_suffix(const char *name);
-void strip_dot(char *name);
-void strip_suffix(char *name);
+int refuse_unmatched(uint8_t *buf, size_t *len);
 ldns_resolver* create_fresh_resolver(void);
-ldns_pkt* modify_query_domain(ldns_pkt *original_pkt,  ldns_rdf *new_domain);
+int forward_query(const route_t *route, const uint8_t *buf, size_t len, uint16_t hops,
+                  int hedge_percent, uint8_t *resp, size_t *resp_len);
+void update_hedge_delay(void);
 void process_dns_query(int sockfd, const uint8_t *buf, ssize_t len,
-                        struct sockaddr_in *client, socklen_t client_len);
+                        struct sockaddr_in *client, socklen_t client_len, uint64_t recv_ns);
 #endif
@@ -0,0 +1,18 @@
+#ifndef DOCKER_H
+#define DOCKER_H
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t
+
+#define DOCKER_TTL 10
+#define DOCKER_MAX_CONTAINERS 1024      // 必须是2的幂
+#define DOCKER_MAX_ADDRS 4
+#define DOCKER_ID_LEN 65
+#define DOCKER_RETRY_MAX_SEC 60
+// 名称指针(2) + 类型(2) + 类别(2) + TTL(4) + 长度(2) + IPv4地址(4)
+#define DOCKER_ANSWER_LEN 16
+
+int start_docker_watcher(const char *socket_path);
+size_t handle_docker_query(const uint8_t *query, size_t qname_end, size_t suffix_len,
+                           uint8_t *resp, size_t cap);
+
+#endif
@@ -1,15 +1,25 @@
 #ifndef GATEWAY_H
 #define GATEWAY_H
+#include "snapshot.h"     // for snapshot_t
 #include <netinet/in.h>   // for in_addr
-// #include <ldns/packet.h>  // for ldns_pkt
-// #include <ldns/rr.h>      // for ldns_rr
-#include <ldns/ldns.h>
+#include <stddef.h>       // for size_t
+#include <stdint.h>       // for uint8_t
+
+#define GATEWAY_TTL 60
+#define NETLINK_BUF_SIZE 16384
+// 名称指针(2) + 类型(2) + 类别(2) + TTL(4) + 长度(2) + IPv4地址(4)
+#define GATEWAY_ANSWER_LEN 16
 
 extern struct in_addr gateway_addr; 
 
-int is_gateway_domain(const char *name);
+void init_gateway(void);
+void build_gateway_name(snapshot_t *s);
+void set_gateway_addr(struct in_addr addr);
+struct in_addr get_gateway_addr(void);
+int is_gateway_domain(const snapshot_t *s, const uint8_t *pkt, size_t qname_end);
 int resolve_gateway_ip(void);
-ldns_pkt* handle_gateway_query(ldns_pkt *query_pkt, ldns_rr *qrr, 
-    struct in_addr client_addr);
+int start_gateway_monitor(void);
+size_t handle_gateway_query(const snapshot_t *s, const uint8_t *query, size_t len,
+                            uint8_t *resp, size_t cap, struct in_addr client_addr);
 
 #endif
@@ -0,0 +1,32 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+#include <signal.h>   // for sig_atomic_t
+#include <stdint.h>   // for uint32_t
+
+// systemd 传入的第一个描述符
+#define LISTEN_FDS_START 3
+#define HANDOFF_MAGIC 0x444e5346   // "DNSF"
+#define HANDOFF_MAX_FDS 2
+#define HANDOFF_TIMEOUT_MS 5000
+// 交出套接字后等待正在处理的查询完成的最长时间
+#define HANDOFF_DRAIN_MS 10000
+
+// 随描述符一起发送的说明，kinds 与描述符一一对应
+typedef enum {
+    HANDOFF_DNS = 1,        // DNS UDP 套接字
+    HANDOFF_METRICS = 2     // 指标 TCP 侦听套接字
+} handoff_kind_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t kinds[HANDOFF_MAX_FDS];
+} handoff_msg_t;
+
+extern volatile sig_atomic_t handed_off;
+
+int inherit_listen_fds(int *dns_fd, int *metrics_fd);
+int receive_handoff(const char *path, int *dns_fd, int *metrics_fd);
+int start_handoff_server(const char *path, int dns_fd, int metrics_fd);
+
+#endif
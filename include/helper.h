@@ -12,6 +12,20 @@ typedef enum {
     OPT_KEEP_SUFFIX,
     OPT_MAX_HOPS,
     OPT_NUM_WORKERS,
+    OPT_ROUTE,
+    OPT_HOSTS,
+    OPT_DOCKER_SOCKET,
+    OPT_MINIMAL_RESPONSES,
+    OPT_QUERY_LOG,
+    OPT_QUERY_LOG_SIZE,
+    OPT_METRICS,
+    OPT_STATS_ALLOW,
+    OPT_SLOW_QUERY,
+    OPT_ENV_FILE,
+    OPT_UPGRADE_SOCKET,
+    OPT_CACHE_SIZE,
+    OPT_CACHE_FILE,
+    OPT_HEDGE_PERCENT,
     OPT_FOREGROUND,
     OPT_HELP,
     OPT_VERSION
@@ -1,7 +1,13 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
-#include <stdio.h>  // for va_list
+#include <netinet/in.h>  // for in_addr
+#include <stdio.h>       // for va_list
+
+#define LOG_LINE_MAX 512
+#define LOG_RING_SLOTS 256   // 必须是2的幂
+#define LOG_MAX_RINGS 32
+#define LOG_BATCH 64         // 每次 writev 最多写出的行数
 
 typedef enum {
     LOG_DEBUG = 0,
@@ -11,12 +17,28 @@ typedef enum {
     LOG_FATAL
 } log_level_t;
 
+// 编译时的最低日志级别，如 -DLOG_MIN_LEVEL=1 会把 DEBUG 日志完全编译掉
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
 extern log_level_t log_level;
 extern const char *level_str[];
 
+// 先判断级别再求值参数，被关闭的日志不会调用参数中的函数
+#define log_enabled(level) \
+    ((level) >= LOG_MIN_LEVEL && __builtin_expect((level) >= log_level, 0))
+
+#define log_msg(level, ...) \
+    do { \
+        if (log_enabled(level)) log_write((level), __VA_ARGS__); \
+    } while (0)
+
 void vlog_msg(log_level_t level, const char *format, va_list args);
-void log_msg(log_level_t level, const char *format, ...);
+void log_write(log_level_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+const char* log_addr(struct in_addr addr);
 void log_cleanup();
+int start_log_writer(void);
 int parse_log_level(const char *level_str, int default_val);
 
 #endif
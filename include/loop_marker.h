@@ -1,13 +1,13 @@
 #ifndef LOOP_MARKER_H
 #define LOOP_MARKER_H
 
-#include <stdint.h>       // for uint16_t
-// #include <ldns/packet.h>  // for ldns_pkt
-#include <ldns/ldns.h> 
+#include <stddef.h>       // for size_t
+#include <stdint.h>       // for uint16_t, uint8_t
 
 #define MY_OPTION_CODE 65001
 #define HOP_COUNT_DATA_LEN 2
+#define EDNS_UDP_SIZE 4096
 
-void add_loop_marker(ldns_pkt *pkt, uint16_t hop_count);
-uint16_t get_loop_marker(ldns_pkt *pkt);
+int add_loop_marker(uint8_t *pkt, size_t *len, size_t cap, uint16_t hop_count);
+uint16_t get_loop_marker(const uint8_t *pkt, size_t len);
 #endif
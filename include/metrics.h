@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint64_t
+#include <time.h>    // for clock_gettime, CLOCK_MONOTONIC
+
+#define METRICS_MAX_SHARDS 32
+#define METRICS_BUF_SIZE 131072
+#define METRICS_PREFIX "docker_dns_"
+
+// 对数线性直方图：每个2的幂区间分为 4 段，单位微秒，最后一个桶收纳更大的值
+#define HIST_SUB_BITS 2
+#define HIST_BUCKETS 100
+
+// 计数器，查询结果的顺序与 QLOG_SRC_* 相同
+typedef enum {
+    M_QUERIES_LOCAL,
+    M_QUERIES_GATEWAY,
+    M_QUERIES_DOCKER,
+    M_QUERIES_FORWARDED,
+    M_QUERIES_REFUSED,
+    M_QUERIES_LOOP,
+    M_QUERIES_CACHED,
+    M_UPSTREAM_TIMEOUTS,
+    M_UPSTREAM_ERRORS,
+    M_QUEUE_DROPS,
+    M_TRUNCATED,
+    M_CACHE_MISSES,
+    M_HEDGES,
+    M_HEDGE_WINS,
+    M_COUNTERS
+} metric_t;
+
+typedef enum {
+    H_TOTAL,        // 收到查询到发出响应
+    H_UPSTREAM,     // 单次上游往返
+    H_QUEUE,        // 在任务队列中等待
+    H_PARSE,        // 解析问题段
+    H_RESOLVE,      // 生成应答，包括上游往返
+    H_SEND,         // 裁剪响应并发出
+    H_COUNT
+} histogram_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_data_t;
+
+// 单调时钟（纳秒）
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void metric_inc(metric_t m);
+void metric_observe(histogram_t h, uint64_t ns);
+uint64_t metric_total(metric_t m);
+void metric_histogram(histogram_t h, hist_data_t *out);
+uint64_t hist_quantile(const hist_data_t *data, double q);
+size_t format_metrics(char *buf, size_t cap);
+int start_metrics_server(const char *listen, int *fd);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef PROBES_H
+#define PROBES_H
+#include <stdint.h>  // for uint64_t
+
+// USDT 静态探针，格式与 <sys/sdt.h> 相同（.note.stapsdt），bpftrace/perf 可直接使用：
+//   bpftrace -e 'usdt:/docker-dns:docker_dns:query_reply { @[arg1] = count(); }'
+// 未附加时每个探针只有一条 nop；构建镜像里没有 sys/sdt.h，这里直接生成注释段。
+// 参数一律按 8 字节整数传递，-DNO_PROBES 可完全去掉。
+#define PROBE_PROVIDER "docker_dns"
+
+#if !defined(NO_PROBES) && (defined(__x86_64__) || defined(__aarch64__))
+
+#define PROBE_ARG(x) "nor"((uint64_t)(x))
+
+#define PROBE_ASM(name, args, ...)                                              \
+    __asm__ __volatile__(                                                       \
+        "990: nop\n"                                                            \
+        ".pushsection .note.stapsdt,\"\",\"note\"\n"                            \
+        ".balign 4\n"                                                           \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                      \
+        "991: .asciz \"stapsdt\"\n"                                             \
+        "992: .balign 4\n"                                                      \
+        "993: .8byte 990b\n"                                                    \
+        ".8byte _.stapsdt.base\n"                                               \
+        ".8byte 0\n"                                                            \
+        ".asciz \"" PROBE_PROVIDER "\"\n"                                       \
+        ".asciz \"" #name "\"\n"                                                \
+        ".asciz \"" args "\"\n"                                                 \
+        "994: .balign 4\n"                                                      \
+        ".popsection\n"                                                         \
+        ".ifndef _.stapsdt.base\n"                                              \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n"                                                \
+        ".hidden _.stapsdt.base\n"                                              \
+        "_.stapsdt.base: .space 1\n"                                            \
+        ".size _.stapsdt.base, 1\n"                                             \
+        ".popsection\n"                                                         \
+        ".endif\n"                                                              \
+        :: __VA_ARGS__)
+
+#define PROBE0(name) PROBE_ASM(name, "")
+#define PROBE1(name, a) PROBE_ASM(name, "8@%0", PROBE_ARG(a))
+#define PROBE2(name, a, b) PROBE_ASM(name, "8@%0 8@%1", PROBE_ARG(a), PROBE_ARG(b))
+#define PROBE3(name, a, b, c) \
+    PROBE_ASM(name, "8@%0 8@%1 8@%2", PROBE_ARG(a), PROBE_ARG(b), PROBE_ARG(c))
+#define PROBE4(name, a, b, c, d) \
+    PROBE_ASM(name, "8@%0 8@%1 8@%2 8@%3", PROBE_ARG(a), PROBE_ARG(b), PROBE_ARG(c), PROBE_ARG(d))
+
+#else
+
+#define PROBE0(name) do {} while (0)
+#define PROBE1(name, a) do { (void)(a); } while (0)
+#define PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#define PROBE4(name, a, b, c, d) do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+
+#endif
+
+#endif
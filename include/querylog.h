@@ -0,0 +1,63 @@
+#ifndef QUERYLOG_H
+#define QUERYLOG_H
+#include <netinet/in.h>  // for sockaddr_in
+#include <stddef.h>      // for size_t
+#include <stdint.h>      // for uint8_t, uint16_t, uint32_t, uint64_t
+
+// 文件布局：一页文件头 | records[capacity]，字段均为本机字节序
+#define QLOG_MAGIC 0x4c514453        // "SDQL"
+#define QLOG_VERSION 1
+#define QLOG_HEADER_SIZE 4096
+#define QLOG_RECORD_SIZE 128
+#define QLOG_NAME_MAX 88              // 超长的名称只保留前缀
+#define QLOG_SIZE_MAX 4096            // MB
+
+// 应答来源
+#define QLOG_SRC_LOCAL   0
+#define QLOG_SRC_GATEWAY 1
+#define QLOG_SRC_DOCKER  2
+#define QLOG_SRC_FORWARD 3
+#define QLOG_SRC_REFUSED 4
+#define QLOG_SRC_LOOP    5
+#define QLOG_SRC_CACHE   6
+
+#define QLOG_FLAG_NAME_TRUNC 0x01     // qname 被截断
+#define QLOG_FLAG_TC         0x02     // 响应设置了 TC
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t capacity;                // 记录数，2的幂
+    uint64_t head;                    // 下一条记录的序号
+} qlog_header_t;
+
+typedef struct {
+    uint64_t seq;                     // 序号+1，0 表示空槽或正在写入
+    uint64_t ts_ns;                   // 收到查询的时间（CLOCK_REALTIME）
+    uint32_t latency_us;
+    uint32_t client_addr;             // 网络字节序
+    uint16_t client_port;
+    uint16_t id;
+    uint16_t qtype;
+    uint16_t query_len;
+    uint16_t resp_len;
+    uint8_t rcode;
+    uint8_t source;
+    uint8_t qname_len;                // 完整的线格式名称长度
+    uint8_t flags;
+    uint8_t pad[2];
+    uint8_t qname[QLOG_NAME_MAX];     // 线格式名称
+} qlog_record_t;
+
+_Static_assert(sizeof(qlog_record_t) == QLOG_RECORD_SIZE, "query log record size");
+
+extern qlog_header_t *qlog;
+
+#define querylog_enabled() (qlog != NULL)
+
+int open_querylog(const char *path, size_t size_mb);
+void querylog_write(const uint8_t *query, size_t query_len, const uint8_t *resp, size_t resp_len,
+                    const struct sockaddr_in *client, uint64_t start, uint8_t source);
+
+#endif
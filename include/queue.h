@@ -13,6 +13,7 @@ typedef struct {
     size_t len;
     struct sockaddr_in client_addr;
     socklen_t client_len;
+    uint64_t recv_ns;           // 接收时的单调时钟
 } dns_request_t;
 
 extern dns_request_t queue[];
@@ -20,6 +21,7 @@ extern int q_head, q_tail;
 extern pthread_mutex_t q_mutex;
 extern pthread_cond_t q_cond;
 
-void enqueue_request(dns_request_t *req);
+int enqueue_request(dns_request_t *req);
 void dequeue_request(dns_request_t *req);
+int queue_depth(void);
 #endif
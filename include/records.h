@@ -0,0 +1,16 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t
+
+#define RECORDS_TTL 60
+// 名称指针(2) + 类型(2) + 类别(2) + TTL(4) + 长度(2) + 地址
+#define RECORD_A_LEN    (12 + 4)
+#define RECORD_AAAA_LEN (12 + 16)
+
+int load_records(const char *path);
+size_t num_records(void);
+int is_local_name(const uint8_t *pkt, size_t qname_end);
+size_t handle_local_query(const uint8_t *query, size_t qname_end, uint8_t *resp, size_t cap);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+#include <netinet/in.h>  // for sockaddr_in
+#include <stddef.h>      // for size_t
+#include <stdint.h>      // for uint8_t
+
+#define MAX_ROUTES 16
+#define MAX_UPSTREAMS 4
+#define ROUTE_SUFFIX_LEN 64
+#define UPSTREAM_STR_LEN 24              // 最长为 255.255.255.255#65535
+#define ROUTES_MAX_LEN 1024
+
+// 反转标签的后缀树，每个节点按(父节点, 小写标签)哈希到子节点
+#define TRIE_MAX_NODES (MAX_ROUTES * ROUTE_SUFFIX_LEN / 2 + 1)
+#define TRIE_HASH_SIZE 1024
+
+typedef struct {
+    char suffix[ROUTE_SUFFIX_LEN];             // 如 .docker
+    uint8_t suffix_wire[ROUTE_SUFFIX_LEN];     // 小写线格式，不含根标签
+    size_t suffix_wire_len;
+    int keep_suffix;
+    int num_upstreams;
+    struct sockaddr_in upstreams[MAX_UPSTREAMS];
+    char upstream_str[MAX_UPSTREAMS][UPSTREAM_STR_LEN];
+} route_t;
+
+typedef struct {
+    const uint8_t *label;   // 指向路由后缀线格式中的标签（长度 + 小写字符）
+    uint16_t parent;
+    uint16_t child;         // 0 表示空槽，根节点不会作为子节点
+} trie_edge_t;
+
+// 路由表及其后缀树，构建后只读，随配置快照整体替换
+typedef struct {
+    route_t routes[MAX_ROUTES];
+    int num_routes;
+    trie_edge_t trie_edges[TRIE_HASH_SIZE];
+    int16_t trie_route[TRIE_MAX_NODES];
+    int trie_nodes;
+    int trie_fallback;      // 空后缀的路由匹配所有名称
+} route_table_t;
+
+// 配置中的路由，构建路由表时复制，0 号由默认配置生成
+extern route_t routes[MAX_ROUTES];
+extern int num_routes;
+
+int add_route(const char *spec);
+int add_routes(const char *specs);
+void reset_routes(void);
+int build_route_table(route_table_t *t);
+const route_t* match_route(const route_table_t *t, const uint8_t *pkt, size_t qname_end);
+
+#endif
@@ -3,6 +3,7 @@
 #include <signal.h>   // for sig_atomic_t
 
 extern volatile sig_atomic_t stop;
+extern volatile sig_atomic_t reload;
 
 void setup_signal_handlers(void);
 #endif
@@ -0,0 +1,35 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include "config.h"  // for gateway_name, suffix_domain
+#include "route.h"   // for route_table_t
+#include "wire.h"    // for DNS_MAX_NAME
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint64_t
+
+// 读者槽数，超出的线程共用一个引用计数
+#define SNAPSHOT_MAX_READERS 32
+
+// 查询路径上读取的配置，发布后不再修改，重新加载时整体替换
+typedef struct snapshot {
+    route_table_t routes;
+    char gateway_domain[sizeof(gateway_name) + sizeof(suffix_domain)];
+    uint8_t gateway_wire[DNS_MAX_NAME + 1];    // 小写线格式（含根标签），为空时不应答网关
+    size_t gateway_wire_len;
+    int max_hops;
+    int minimal_responses;
+    int slow_query_ms;
+    int hedge_percent;
+
+    uint64_t retired;                          // 被替换时的纪元
+    struct snapshot *next;                     // 待回收链表
+} snapshot_t;
+
+snapshot_t* build_snapshot(void);
+void publish_snapshot(snapshot_t *s);
+const snapshot_t* snapshot_enter(void);
+void snapshot_exit(void);
+void snapshot_release(void);
+int snapshot_idle(void);
+void reclaim_snapshots(void);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef WIRE_H
+#define WIRE_H
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint16_t
+
+#define DNS_HEADER_SIZE 12
+// 不使用EDNS时UDP报文的最大长度
+#define DNS_UDP_MIN_SIZE 512
+#define DNS_MAX_NAME 255
+// 域名文本形式的最大长度（每字节最多转义为 \DDD）
+#define DNS_NAME_STR_LEN (DNS_MAX_NAME * 4 + 1)
+
+// 报头字段偏移
+#define DNS_OFF_ID      0
+#define DNS_OFF_FLAGS   2
+#define DNS_OFF_QDCOUNT 4
+#define DNS_OFF_ANCOUNT 6
+#define DNS_OFF_NSCOUNT 8
+#define DNS_OFF_ARCOUNT 10
+
+#define DNS_FLAG_QR 0x8000
+#define DNS_OPCODE_MASK 0x7800
+#define DNS_FLAG_AA 0x0400
+#define DNS_FLAG_TC 0x0200
+#define DNS_FLAG_RD 0x0100
+#define DNS_FLAG_RA 0x0080
+#define DNS_FLAG_CD 0x0010
+#define DNS_EDNS_DO 0x8000         // OPT 记录 TTL 字段低 16 位中的 DO 标志
+#define DNS_OPT_HEADER_SIZE 11     // 根域名(1) + 类型(2) + 类别(2) + TTL(4) + 长度(2)
+#define DNS_RCODE_MASK 0x000f
+
+#define DNS_RCODE_NOERROR  0
+#define DNS_RCODE_FORMERR  1
+#define DNS_RCODE_SERVFAIL 2
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_RCODE_NOTIMPL  4
+#define DNS_RCODE_REFUSED  5
+
+#define DNS_TYPE_A    1
+#define DNS_TYPE_SOA  6
+#define DNS_TYPE_TXT  16
+#define DNS_TYPE_AAAA 28
+#define DNS_TYPE_OPT  41
+#define DNS_TYPE_ANY  255
+#define DNS_CLASS_IN  1
+#define DNS_CLASS_CH  3
+#define DNS_CLASS_ANY 255
+
+static inline uint16_t wire_get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void wire_set_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)(v & 0xff);
+}
+
+int wire_skip_name(const uint8_t *pkt, size_t len, size_t off, size_t *end);
+int wire_skip_rr(const uint8_t *pkt, size_t len, size_t off, size_t *end);
+int wire_question_end(const uint8_t *pkt, size_t len, size_t *qname_end, size_t *end);
+int wire_name_equal(const uint8_t *pkt, size_t len, size_t a, size_t b);
+int wire_question_equal(const uint8_t *a, size_t alen, const uint8_t *b, size_t blen);
+int wire_find_opt(const uint8_t *pkt, size_t len, size_t *rr_off);
+size_t wire_name_from_str(const char *str, uint8_t *out);
+size_t wire_name_to_str(const uint8_t *pkt, size_t len, size_t off, char *out, size_t cap);
+const char* wire_type_str(uint16_t type, char *buf, size_t cap);
+size_t wire_udp_size(const uint8_t *pkt, size_t len);
+size_t wire_fit_response(uint8_t *pkt, size_t len, size_t max, int minimal);
+size_t wire_make_error(uint8_t *pkt, size_t len, uint16_t rcode);
+int wire_splice(uint8_t *pkt, size_t *len, size_t cap, size_t off, size_t old_len,
+                const uint8_t *data, size_t new_len);
+
+#endif
@@ -0,0 +1,409 @@
+#include "cache.h"
+#include "handoff.h"     // for handed_off
+#include "logging.h"     // for log_msg, LOG_DEBUG, LOG_ERROR, LOG_INFO, LOG_WARN
+#include "metrics.h"     // for metric_inc, M_CACHE_MISSES
+#include "wire.h"        // for wire_question_end, wire_skip_name, wire_skip_rr, wire_find_opt, ...
+#include <errno.h>       // for errno, ENOENT
+#include <fcntl.h>       // for open, O_RDONLY, O_CLOEXEC
+#include <limits.h>      // for PATH_MAX
+#include <pthread.h>     // for pthread_mutex_t, pthread_create, pthread_detach
+#include <stdio.h>       // for FILE, fopen, fwrite, fflush, fclose, rename, snprintf
+#include <stdlib.h>      // for calloc
+#include <string.h>      // for memcpy, memcmp, strerror
+#include <sys/mman.h>    // for mmap, munmap, PROT_READ, MAP_PRIVATE
+#include <sys/stat.h>    // for fstat, stat
+#include <time.h>        // for time
+#include <unistd.h>      // for close, fsync, unlink, sleep
+
+// 键：标志字节 + 小写线格式问题名称 + 类型 + 类别
+#define CACHE_KEY_MAX (1 + DNS_MAX_NAME + 4)
+#define KEY_EDNS 0x01
+#define KEY_DO   0x02
+#define KEY_CD   0x04
+#define KEY_RD   0x08
+
+// 条目定长，整个表一次分配
+typedef struct {
+    int64_t expire;                   // 0 表示空槽
+    int64_t stored;
+    uint32_t hash;
+    uint16_t key_len;
+    uint16_t data_len;
+    uint8_t key[CACHE_KEY_MAX];
+    uint8_t data[CACHE_DATA_MAX];
+} cache_entry_t;
+
+static cache_entry_t *table;
+static size_t set_mask;
+static size_t used;                   // 非空槽数，包括已过期但未被替换的
+static pthread_mutex_t locks[CACHE_LOCKS];
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+static char cache_path[PATH_MAX];
+
+static inline uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void set_u32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t key_hash(const uint8_t *key, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 条目数向上取整为组数的2的幂
+int init_cache(size_t entries) {
+    if (entries == 0) return 0;
+    if (entries > CACHE_SIZE_MAX) {
+        log_msg(LOG_ERROR, "Invalid cache size %zu (maximum %d)", entries, CACHE_SIZE_MAX);
+        return 1;
+    }
+
+    size_t sets = 1;
+    while (sets * CACHE_WAYS < entries) sets *= 2;
+    table = calloc(sets * CACHE_WAYS, sizeof(cache_entry_t));
+    if (!table) {
+        log_msg(LOG_ERROR, "Failed to allocate cache of %zu entries", sets * CACHE_WAYS);
+        return 1;
+    }
+    set_mask = sets - 1;
+    for (int i = 0; i < CACHE_LOCKS; i++) pthread_mutex_init(&locks[i], NULL);
+    return 0;
+}
+
+int cache_enabled(void) {
+    return table != NULL;
+}
+
+size_t cache_entries(void) {
+    return __atomic_load_n(&used, __ATOMIC_RELAXED);
+}
+
+// 由查询生成键，影响上游应答的标志位也计入键中
+static size_t make_key(const uint8_t *query, size_t len, size_t qname_end, uint8_t *key) {
+    uint16_t flags = wire_get_u16(query + DNS_OFF_FLAGS);
+    size_t opt;
+    key[0] = 0;
+    if (flags & DNS_FLAG_CD) key[0] |= KEY_CD;
+    if (flags & DNS_FLAG_RD) key[0] |= KEY_RD;
+    if (wire_find_opt(query, len, &opt) == 1) {
+        key[0] |= KEY_EDNS;
+        // OPT 的名称是根标签，TTL 字段的低16位是标志
+        if (opt + 9 <= len && (wire_get_u16(query + opt + 7) & 0x8000)) key[0] |= KEY_DO;
+    }
+
+    size_t n = 1;
+    for (size_t i = DNS_HEADER_SIZE; i < qname_end + 4; i++) {
+        uint8_t c = query[i];
+        key[n++] = (i < qname_end && c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+    }
+    return n;
+}
+
+// 响应中最小的 TTL，否定应答还受 SOA MINIMUM 限制，返回 0 表示不缓存
+static uint32_t response_ttl(const uint8_t *pkt, size_t len) {
+    size_t off;
+    if (wire_question_end(pkt, len, NULL, &off) != 0) return 0;
+
+    size_t count = (size_t)wire_get_u16(pkt + DNS_OFF_ANCOUNT) +
+                   wire_get_u16(pkt + DNS_OFF_NSCOUNT) + wire_get_u16(pkt + DNS_OFF_ARCOUNT);
+    uint32_t ttl = CACHE_TTL_MAX;
+    int found = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t name_end, end;
+        if (wire_skip_name(pkt, len, off, &name_end) != 0 ||
+            wire_skip_rr(pkt, len, off, &end) != 0) return 0;
+        uint16_t type = wire_get_u16(pkt + name_end);
+        if (type != DNS_TYPE_OPT) {
+            uint32_t t = get_u32(pkt + name_end + 4);
+            if (t < ttl) ttl = t;
+            if (type == DNS_TYPE_SOA && end >= name_end + 14 && get_u32(pkt + end - 4) < ttl) {
+                ttl = get_u32(pkt + end - 4);
+            }
+            found = 1;
+        }
+        off = end;
+    }
+    return found ? ttl : CACHE_NEG_TTL;
+}
+
+// 按在缓存中停留的时间递减各记录的 TTL
+static void age_response(uint8_t *pkt, size_t len, uint32_t age) {
+    size_t off;
+    if (age == 0 || wire_question_end(pkt, len, NULL, &off) != 0) return;
+
+    size_t count = (size_t)wire_get_u16(pkt + DNS_OFF_ANCOUNT) +
+                   wire_get_u16(pkt + DNS_OFF_NSCOUNT) + wire_get_u16(pkt + DNS_OFF_ARCOUNT);
+    for (size_t i = 0; i < count; i++) {
+        size_t name_end, end;
+        if (wire_skip_name(pkt, len, off, &name_end) != 0 ||
+            wire_skip_rr(pkt, len, off, &end) != 0) return;
+        if (wire_get_u16(pkt + name_end) != DNS_TYPE_OPT) {
+            uint32_t t = get_u32(pkt + name_end + 4);
+            set_u32(pkt + name_end + 4, t > age ? t - age : 0);
+        }
+        off = end;
+    }
+}
+
+static pthread_mutex_t* set_lock(size_t set) {
+    return &locks[set & (CACHE_LOCKS - 1)];
+}
+
+// 写入条目：替换相同的键，否则依次选择空槽、已过期的槽、最早过期的槽
+static void insert_entry(const uint8_t *key, size_t key_len, uint32_t hash,
+                         const uint8_t *data, size_t data_len, int64_t expire, int64_t stored) {
+    size_t set = hash & set_mask;
+    int64_t now = time(NULL);
+    cache_entry_t *e = &table[set * CACHE_WAYS];
+
+    pthread_mutex_lock(set_lock(set));
+    cache_entry_t *victim = &e[0];
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (e[i].expire && e[i].hash == hash && e[i].key_len == key_len &&
+            memcmp(e[i].key, key, key_len) == 0) {
+            victim = &e[i];
+            break;
+        }
+        if (victim->expire > now && (e[i].expire <= now || e[i].expire < victim->expire)) victim = &e[i];
+    }
+    if (!victim->expire) __atomic_add_fetch(&used, 1, __ATOMIC_RELAXED);
+    victim->expire = expire;
+    victim->stored = stored;
+    victim->hash = hash;
+    victim->key_len = key_len;
+    victim->data_len = data_len;
+    memcpy(victim->key, key, key_len);
+    memcpy(victim->data, data, data_len);
+    pthread_mutex_unlock(set_lock(set));
+}
+
+// 查找缓存的应答，命中时写入 resp 并返回长度，ID 和问题段取自本次查询
+size_t cache_lookup(const uint8_t *query, size_t len, size_t qname_end, uint8_t *resp, size_t cap) {
+    if (!table) return 0;
+
+    uint8_t key[CACHE_KEY_MAX];
+    size_t key_len = make_key(query, len, qname_end, key);
+    uint32_t hash = key_hash(key, key_len);
+    size_t set = hash & set_mask;
+    int64_t now = time(NULL);
+    cache_entry_t *e = &table[set * CACHE_WAYS];
+
+    size_t n = 0;
+    int64_t stored = 0;
+    pthread_mutex_lock(set_lock(set));
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (e[i].expire > now && e[i].hash == hash && e[i].key_len == key_len &&
+            memcmp(e[i].key, key, key_len) == 0) {
+            if (e[i].data_len <= cap) {
+                memcpy(resp, e[i].data, e[i].data_len);
+                n = e[i].data_len;
+                stored = e[i].stored;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(set_lock(set));
+
+    if (!n) {
+        metric_inc(M_CACHE_MISSES);
+        return 0;
+    }
+    // 名称只有大小写可能不同，长度相同
+    memcpy(resp + DNS_HEADER_SIZE, query + DNS_HEADER_SIZE, qname_end + 4 - DNS_HEADER_SIZE);
+    wire_set_u16(resp + DNS_OFF_ID, wire_get_u16(query + DNS_OFF_ID));
+    age_response(resp, n, now > stored ? (uint32_t)(now - stored) : 0);
+    return n;
+}
+
+// 缓存上游的应答，只缓存没有截断的 NOERROR 和 NXDOMAIN
+void cache_store(const uint8_t *query, size_t len, size_t qname_end, const uint8_t *resp, size_t rlen) {
+    if (!table || rlen > CACHE_DATA_MAX) return;
+
+    uint16_t flags = wire_get_u16(resp + DNS_OFF_FLAGS);
+    uint16_t rcode = flags & DNS_RCODE_MASK;
+    if ((flags & DNS_FLAG_TC) || (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)) return;
+
+    uint32_t ttl = response_ttl(resp, rlen);
+    if (ttl == 0) return;
+
+    // OPT 的选项（如 cookie）只对当次查询有效，缓存时去掉
+    uint8_t data[CACHE_DATA_MAX];
+    size_t data_len = rlen;
+    memcpy(data, resp, rlen);
+    size_t opt, name_end;
+    if (wire_find_opt(data, data_len, &opt) == 1 && wire_skip_name(data, data_len, opt, &name_end) == 0) {
+        size_t rdlen = wire_get_u16(data + name_end + 8);
+        if (rdlen && wire_splice(data, &data_len, sizeof(data), name_end + 10, rdlen, NULL, 0) != 0) return;
+        wire_set_u16(data + name_end + 8, 0);
+    }
+
+    uint8_t key[CACHE_KEY_MAX];
+    size_t key_len = make_key(query, len, qname_end, key);
+    int64_t now = time(NULL);
+    insert_entry(key, key_len, key_hash(key, key_len), data, data_len, now + ttl, now);
+}
+
+// 清空缓存，重新加载配置后上游和路由可能已经改变
+void cache_flush(void) {
+    if (!table) return;
+    for (int i = 0; i < CACHE_LOCKS; i++) pthread_mutex_lock(&locks[i]);
+    for (size_t i = 0; i < (set_mask + 1) * CACHE_WAYS; i++) table[i].expire = 0;
+    __atomic_store_n(&used, 0, __ATOMIC_RELAXED);
+    for (int i = CACHE_LOCKS - 1; i >= 0; i--) pthread_mutex_unlock(&locks[i]);
+}
+
+// 写入临时文件后改名，进程中途退出时不会留下不完整的缓存文件
+int cache_save(const char *path) {
+    if (!table) return 0;
+
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        log_msg(LOG_ERROR, "Cache file path too long: %s", path);
+        return 1;
+    }
+
+    pthread_mutex_lock(&save_lock);
+    FILE *f = fopen(tmp, "wbe");
+    if (!f) {
+        log_msg(LOG_ERROR, "Failed to create %s: %s", tmp, strerror(errno));
+        pthread_mutex_unlock(&save_lock);
+        return 1;
+    }
+
+    int64_t now = time(NULL);
+    cache_file_header_t header = { .magic = CACHE_FILE_MAGIC, .version = CACHE_FILE_VERSION, .saved = now };
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    // 逐条复制后再写文件，不在持锁时做 IO
+    cache_entry_t e;
+    for (size_t i = 0; ok && i < (set_mask + 1) * CACHE_WAYS; i++) {
+        pthread_mutex_lock(set_lock(i / CACHE_WAYS));
+        int valid = table[i].expire > now;
+        if (valid) memcpy(&e, &table[i], sizeof(e));
+        pthread_mutex_unlock(set_lock(i / CACHE_WAYS));
+        if (!valid) continue;
+
+        cache_file_record_t rec = { .expire = e.expire, .stored = e.stored,
+                                    .key_len = e.key_len, .data_len = e.data_len };
+        ok = fwrite(&rec, sizeof(rec), 1, f) == 1 &&
+             fwrite(e.key, 1, e.key_len, f) == e.key_len &&
+             fwrite(e.data, 1, e.data_len, f) == e.data_len;
+        header.count++;
+    }
+
+    // 最后补上记录数
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1 &&
+         fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        log_msg(LOG_ERROR, "Failed to write cache file %s: %s", path, strerror(errno));
+        unlink(tmp);
+        pthread_mutex_unlock(&save_lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&save_lock);
+
+    log_msg(LOG_DEBUG, "Saved %u cached answers to %s", header.count, path);
+    return 0;
+}
+
+// 映射缓存文件并导入仍然有效的条目，文件不存在时不算错误
+int cache_load(const char *path) {
+    if (!table) return 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return 0;
+        log_msg(LOG_ERROR, "Failed to open cache file %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cache_file_header_t)) {
+        log_msg(LOG_ERROR, "Invalid cache file %s", path);
+        close(fd);
+        return 1;
+    }
+    size_t size = st.st_size;
+    const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_msg(LOG_ERROR, "Failed to map cache file %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    cache_file_header_t header;
+    memcpy(&header, map, sizeof(header));
+    if (header.magic != CACHE_FILE_MAGIC || header.version != CACHE_FILE_VERSION) {
+        log_msg(LOG_WARN, "Ignoring cache file %s with unknown format", path);
+        munmap((void*)map, size);
+        return 1;
+    }
+
+    // 记录是变长的，逐条复制出记录头再检查长度
+    int64_t now = time(NULL);
+    size_t off = sizeof(header), loaded = 0, expired = 0;
+    for (uint32_t i = 0; i < header.count; i++) {
+        cache_file_record_t rec;
+        if (off + sizeof(rec) > size) break;
+        memcpy(&rec, map + off, sizeof(rec));
+        off += sizeof(rec);
+        if (rec.key_len > CACHE_KEY_MAX || rec.data_len > CACHE_DATA_MAX ||
+            rec.data_len < DNS_HEADER_SIZE || off + rec.key_len + rec.data_len > size) break;
+
+        const uint8_t *key = map + off;
+        const uint8_t *data = key + rec.key_len;
+        off += rec.key_len + rec.data_len;
+        if (rec.expire <= now) {
+            expired++;
+            continue;
+        }
+        insert_entry(key, rec.key_len, key_hash(key, rec.key_len), data, rec.data_len,
+                     rec.expire, rec.stored);
+        loaded++;
+    }
+    munmap((void*)map, size);
+
+    if (loaded + expired < header.count) {
+        log_msg(LOG_WARN, "Cache file %s is truncated after %zu records", path, loaded + expired);
+    }
+    log_msg(LOG_INFO, "Loaded %zu cached answers from %s (%zu expired)", loaded, path, expired);
+    return 0;
+}
+
+// 先导入上次保存的缓存，再定期保存
+static void* cache_thread(void *arg) {
+    (void)arg;
+    cache_load(cache_path);
+    while (1) {
+        sleep(CACHE_SAVE_INTERVAL);
+        // 已交出套接字后由新进程保存
+        if (handed_off) break;
+        cache_save(cache_path);
+    }
+    return NULL;
+}
+
+// 在后台导入和保存缓存文件，不推迟开始应答
+int start_cache_persistence(const char *path) {
+    if (!table) return 0;
+    snprintf(cache_path, sizeof(cache_path), "%s", path);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, cache_thread, NULL) != 0) {
+        log_msg(LOG_ERROR, "Failed to create cache thread");
+        return 1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
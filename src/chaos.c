@@ -0,0 +1,233 @@
+#include "cache.h"       // for cache_enabled, cache_entries
+#include "chaos.h"
+#include "config.h"      // for VERSION
+#include "logging.h"     // for log_msg, log_addr, LOG_ERROR, LOG_DEBUG
+#include "metrics.h"     // for metric_total, metric_histogram, hist_quantile
+#include "queue.h"       // for queue_depth
+#include "records.h"     // for num_records
+#include "wire.h"        // for wire_question_end, wire_make_error, wire_set_u16, ...
+#include <arpa/inet.h>   // for inet_pton, htonl, ntohl
+#include <stdio.h>       // for snprintf
+#include <stdlib.h>      // for strtol
+#include <string.h>      // for memcpy, strchr, strcspn, strlen
+#include <time.h>        // for time, time_t
+
+typedef struct {
+    uint32_t net;        // 主机字节序
+    uint32_t mask;
+} chaos_allow_t;
+
+static chaos_allow_t allow_list[CHAOS_MAX_ALLOW];
+static int num_allow;
+static time_t start_time;
+
+typedef enum { CH_VERSION, CH_STATS, CH_CACHE } chaos_name_t;
+
+static const struct {
+    const char *name;
+    chaos_name_t kind;
+} chaos_names[] = {
+    {"version.bind.", CH_VERSION},
+    {"version.server.", CH_VERSION},
+    {"version." CHAOS_DOMAIN, CH_VERSION},
+    {"stats." CHAOS_DOMAIN, CH_STATS},
+    {"cache." CHAOS_DOMAIN, CH_CACHE},
+};
+
+#define NUM_CHAOS_NAMES (sizeof(chaos_names) / sizeof(chaos_names[0]))
+
+static uint8_t chaos_wire[NUM_CHAOS_NAMES][DNS_MAX_NAME + 1];
+static size_t chaos_wire_len[NUM_CHAOS_NAMES];
+
+// 解析逗号分隔的 ADDR[/PREFIX] 列表
+static int parse_allow(const char *list) {
+    num_allow = 0;
+    while (*list) {
+        size_t n = strcspn(list, ",");
+        char item[32];
+        if (n == 0) {
+            list++;
+            continue;
+        }
+        if (n >= sizeof(item) || num_allow >= CHAOS_MAX_ALLOW) return 1;
+        memcpy(item, list, n);
+        item[n] = '\0';
+        list += n;
+
+        long prefix = 32;
+        char *slash = strchr(item, '/');
+        if (slash) {
+            char *end;
+            *slash = '\0';
+            prefix = strtol(slash + 1, &end, 10);
+            if (end == slash + 1 || *end || prefix < 0 || prefix > 32) return 1;
+        }
+        struct in_addr addr;
+        if (inet_pton(AF_INET, item, &addr) != 1) return 1;
+
+        uint32_t mask = prefix ? 0xffffffffu << (32 - prefix) : 0;
+        allow_list[num_allow].net = ntohl(addr.s_addr) & mask;
+        allow_list[num_allow].mask = mask;
+        num_allow++;
+    }
+    return 0;
+}
+
+// 初始化允许查询的来源地址和名称表
+int init_chaos(const char *allow) {
+    if (parse_allow(allow) != 0) {
+        log_msg(LOG_ERROR, "Invalid stats allow list '%s'. Format: ADDR[/PREFIX][,...]", allow);
+        return 1;
+    }
+    for (size_t i = 0; i < NUM_CHAOS_NAMES; i++) {
+        chaos_wire_len[i] = wire_name_from_str(chaos_names[i].name, chaos_wire[i]);
+    }
+    start_time = time(NULL);
+    return 0;
+}
+
+static int is_allowed(struct in_addr client) {
+    uint32_t a = ntohl(client.s_addr);
+    for (int i = 0; i < num_allow; i++) {
+        if ((a & allow_list[i].mask) == allow_list[i].net) return 1;
+    }
+    return 0;
+}
+
+// 名称比较不区分大小写；长度字节都小于 'A'，可以整体转换
+static int find_name(const uint8_t *pkt, size_t qname_end) {
+    size_t len = qname_end - DNS_HEADER_SIZE;
+    const uint8_t *name = pkt + DNS_HEADER_SIZE;
+    for (size_t i = 0; i < NUM_CHAOS_NAMES; i++) {
+        if (chaos_wire_len[i] != len) continue;
+        size_t j = 0;
+        while (j < len && (name[j] | ((name[j] >= 'A' && name[j] <= 'Z') ? 0x20 : 0)) == chaos_wire[i][j]) j++;
+        if (j == len) return i;
+    }
+    return -1;
+}
+
+// 运行状态，每行一个 TXT 记录
+static int stats_lines(char lines[][CHAOS_LINE_MAX + 1]) {
+    int n = 0;
+    hist_data_t total, upstream;
+    metric_histogram(H_TOTAL, &total);
+    metric_histogram(H_UPSTREAM, &upstream);
+
+    snprintf(lines[n++], CHAOS_LINE_MAX + 1, "uptime=%lld version=%s",
+             (long long)(time(NULL) - start_time), VERSION);
+    snprintf(lines[n++], CHAOS_LINE_MAX + 1,
+             "queries local=%llu gateway=%llu docker=%llu forwarded=%llu cached=%llu refused=%llu loop=%llu",
+             (unsigned long long)metric_total(M_QUERIES_LOCAL),
+             (unsigned long long)metric_total(M_QUERIES_GATEWAY),
+             (unsigned long long)metric_total(M_QUERIES_DOCKER),
+             (unsigned long long)metric_total(M_QUERIES_FORWARDED),
+             (unsigned long long)metric_total(M_QUERIES_CACHED),
+             (unsigned long long)metric_total(M_QUERIES_REFUSED),
+             (unsigned long long)metric_total(M_QUERIES_LOOP));
+    snprintf(lines[n++], CHAOS_LINE_MAX + 1,
+             "upstream timeouts=%llu errors=%llu truncated=%llu hedged=%llu hedge_wins=%llu",
+             (unsigned long long)metric_total(M_UPSTREAM_TIMEOUTS),
+             (unsigned long long)metric_total(M_UPSTREAM_ERRORS),
+             (unsigned long long)metric_total(M_TRUNCATED),
+             (unsigned long long)metric_total(M_HEDGES),
+             (unsigned long long)metric_total(M_HEDGE_WINS));
+    snprintf(lines[n++], CHAOS_LINE_MAX + 1, "queue depth=%d drops=%llu",
+             queue_depth(), (unsigned long long)metric_total(M_QUEUE_DROPS));
+    snprintf(lines[n++], CHAOS_LINE_MAX + 1, "latency_us p50=%llu p90=%llu p99=%llu p999=%llu",
+             (unsigned long long)hist_quantile(&total, 0.5),
+             (unsigned long long)hist_quantile(&total, 0.9),
+             (unsigned long long)hist_quantile(&total, 0.99),
+             (unsigned long long)hist_quantile(&total, 0.999));
+    snprintf(lines[n++], CHAOS_LINE_MAX + 1, "upstream_us p50=%llu p90=%llu p99=%llu p999=%llu",
+             (unsigned long long)hist_quantile(&upstream, 0.5),
+             (unsigned long long)hist_quantile(&upstream, 0.9),
+             (unsigned long long)hist_quantile(&upstream, 0.99),
+             (unsigned long long)hist_quantile(&upstream, 0.999));
+    snprintf(lines[n++], CHAOS_LINE_MAX + 1, "records=%zu", num_records());
+    return n;
+}
+
+// 在接收线程上原地应答 CH 类查询，已处理返回 1
+// 不经过任务队列，工作线程繁忙时也能查询
+int handle_chaos_query(uint8_t *buf, size_t *len, size_t cap, struct in_addr client) {
+    size_t qname_end;
+    if (*len < DNS_HEADER_SIZE) return 0;
+    if (wire_get_u16(buf + DNS_OFF_FLAGS) & (DNS_FLAG_QR | DNS_OPCODE_MASK)) return 0;
+    if (wire_get_u16(buf + DNS_OFF_QDCOUNT) != 1) return 0;
+    if (wire_question_end(buf, *len, &qname_end, NULL) != 0) return 0;
+    if (wire_get_u16(buf + qname_end + 2) != DNS_CLASS_CH) return 0;
+
+    size_t udp_size = wire_udp_size(buf, *len);
+    uint16_t qtype = wire_get_u16(buf + qname_end);
+    int idx = find_name(buf, qname_end);
+
+    uint16_t rcode = DNS_RCODE_NOERROR;
+    if (!is_allowed(client)) {
+        log_msg(LOG_DEBUG, "Refused CHAOS query from %s", log_addr(client));
+        rcode = DNS_RCODE_REFUSED;
+    } else if (idx < 0) {
+        rcode = DNS_RCODE_NXDOMAIN;
+    }
+
+    size_t n = wire_make_error(buf, *len, rcode);
+    if (!n) return 0;
+    if (rcode != DNS_RCODE_NOERROR || (qtype != DNS_TYPE_TXT && qtype != DNS_TYPE_ANY)) {
+        *len = n;
+        return 1;
+    }
+
+    // 答案要放在 OPT 之前，先取下 OPT，写完答案再放回
+    uint8_t opt[DNS_OPT_HEADER_SIZE];
+    int edns = wire_get_u16(buf + DNS_OFF_ARCOUNT) != 0;
+    if (edns) {
+        n -= DNS_OPT_HEADER_SIZE;
+        memcpy(opt, buf + n, sizeof(opt));
+    }
+
+    char lines[CHAOS_MAX_LINES][CHAOS_LINE_MAX + 1];
+    int count = 0;
+    switch (chaos_names[idx].kind) {
+        case CH_VERSION:
+            snprintf(lines[count++], CHAOS_LINE_MAX + 1, "docker-dns %s", VERSION);
+            break;
+        case CH_STATS:
+            count = stats_lines(lines);
+            break;
+        case CH_CACHE:
+            if (!cache_enabled()) {
+                snprintf(lines[count++], CHAOS_LINE_MAX + 1, "cache disabled");
+                break;
+            }
+            snprintf(lines[count++], CHAOS_LINE_MAX + 1, "entries=%zu hits=%llu misses=%llu",
+                     cache_entries(), (unsigned long long)metric_total(M_QUERIES_CACHED),
+                     (unsigned long long)metric_total(M_CACHE_MISSES));
+            break;
+    }
+
+    // 名称指针(2) + 类型(2) + 类别(2) + TTL(4) + 长度(2) + 字符串
+    uint16_t ancount = 0;
+    for (int i = 0; i < count; i++) {
+        size_t slen = strlen(lines[i]);
+        if (n + 13 + slen + (edns ? sizeof(opt) : 0) > cap) break;
+        uint8_t *p = buf + n;
+        wire_set_u16(p, 0xc000 | DNS_HEADER_SIZE);
+        wire_set_u16(p + 2, DNS_TYPE_TXT);
+        wire_set_u16(p + 4, DNS_CLASS_CH);
+        wire_set_u16(p + 6, 0);
+        wire_set_u16(p + 8, 0);
+        wire_set_u16(p + 10, slen + 1);
+        p[12] = slen;
+        memcpy(p + 13, lines[i], slen);
+        n += 13 + slen;
+        ancount++;
+    }
+    wire_set_u16(buf + DNS_OFF_ANCOUNT, ancount);
+    if (edns) {
+        memcpy(buf + n, opt, sizeof(opt));
+        n += sizeof(opt);
+    }
+
+    *len = wire_fit_response(buf, n, udp_size, 0);
+    return 1;
+}
@@ -1,77 +1,314 @@
+#include "cache.h"    // for CACHE_SIZE_MAX
 #include "config.h"
 #include "helper.h"   // for print_help, get_option_type, OPT_CONTAINER, OPT...
 #include "logging.h"  // for log_msg, LOG_FATAL, parse_log_level, log_level
+#include "route.h"    // for add_route, add_routes, reset_routes, routes, num_routes
+#include "snapshot.h" // for build_snapshot, snapshot_t
 #include <errno.h>    // for errno, ERANGE
-#include <limits.h>   // for INT_MAX, INT_MIN, LONG_MAX, LONG_MIN
-#include <stdio.h>    // for fprintf, printf, stderr
-#include <stdlib.h>   // for exit, free, getenv, malloc, strtol
-#include <string.h>   // for strncpy, memmove, strlen
+#include <limits.h>   // for INT_MAX, INT_MIN, LONG_MAX, LONG_MIN, PATH_MAX
+#include <stdio.h>    // for fprintf, printf, stderr, fopen, fread
+#include <stdlib.h>   // for exit, free, getenv, malloc, strtol, realpath
+#include <string.h>   // for strncpy, memmove, strlen, strcmp, strtok_r
 
 int max_hops = MAX_HOPS_DEFAULT;
 int num_workers = NUM_WORKERS_DEFAULT;
 int keep_suffix = KEEP_SUFFIX_DEFAULT;
+int minimal_responses = MINIMAL_RESPONSES_DEFAULT;
 int foreground = 0;
 int listen_port = LISTEN_PORT_DEFAULT;
+int query_log_size = QUERY_LOG_SIZE_DEFAULT;
+int slow_query_ms = SLOW_QUERY_DEFAULT;
+int cache_size = CACHE_SIZE_DEFAULT;
+int hedge_percent = HEDGE_PERCENT_DEFAULT;
 char forward_dns[16] = FORWARD_DNS_DEFAULT;
 char container_name[256] = {0};
 char gateway_name[64] = {0};
 char suffix_domain[64] = {0};
+char hosts_file[256] = {0};
+char docker_socket_path[108] = {0};
+char query_log_path[256] = {0};
+char metrics_listen[32] = {0};
+char stats_allow[256] = {0};
+char env_file[256] = {0};
+char upgrade_socket[108] = {0};
+char cache_file[256] = {0};
 
-// 初始化配置(环境变量)
-void init_config_env(void) {
+// 配置文件中的 KEY=VALUE，优先于环境变量，重新加载时整体替换
+static char *env_file_data;
+static const char *env_file_keys[ENV_FILE_MAX_ENTRIES];
+static const char *env_file_values[ENV_FILE_MAX_ENTRIES];
+static int env_file_entries;
 
-    // 从环境变量读取
-    log_level = parse_log_level(getenv(LOG_LEVEL_ENV), LOG_INFO);
+// 重新加载时再次应用命令行参数，保证其优先级不变
+static int saved_argc;
+static char **saved_argv;
+
+// 读取配置项，配置文件中后出现的同名项生效
+static const char* config_getenv(const char *name) {
+    for (int i = env_file_entries - 1; i >= 0; i--) {
+        if (strcmp(env_file_keys[i], name) == 0) return env_file_values[i];
+    }
+    return getenv(name);
+}
+
+// 读取 KEY=VALUE 格式的配置文件（与 docker --env-file 相同），出错时保留原内容并返回 1
+static int load_env_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        log_msg(LOG_ERROR, "Failed to open %s: %s", path, strerror(errno));
+        return 1;
+    }
+    char *data = malloc(ENV_FILE_MAX_SIZE + 1);
+    size_t n = data ? fread(data, 1, ENV_FILE_MAX_SIZE + 1, fp) : 0;
+    int err = ferror(fp);
+    fclose(fp);
+    if (!data || err || n > ENV_FILE_MAX_SIZE) {
+        log_msg(LOG_ERROR, "Failed to read %s (at most %d bytes)", path, ENV_FILE_MAX_SIZE);
+        free(data);
+        return 1;
+    }
+    data[n] = '\0';
+
+    const char *keys[ENV_FILE_MAX_ENTRIES], *values[ENV_FILE_MAX_ENTRIES];
+    int entries = 0, lineno = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(data, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        lineno++;
+        line[strcspn(line, "\r")] = '\0';
+        while (*line == ' ' || *line == '\t') line++;
+        if (*line == '\0' || *line == '#') continue;
+
+        char *eq = strchr(line, '=');
+        if (!eq || eq == line || entries >= ENV_FILE_MAX_ENTRIES) {
+            log_msg(LOG_ERROR, "Invalid line %d in %s", lineno, path);
+            free(data);
+            return 1;
+        }
+        *eq = '\0';
+        keys[entries] = line;
+        values[entries++] = eq + 1;
+    }
+
+    free(env_file_data);
+    env_file_data = data;
+    memcpy(env_file_keys, keys, sizeof(keys[0]) * entries);
+    memcpy(env_file_values, values, sizeof(values[0]) * entries);
+    env_file_entries = entries;
+    return 0;
+}
+
+// 读取配置文件，路径来自 --env-file 或 ENV_FILE，需在 init_config_env 之前调用
+void init_config_file(int argc, char *argv[]) {
+    saved_argc = argc;
+    saved_argv = argv;
+
+    read_env(ENV_FILE_ENV, "", env_file, sizeof(env_file));
+    for (int i = 1; i < argc - 1; i++) {
+        if (get_option_type(argv[i]) == OPT_ENV_FILE) {
+            strncpy(env_file, argv[++i], sizeof(env_file) - 1);
+            env_file[sizeof(env_file) - 1] = '\0';
+        }
+    }
+    if (!env_file[0]) return;
+
+    // 守护进程会切换到根目录，先转为绝对路径供重新加载使用
+    char path[PATH_MAX];
+    if (!realpath(env_file, path) || strlen(path) >= sizeof(env_file) || load_env_file(path) != 0) {
+        log_msg(LOG_FATAL, "Failed to load env file %s", env_file);
+        exit(1);
+    }
+    strcpy(env_file, path);
+}
+
+// 读取可以热加载的配置项，出错时返回 1
+static int read_reloadable_env(void) {
     read_env(GATEWAY_ENV, GATEWAY_DEFAULT, gateway_name, sizeof(gateway_name));
-    read_env(CONTAINER_ENV, CONTAINER_DEFAULT, container_name, sizeof(container_name));
     read_env(SUFFIX_ENV, SUFFIX_DEFAULT, suffix_domain, sizeof(suffix_domain));
     read_env(FORWARD_DNS_ENV, FORWARD_DNS_DEFAULT, forward_dns, sizeof(forward_dns));
 
-    char *endptr;
-    
-    // 侦听端口号
-    int *env_port;
-    env_port = str2int(getenv(LISTEN_PORT_ENV));
-    if (env_port != NULL) {
-        listen_port = *env_port;
-        free(env_port);
-        if (listen_port <= 0 || listen_port > 65535){
-            log_msg(LOG_FATAL, "Invalid port number %d", listen_port);
-            exit(1);
-        }
-    }
-    
     // 保留后缀转发
     int *env_keep_suffix;
-    env_keep_suffix =  str2int(getenv(KEEP_SUFFIX_ENV));
+    keep_suffix = KEEP_SUFFIX_DEFAULT;
+    env_keep_suffix =  str2int(config_getenv(KEEP_SUFFIX_ENV));
     if (env_keep_suffix != NULL){
         keep_suffix = (*env_keep_suffix == 0) ? 0 : 1;
         free(env_keep_suffix);
     }
     
+    // 精简响应
+    int *env_minimal;
+    minimal_responses = MINIMAL_RESPONSES_DEFAULT;
+    env_minimal = str2int(config_getenv(MINIMAL_RESPONSES_ENV));
+    if (env_minimal != NULL){
+        minimal_responses = (*env_minimal == 0) ? 0 : 1;
+        free(env_minimal);
+    }
+
     // 最大跳数（防止循环）
     int *env_max_hops;
-    env_max_hops =  str2int(getenv(MAX_HOPS_ENV));
+    max_hops = MAX_HOPS_DEFAULT;
+    env_max_hops =  str2int(config_getenv(MAX_HOPS_ENV));
     if (env_max_hops != NULL){
         max_hops = *env_max_hops;
         free(env_max_hops);
         if (max_hops <= 0 || max_hops > 10){
-            log_msg(LOG_FATAL, "Invalid number of max hops. Must be between 1 and 10."); 
-            exit(1);
+            log_msg(LOG_ERROR, "Invalid number of max hops. Must be between 1 and 10."); 
+            return 1;
         }    
     }
 
     // 工作线程数
     int *env_num_workers;
-    env_num_workers =  str2int(getenv(NUM_WORKERS_ENV));
+    num_workers = NUM_WORKERS_DEFAULT;
+    env_num_workers =  str2int(config_getenv(NUM_WORKERS_ENV));
     if (env_num_workers != NULL){
         num_workers = *env_num_workers;
         free(env_num_workers);
         if (num_workers <= 0 || num_workers > 10){
-            log_msg(LOG_FATAL, "Invalid number of workers. Must be between 1 and 10."); 
-            exit(1);
+            log_msg(LOG_ERROR, "Invalid number of workers. Must be between 1 and 10."); 
+            return 1;
         }       
     }
+
+    // 慢查询阈值（毫秒）
+    int *env_slow_query;
+    slow_query_ms = SLOW_QUERY_DEFAULT;
+    env_slow_query = str2int(config_getenv(SLOW_QUERY_ENV));
+    if (env_slow_query != NULL){
+        slow_query_ms = *env_slow_query;
+        free(env_slow_query);
+        if (slow_query_ms < 0 || slow_query_ms > 60000){
+            log_msg(LOG_ERROR, "Invalid slow query threshold. Must be between 0 and 60000 ms.");
+            return 1;
+        }
+    }
+
+    // 可以对冲的转发查询比例（百分比）
+    int *env_hedge;
+    hedge_percent = HEDGE_PERCENT_DEFAULT;
+    env_hedge = str2int(config_getenv(HEDGE_PERCENT_ENV));
+    if (env_hedge != NULL){
+        hedge_percent = *env_hedge;
+        free(env_hedge);
+        if (hedge_percent < 0 || hedge_percent > 50){
+            log_msg(LOG_ERROR, "Invalid hedge percent. Must be between 0 and 50.");
+            return 1;
+        }
+    }
+
+    // 额外的后缀路由
+    reset_routes();
+    if (add_routes(config_getenv(ROUTES_ENV)) != 0) {
+        log_msg(LOG_ERROR, "Invalid %s. Format: SUFFIX=DNS[,DNS...][:keep|:strip];...", ROUTES_ENV);
+        return 1;
+    }
+    return 0;
+}
+
+// 初始化配置(环境变量)
+void init_config_env(void) {
+
+    // 从环境变量读取
+    log_level = parse_log_level(config_getenv(LOG_LEVEL_ENV), LOG_INFO);
+    read_env(CONTAINER_ENV, CONTAINER_DEFAULT, container_name, sizeof(container_name));
+    read_env(HOSTS_ENV, "", hosts_file, sizeof(hosts_file));
+    read_env(DOCKER_SOCKET_ENV, "", docker_socket_path, sizeof(docker_socket_path));
+    read_env(QUERY_LOG_ENV, "", query_log_path, sizeof(query_log_path));
+    read_env(METRICS_ENV, "", metrics_listen, sizeof(metrics_listen));
+    read_env(STATS_ALLOW_ENV, STATS_ALLOW_DEFAULT, stats_allow, sizeof(stats_allow));
+    read_env(UPGRADE_SOCKET_ENV, "", upgrade_socket, sizeof(upgrade_socket));
+    read_env(CACHE_FILE_ENV, "", cache_file, sizeof(cache_file));
+
+    char *endptr;
+    
+    // 侦听端口号
+    int *env_port;
+    env_port = str2int(config_getenv(LISTEN_PORT_ENV));
+    if (env_port != NULL) {
+        listen_port = *env_port;
+        free(env_port);
+        if (listen_port <= 0 || listen_port > 65535){
+            log_msg(LOG_FATAL, "Invalid port number %d", listen_port);
+            exit(1);
+        }
+    }
+
+    // 查询日志文件大小（MB）
+    int *env_query_log_size;
+    env_query_log_size = str2int(config_getenv(QUERY_LOG_SIZE_ENV));
+    if (env_query_log_size != NULL){
+        query_log_size = *env_query_log_size;
+        free(env_query_log_size);
+        if (query_log_size <= 0 || query_log_size > 4096){
+            log_msg(LOG_FATAL, "Invalid query log size. Must be between 1 and 4096 MB.");
+            exit(1);
+        }
+    }
+
+    // 应答缓存条数，0 表示不缓存
+    int *env_cache_size;
+    env_cache_size = str2int(config_getenv(CACHE_SIZE_ENV));
+    if (env_cache_size != NULL){
+        cache_size = *env_cache_size;
+        free(env_cache_size);
+        if (cache_size < 0 || cache_size > CACHE_SIZE_MAX){
+            log_msg(LOG_FATAL, "Invalid cache size. Must be between 0 and %d entries.", CACHE_SIZE_MAX);
+            exit(1);
+        }
+    }
+
+    if (read_reloadable_env() != 0) exit(1);
+}
+
+// 重新读取配置文件并重新应用命令行参数，只更新可热加载的配置项
+// 返回由新配置生成的快照，出错时恢复原配置并返回 NULL
+snapshot_t* reload_config(void) {
+    struct {
+        int max_hops, num_workers, keep_suffix, minimal_responses, slow_query_ms, hedge_percent, num_routes;
+        char forward_dns[sizeof(forward_dns)];
+        char gateway_name[sizeof(gateway_name)];
+        char suffix_domain[sizeof(suffix_domain)];
+        route_t routes[MAX_ROUTES];
+    } saved;
+
+    if (!env_file[0]) {
+        log_msg(LOG_WARN, "No %s set, the environment of a running process cannot change", ENV_FILE_ENV);
+        return NULL;
+    }
+    if (load_env_file(env_file) != 0) return NULL;
+
+    saved.max_hops = max_hops;
+    saved.num_workers = num_workers;
+    saved.keep_suffix = keep_suffix;
+    saved.minimal_responses = minimal_responses;
+    saved.slow_query_ms = slow_query_ms;
+    saved.hedge_percent = hedge_percent;
+    saved.num_routes = num_routes;
+    memcpy(saved.forward_dns, forward_dns, sizeof(forward_dns));
+    memcpy(saved.gateway_name, gateway_name, sizeof(gateway_name));
+    memcpy(saved.suffix_domain, suffix_domain, sizeof(suffix_domain));
+    memcpy(saved.routes, routes, sizeof(routes));
+
+    // 命令行参数在启动时已经校验过，再次应用不会失败
+    snapshot_t *s = NULL;
+    if (read_reloadable_env() == 0) {
+        init_config_argc(saved_argc, saved_argv);
+        s = build_snapshot();
+    }
+    if (s) return s;
+
+    max_hops = saved.max_hops;
+    num_workers = saved.num_workers;
+    keep_suffix = saved.keep_suffix;
+    minimal_responses = saved.minimal_responses;
+    slow_query_ms = saved.slow_query_ms;
+    hedge_percent = saved.hedge_percent;
+    num_routes = saved.num_routes;
+    memcpy(forward_dns, saved.forward_dns, sizeof(forward_dns));
+    memcpy(gateway_name, saved.gateway_name, sizeof(gateway_name));
+    memcpy(suffix_domain, saved.suffix_domain, sizeof(suffix_domain));
+    memcpy(routes, saved.routes, sizeof(routes));
+    return NULL;
 }
 
 // 初始化配置(命令行参数)
@@ -157,6 +394,10 @@ void init_config_argc(int argc, char *argv[]) {
                 keep_suffix = 1;
                 break;
 
+            case OPT_MINIMAL_RESPONSES:
+                minimal_responses = 1;
+                break;
+
             case OPT_FOREGROUND:
                 foreground = 1;
                 break;
@@ -196,10 +437,173 @@ void init_config_argc(int argc, char *argv[]) {
                         exit(1);
                     }
                 } else {
-                    log_msg(LOG_FATAL, "Invalid workers number %d", argv_workers);
+                    log_msg(LOG_FATAL, "Invalid workers number %s", argv_workers);
                 }
                 break;
                 
+            case OPT_ROUTE:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--route requires a value");
+                    exit(1);
+                }
+                if (add_route(argv[++i]) != 0) {
+                    log_msg(LOG_FATAL, "Invalid route '%s'. Format: SUFFIX=DNS[,DNS...][:keep|:strip]", argv[i]);
+                    exit(1);
+                }
+                break;
+
+            case OPT_HOSTS:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--hosts requires a value");
+                    exit(1);
+                }
+                strncpy(hosts_file, argv[++i], sizeof(hosts_file) - 1);
+                hosts_file[sizeof(hosts_file) - 1] = '\0';
+                break;
+
+            case OPT_DOCKER_SOCKET:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--docker-socket requires a value");
+                    exit(1);
+                }
+                strncpy(docker_socket_path, argv[++i], sizeof(docker_socket_path) - 1);
+                docker_socket_path[sizeof(docker_socket_path) - 1] = '\0';
+                break;
+
+            case OPT_QUERY_LOG:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--query-log requires a value");
+                    exit(1);
+                }
+                strncpy(query_log_path, argv[++i], sizeof(query_log_path) - 1);
+                query_log_path[sizeof(query_log_path) - 1] = '\0';
+                break;
+
+            case OPT_QUERY_LOG_SIZE:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--query-log-size requires a value");
+                    exit(1);
+                }
+                char *argv_qlog_size = argv[++i];
+                int *argv_query_log_size = str2int(argv_qlog_size);
+                if (argv_query_log_size != NULL){
+                    query_log_size = *argv_query_log_size;
+                    free(argv_query_log_size);
+                    if (query_log_size <= 0 || query_log_size > 4096) {
+                        log_msg(LOG_FATAL, "Invalid query log size. Must be between 1 and 4096 MB.");
+                        exit(1);
+                    }
+                } else {
+                    log_msg(LOG_FATAL, "Invalid query log size %s", argv_qlog_size);
+                    exit(1);
+                }
+                break;
+
+            case OPT_METRICS:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--metrics requires a value");
+                    exit(1);
+                }
+                strncpy(metrics_listen, argv[++i], sizeof(metrics_listen) - 1);
+                metrics_listen[sizeof(metrics_listen) - 1] = '\0';
+                break;
+
+            case OPT_STATS_ALLOW:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--stats-allow requires a value");
+                    exit(1);
+                }
+                strncpy(stats_allow, argv[++i], sizeof(stats_allow) - 1);
+                stats_allow[sizeof(stats_allow) - 1] = '\0';
+                break;
+
+            case OPT_SLOW_QUERY:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--slow-query-ms requires a value");
+                    exit(1);
+                }
+                char *argv_slow = argv[++i];
+                int *argv_slow_query = str2int(argv_slow);
+                if (argv_slow_query != NULL){
+                    slow_query_ms = *argv_slow_query;
+                    free(argv_slow_query);
+                    if (slow_query_ms < 0 || slow_query_ms > 60000) {
+                        log_msg(LOG_FATAL, "Invalid slow query threshold. Must be between 0 and 60000 ms.");
+                        exit(1);
+                    }
+                } else {
+                    log_msg(LOG_FATAL, "Invalid slow query threshold %s", argv_slow);
+                    exit(1);
+                }
+                break;
+
+            case OPT_HEDGE_PERCENT:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--hedge-percent requires a value");
+                    exit(1);
+                }
+                char *argv_hedge = argv[++i];
+                int *argv_hedge_percent = str2int(argv_hedge);
+                if (argv_hedge_percent != NULL){
+                    hedge_percent = *argv_hedge_percent;
+                    free(argv_hedge_percent);
+                    if (hedge_percent < 0 || hedge_percent > 50) {
+                        log_msg(LOG_FATAL, "Invalid hedge percent. Must be between 0 and 50.");
+                        exit(1);
+                    }
+                } else {
+                    log_msg(LOG_FATAL, "Invalid hedge percent %s", argv_hedge);
+                    exit(1);
+                }
+                break;
+
+            case OPT_CACHE_SIZE:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--cache-size requires a value");
+                    exit(1);
+                }
+                char *argv_cache = argv[++i];
+                int *argv_cache_size = str2int(argv_cache);
+                if (argv_cache_size != NULL){
+                    cache_size = *argv_cache_size;
+                    free(argv_cache_size);
+                    if (cache_size < 0 || cache_size > CACHE_SIZE_MAX) {
+                        log_msg(LOG_FATAL, "Invalid cache size. Must be between 0 and %d entries.", CACHE_SIZE_MAX);
+                        exit(1);
+                    }
+                } else {
+                    log_msg(LOG_FATAL, "Invalid cache size %s", argv_cache);
+                    exit(1);
+                }
+                break;
+
+            case OPT_CACHE_FILE:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--cache-file requires a value");
+                    exit(1);
+                }
+                strncpy(cache_file, argv[++i], sizeof(cache_file) - 1);
+                cache_file[sizeof(cache_file) - 1] = '\0';
+                break;
+
+            case OPT_UPGRADE_SOCKET:
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--upgrade-socket requires a value");
+                    exit(1);
+                }
+                strncpy(upgrade_socket, argv[++i], sizeof(upgrade_socket) - 1);
+                upgrade_socket[sizeof(upgrade_socket) - 1] = '\0';
+                break;
+
+            case OPT_ENV_FILE:
+                // 已由 init_config_file 读取
+                if (i + 1 >= argc) {
+                    log_msg(LOG_FATAL, "--env-file requires a value");
+                    exit(1);
+                }
+                i++;
+                break;
+
             case OPT_HELP:
                 print_help(argv[0]);
                 exit(0);
@@ -251,7 +655,7 @@ void read_env(const char *env_name, const char *default_val, char *dest, size_t
         exit(1);
     }
 
-    const char *env_value = getenv(env_name);
+    const char *env_value = config_getenv(env_name);
     if (env_value) {
         strncpy(dest, env_value, dest_size - 1);
         dest[dest_size - 1] = '\0';
@@ -1,17 +1,25 @@
-#include "config.h"          // for forward_dns, suffix_domain, container_name
+#include "cache.h"           // for cache_lookup, cache_store
+#include "config.h"          // for forward_dns, container_name
 #include "dns.h"
+#include "docker.h"          // for handle_docker_query
 #include "gateway.h"         // for handle_gateway_query, is_gateway_domain
 #include "logging.h"         // for log_msg, LOG_DEBUG, LOG_ERROR, LOG_WARN
 #include "loop_marker.h"     // for add_loop_marker, get_loop_marker
-#include <arpa/inet.h>       // for inet_ntoa, ntohs
+#include "metrics.h"         // for metric_inc, metric_observe, monotonic_ns
+#include "probes.h"          // for PROBE2, PROBE3, PROBE4
+#include "querylog.h"        // for querylog_write, QLOG_SRC_FORWARD
+#include "records.h"         // for handle_local_query, is_local_name
+#include "route.h"           // for match_route, route_t
+#include "snapshot.h"        // for snapshot_t, snapshot_enter, snapshot_exit
+#include "wire.h"            // for wire_splice, wire_question_end, wire_get_u16
+#include <arpa/inet.h>       // for inet_pton, ntohs
 #include <errno.h>           // for errno
 #include <netinet/in.h>      // for sockaddr_in
+#include <poll.h>            // for poll, pollfd, POLLIN
 #include <stdint.h>          // for uint8_t, uint16_t
 #include <stdio.h>           // for NULL
-#include <stdlib.h>          // for free
-#include <string.h>          // for strlen, strcspn, strdup, strerror
-#include <strings.h>         // for strncasecmp
-#include <sys/time.h>        // for timeval
+#include <string.h>          // for memcpy, strerror
+#include <unistd.h>          // for close
 // #include <ldns/error.h>      // for ldns_enum_status, ldns_status
 // #include <ldns/host2str.h>   // for ldns_rr_type2str, ldns_rdf2str
 // #include <ldns/host2wire.h>  // for ldns_pkt2wire
@@ -24,26 +32,12 @@
 int test_forward_dns(void) {
     log_msg(LOG_DEBUG, "Testing connection to forward DNS server %s", forward_dns);
     
-    ldns_resolver *test_resolver = ldns_resolver_new();
+    ldns_resolver *test_resolver = create_fresh_resolver();
     if (!test_resolver) {
         log_msg(LOG_ERROR, "Failed to create test resolver");
         return 0;
     }
 
-    ldns_rdf *ns_rdf = ldns_rdf_new_frm_str(LDNS_RDF_TYPE_A, forward_dns);
-    if (!ns_rdf) {
-        log_msg(LOG_ERROR, "Failed to create nameserver RDF for %s", forward_dns);
-        ldns_resolver_deep_free(test_resolver);
-        return 0;
-    }
-    
-    ldns_resolver_push_nameserver(test_resolver, ns_rdf);
-    ldns_rdf_deep_free(ns_rdf);
-
-    struct timeval tv = {2, 0};
-    ldns_resolver_set_timeout(test_resolver, tv);
-    ldns_resolver_set_retry(test_resolver, 1);
-
     ldns_rdf *test_name = NULL;
     ldns_str2rdf_dname(&test_name, container_name);
     
@@ -66,43 +60,22 @@ int test_forward_dns(void) {
     return 0;
 }
 
-// 检查是否是匹配后缀
-int is_match_suffix(const char *name) {
-    if (!name) return 0;
-    size_t len = strlen(name);
-    size_t suffix_len = strlen(suffix_domain);
-    if (len > 0 && name[len-1] == '.') len--;
-    int result = (len >= suffix_len && strncasecmp(name + len - suffix_len, suffix_domain, suffix_len) == 0);
-    log_msg(LOG_DEBUG, "Checking if '%s' is %s domain: %s",
-        name, suffix_domain, result ? "YES" : "NO");
-    return result;
-}
-
-// 移除尾部的点（FQDN）
-void strip_dot(char *name) {
-    if (!name) return;
-    size_t len = strlen(name);
-    
-    if (len > 0 && name[len-1] == '.') {
-        name[len-1] = '\0';
-        len--;
-    }
-}
-
-// 移除域名后缀
-void strip_suffix(char *name) {
-    if (!name) return;
-    size_t len = strlen(name);
-
-    // 先移除尾部的点（FQDN）
-    strip_dot(name);
-    
-    // 然后移除后缀
-    size_t suffix_len = strlen(suffix_domain);
-    if (len >= suffix_len) {
-        name[len - suffix_len] = '\0';
-        log_msg(LOG_DEBUG, "Stripped %s suffix, new name: '%s'", suffix_domain, name);
-    }
+// 不匹配后缀且不在本地记录中的标准查询直接原地改写为REFUSED，无需进入任务队列
+int refuse_unmatched(uint8_t *buf, size_t *len) {
+    size_t qname_end;
+    if (*len < DNS_HEADER_SIZE) return 0;
+    if (wire_get_u16(buf + DNS_OFF_FLAGS) & (DNS_FLAG_QR | DNS_OPCODE_MASK)) return 0;
+    if (wire_question_end(buf, *len, &qname_end, NULL) != 0) return 0;
+
+    const snapshot_t *conf = snapshot_enter();
+    int matched = match_route(&conf->routes, buf, qname_end) != NULL;
+    snapshot_exit();
+    if (matched || is_local_name(buf, qname_end)) return 0;
+
+    size_t n = wire_make_error(buf, *len, DNS_RCODE_REFUSED);
+    if (!n) return 0;
+    *len = n;
+    return 1;
 }
 
 // 创建一个新的resolver
@@ -130,259 +103,434 @@ ldns_resolver* create_fresh_resolver(void) {
     return fresh_resolver;
 }
 
-// 克隆一个请求包并修改转发域名
-ldns_pkt* modify_query_domain(ldns_pkt *original_pkt,  ldns_rdf *new_domain) {
+// 每个工作线程独立的上游套接字
+static __thread int upstream_fd = -1;
+// 对冲查询使用另一个套接字（不同的源端口），额度以 1/100 次为单位
+static __thread int hedge_fd = -1;
+static __thread int hedge_tokens;
+// 对冲延迟（微秒），由主线程按上游往返时间的分位数更新
+static uint64_t hedge_delay_us = HEDGE_DELAY_DEFAULT_US;
 
-    ldns_rr_list *questions = ldns_pkt_question(original_pkt);
-    ldns_rr *original_question = ldns_rr_list_rr(questions, 0);
-    ldns_rr *new_question = ldns_rr_clone(original_question);
+// 每个工作线程复用的报文缓冲区，处理查询的过程中不再分配内存
+typedef struct {
+    uint8_t fwd[WIRE_BUF_SIZE];
+    uint8_t resp[WIRE_BUF_SIZE];
+} dns_scratch_t;
 
-    ldns_rr_set_owner(new_question, new_domain);
+static __thread dns_scratch_t scratch;
 
-    ldns_rr_list *new_questions = ldns_rr_list_new();
-    if (!new_questions) {
-        ldns_rr_free(new_question);
-        return NULL;
+// 当前查询各阶段的时间
+static __thread query_trace_t trace;
+
+_Static_assert(M_QUERIES_CACHED - M_QUERIES_LOCAL == QLOG_SRC_CACHE, "query counters follow QLOG_SRC_*");
+
+// 打开发往上游DNS的UDP套接字，slot 为线程保存套接字的位置
+static int open_upstream(int *slot) {
+    if (*slot >= 0) return *slot;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "Failed to create upstream socket: %s", strerror(errno));
+        return -1;
     }
-    ldns_rr_list_push_rr(new_questions, new_question);
 
-    ldns_pkt *new_pkt = ldns_pkt_clone(original_pkt);
-    if (!new_pkt) {
-        ldns_rr_list_deep_free(new_questions);
-        return NULL;
+    *slot = fd;
+    return fd;
+}
+
+// 接收一个报文，是 server 对该查询的响应时返回长度
+static ssize_t recv_response(int fd, const struct sockaddr_in *server,
+                             const uint8_t *query, size_t qlen, uint8_t *resp, size_t cap) {
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n = recvfrom(fd, resp, cap, 0, (struct sockaddr*)&from, &from_len);
+    // 丢弃超时查询迟到的响应和不匹配的报文
+    if (n >= DNS_HEADER_SIZE &&
+        from.sin_addr.s_addr == server->sin_addr.s_addr &&
+        from.sin_port == server->sin_port &&
+        wire_get_u16(resp + DNS_OFF_ID) == wire_get_u16(query + DNS_OFF_ID) &&
+        (wire_get_u16(resp + DNS_OFF_FLAGS) & DNS_FLAG_QR) &&
+        wire_question_equal(query, qlen, resp, n)) {
+        return n;
+    }
+    log_msg(LOG_DEBUG, "Discarded mismatched upstream response (%zd bytes)", n);
+    return -1;
+}
+
+// 从对冲套接字再发一份查询，额度不足或发送失败时返回 -1
+static int send_hedge(const struct sockaddr_in *hedge, const uint8_t *query, size_t qlen) {
+    if (hedge_tokens < 100) return -1;
+    int fd = open_upstream(&hedge_fd);
+    if (fd < 0) return -1;
+    if (sendto(fd, query, qlen, 0, (const struct sockaddr*)hedge, sizeof(*hedge)) != (ssize_t)qlen) {
+        log_msg(LOG_DEBUG, "Failed to send hedged query: %s", strerror(errno));
+        return -1;
+    }
+    hedge_tokens -= 100;
+    metric_inc(M_HEDGES);
+    PROBE2(upstream_hedge, wire_get_u16(query + DNS_OFF_ID), ntohl(hedge->sin_addr.s_addr));
+    return fd;
+}
+
+// 发送查询到上游并等待匹配的响应
+// hedge 不为空时，超过对冲延迟仍未收到响应则向 hedge 再发一份，使用先到的有效响应
+static ssize_t exchange_upstream(const struct sockaddr_in *server, const struct sockaddr_in *hedge,
+                                 const uint8_t *query, size_t qlen, uint8_t *resp, size_t cap) {
+    int fd = open_upstream(&upstream_fd);
+    if (fd < 0) return -1;
+
+    if (sendto(fd, query, qlen, 0, (const struct sockaddr*)server, sizeof(*server)) != (ssize_t)qlen) {
+        log_msg(LOG_ERROR, "Failed to send query upstream: %s", strerror(errno));
+        metric_inc(M_UPSTREAM_ERRORS);
+        return -1;
     }
 
-    ldns_pkt_set_question(new_pkt, new_questions);
+    uint64_t start = monotonic_ns();
+    if (!trace.upstream_send) trace.upstream_send = start;
+    trace.upstream_tries++;
+    PROBE3(upstream_send, wire_get_u16(query + DNS_OFF_ID), ntohl(server->sin_addr.s_addr),
+           trace.upstream_tries);
+    int remaining = UPSTREAM_TIMEOUT_MS;
+
+    // 第二个槽位在发出对冲查询后才启用，poll 忽略负的描述符
+    struct pollfd pfd[2] = { { .fd = fd, .events = POLLIN }, { .fd = -1, .events = POLLIN } };
+    const struct sockaddr_in *peer[2] = { server, hedge };
+    uint64_t hedge_at = hedge ? start + __atomic_load_n(&hedge_delay_us, __ATOMIC_RELAXED) * 1000 : 0;
+
+    while (remaining > 0) {
+        int wait = remaining;
+        if (hedge_at) {
+            uint64_t now = monotonic_ns();
+            if (now >= hedge_at) {
+                pfd[1].fd = send_hedge(hedge, query, qlen);
+                hedge_at = 0;
+            } else if ((hedge_at - now + 999999) / 1000000 < (uint64_t)wait) {
+                wait = (hedge_at - now + 999999) / 1000000;
+            }
+        }
+
+        int ready = poll(pfd, 2, wait);
+        if (ready < 0 && errno != EINTR) {
+            metric_inc(M_UPSTREAM_ERRORS);
+            return -1;
+        }
 
-    return new_pkt;
+        for (int i = 0; ready > 0 && i < 2; i++) {
+            if (!(pfd[i].revents & POLLIN)) continue;
+            ssize_t n = recv_response(pfd[i].fd, peer[i], query, qlen, resp, cap);
+            if (n < 0) continue;
+            trace.upstream_recv = monotonic_ns();
+            metric_observe(H_UPSTREAM, trace.upstream_recv - start);
+            if (i == 1) metric_inc(M_HEDGE_WINS);
+            PROBE3(upstream_recv, wire_get_u16(resp + DNS_OFF_ID), trace.upstream_recv - start, n);
+            // 另一份迟到的响应ID不同，之后会被当作不匹配的报文丢弃
+            return n;
+        }
+
+        remaining = UPSTREAM_TIMEOUT_MS - (int)((monotonic_ns() - start) / 1000000);
+    }
+    metric_inc(M_UPSTREAM_TIMEOUTS);
+    PROBE2(upstream_timeout, wire_get_u16(query + DNS_OFF_ID), ntohl(server->sin_addr.s_addr));
+    return -1;
 }
 
-// 处理单个DNS查询
-void process_dns_query(int sockfd, const uint8_t *buf, ssize_t len,
-                        struct sockaddr_in *client, socklen_t client_len) {
+// 根据最近的上游往返时间更新对冲延迟，由主线程定期调用
+void update_hedge_delay(void) {
+    static uint64_t last;
+    static hist_data_t prev;
+    uint64_t now = monotonic_ns();
+    if (now - last < HEDGE_UPDATE_MS * 1000000ULL) return;
+    last = now;
+
+    // 只看上次更新以来的样本，样本太少时保留原延迟，继续累积
+    hist_data_t cur, window = {0};
+    metric_histogram(H_UPSTREAM, &cur);
+    window.count = cur.count - prev.count;
+    if (window.count < HEDGE_MIN_SAMPLES) return;
+    for (int b = 0; b < HIST_BUCKETS; b++) window.buckets[b] = cur.buckets[b] - prev.buckets[b];
+    prev = cur;
+
+    uint64_t us = hist_quantile(&window, HEDGE_QUANTILE);
+    if (us < HEDGE_DELAY_MIN_US) us = HEDGE_DELAY_MIN_US;
+    if (us > HEDGE_DELAY_MAX_US) us = HEDGE_DELAY_MAX_US;
+    if (__atomic_exchange_n(&hedge_delay_us, us, __ATOMIC_RELAXED) != us) {
+        log_msg(LOG_DEBUG, "Hedge delay set to %llu us", (unsigned long long)us);
+    }
+}
 
-    log_msg(LOG_DEBUG, "Processing DNS query from %s:%d (%zd bytes)", 
-                inet_ntoa(client->sin_addr), ntohs(client->sin_port), len);
+// 在线格式上转发查询：去掉后缀，发往上游，再在响应中恢复原始问题
+// hedge_percent 为可以对冲的查询比例，0 表示不对冲
+int forward_query(const route_t *route, const uint8_t *buf, size_t len, uint16_t hops,
+                  int hedge_percent, uint8_t *resp, size_t *resp_len) {
+    size_t qname_end, qend;
+    if (wire_question_end(buf, len, &qname_end, &qend) != 0) {
+        log_msg(LOG_ERROR, "Failed to locate question in DNS query");
+        return -1;
+    }
 
-    ldns_pkt *query_pkt = NULL;
-    if (ldns_wire2pkt(&query_pkt, buf, len) != LDNS_STATUS_OK || !query_pkt) {
-        log_msg(LOG_ERROR, "Failed to parse DNS query packet");
-        return;
+    uint8_t *fwd = scratch.fwd;
+    size_t flen = len;
+    memcpy(fwd, buf, len);
+
+    // 问题名称根标签的位置，后缀在它之前
+    size_t cut = qname_end - 1;
+    size_t suffix_len = route->keep_suffix ? 0 : route->suffix_wire_len;
+    size_t suffix_off = cut - suffix_len;
+
+    // 路由匹配已保证后缀从标签边界开始
+    if (suffix_len) {
+        if (wire_splice(fwd, &flen, sizeof(scratch.fwd), suffix_off, suffix_len, NULL, 0) != 0) {
+            log_msg(LOG_ERROR, "Failed to strip %s suffix from query", route->suffix);
+            return -1;
+        }
     }
 
-    ldns_rr_list *question = ldns_pkt_question(query_pkt);
-    if (!question || ldns_rr_list_rr_count(question) == 0) { 
-        log_msg(LOG_ERROR, "Failed to find questions in DNS query");
-        ldns_pkt_free(query_pkt); 
-        return; 
+    // 使用独立的ID，避免与超时查询的迟到响应混淆
+    wire_set_u16(fwd + DNS_OFF_ID, ldns_get_random());
+    if (add_loop_marker(fwd, &flen, sizeof(scratch.fwd), hops + 1) != 0) return -1;
+    log_msg(LOG_DEBUG, "Add loop marker hops -> %d", hops + 1);
+
+    // 每个转发的查询积累 hedge_percent/100 次对冲额度，有上限，空闲之后不会集中对冲
+    if (hedge_percent) {
+        hedge_tokens += hedge_percent;
+        if (hedge_tokens > HEDGE_BURST * 100) hedge_tokens = HEDGE_BURST * 100;
     }
 
-    ldns_rr *qrr = ldns_rr_list_rr(question, 0);
-    if (!qrr) {
-        log_msg(LOG_ERROR, "Failed to get question RR");
-        ldns_pkt_free(query_pkt);
-        return;
+    // 依次尝试路由中的上游，对冲查询发往下一个上游，只有一个上游时从另一个套接字发给它
+    ssize_t n = -1;
+    for (int i = 0; i < route->num_upstreams && n < 0; i++) {
+        const struct sockaddr_in *hedge = NULL;
+        if (hedge_percent) hedge = &route->upstreams[i + 1 < route->num_upstreams ? i + 1 : i];
+        n = exchange_upstream(&route->upstreams[i], hedge, fwd, flen, resp, BUF_SIZE);
+        if (n < 0) log_msg(LOG_DEBUG, "No response from upstream %s", route->upstream_str[i]);
+    }
+    if (n < 0) return -1;
+    size_t rlen = (size_t)n;
+
+    log_msg(LOG_DEBUG, "Forward DNS response: rcode %d (%d answers)",
+            wire_get_u16(resp + DNS_OFF_FLAGS) & DNS_RCODE_MASK,
+            wire_get_u16(resp + DNS_OFF_ANCOUNT));
+
+    size_t off;
+    if (wire_question_end(resp, rlen, NULL, &off) != 0) return -1;
+
+    // 将答案记录的域名改回原始域名（指向问题名称）
+    static const uint8_t qname_ptr[2] = { 0xc0, DNS_HEADER_SIZE };
+    size_t ancount = wire_get_u16(resp + DNS_OFF_ANCOUNT);
+    for (size_t i = 0; i < ancount; i++) {
+        size_t name_end;
+        if (wire_skip_name(resp, rlen, off, &name_end) != 0) return -1;
+        // 替换失败时报文保持不变，保留上游的原始名称即可
+        if (!(resp[off] & 0xc0) && wire_name_equal(resp, rlen, off, DNS_HEADER_SIZE)) {
+            wire_splice(resp, &rlen, WIRE_BUF_SIZE, off, name_end - off, qname_ptr, sizeof(qname_ptr));
+        }
+        if (wire_skip_rr(resp, rlen, off, &off) != 0) return -1;
     }
 
-    ldns_rdf *qname = ldns_rr_owner(qrr);
-    if (!qname) {
-        log_msg(LOG_ERROR, "Failed to get question name");
-        ldns_pkt_free(query_pkt);
-        return;
+    // 客户端没有使用EDNS时，不能返回OPT记录
+    size_t opt;
+    if (wire_find_opt(buf, len, &opt) != 1 && wire_find_opt(resp, rlen, &opt) == 1) {
+        size_t opt_end;
+        if (wire_skip_rr(resp, rlen, opt, &opt_end) != 0 ||
+            wire_splice(resp, &rlen, WIRE_BUF_SIZE, opt, opt_end - opt, NULL, 0) != 0) {
+            return -1;
+        }
+        wire_set_u16(resp + DNS_OFF_ARCOUNT, wire_get_u16(resp + DNS_OFF_ARCOUNT) - 1);
+    }
+
+    // 恢复后缀，并使用原始问题段（保留客户端的大小写）
+    if (suffix_len &&
+        wire_splice(resp, &rlen, WIRE_BUF_SIZE, suffix_off, 0, buf + suffix_off, suffix_len) != 0) {
+        log_msg(LOG_ERROR, "Failed to restore %s suffix in response", route->suffix);
+        return -1;
     }
+    memcpy(resp + DNS_HEADER_SIZE, buf + DNS_HEADER_SIZE, qend - DNS_HEADER_SIZE);
+    wire_set_u16(resp + DNS_OFF_ID, wire_get_u16(buf + DNS_OFF_ID));
+
+    *resp_len = rlen;
+    return 0;
+}
+
+// 发送响应给客户端
+static void send_response(int sockfd, const uint8_t *out, size_t outlen,
+                          struct sockaddr_in *client, socklen_t client_len) {
+    ssize_t sent = sendto(sockfd, out, outlen, 0, 
+                        (struct sockaddr*)client, client_len);
+    if (sent == -1) {
+        log_msg(LOG_ERROR, "Failed to send response: %s", strerror(errno));
+    } else if ((size_t)sent != outlen) {
+        log_msg(LOG_WARN, "Partial send: %zd of %zu bytes", sent, outlen);
+    } else {
+        log_msg(LOG_DEBUG, "Sent response (%zd bytes)", sent);
+    }
+}
+
+static uint64_t stage_us(uint64_t from, uint64_t to) {
+    return from && to > from ? (to - from) / 1000 : 0;
+}
+
+// 各阶段耗时计入直方图，超过阈值时输出一行跟踪日志
+static void finish_trace(const uint8_t *buf, size_t len, size_t qname_end, int slow_query_ms,
+                         const struct sockaddr_in *client, uint8_t source, uint16_t rcode) {
+    static const char *source_str[] = {"local", "gateway", "docker", "forward", "refused", "loop", "cache"};
+    uint64_t resolved = trace.answer ? trace.answer : trace.parsed;
+
+    metric_observe(H_TOTAL, trace.reply - trace.recv);
+    metric_observe(H_QUEUE, trace.dequeue - trace.recv);
+    metric_observe(H_PARSE, trace.parsed - trace.dequeue);
+    metric_observe(H_RESOLVE, resolved - trace.parsed);
+    metric_observe(H_SEND, trace.reply - resolved);
+
+    uint64_t total = trace.reply - trace.recv;
+    if (!slow_query_ms || total < (uint64_t)slow_query_ms * 1000000 || !log_enabled(LOG_WARN)) return;
+
+    char qname_str[DNS_NAME_STR_LEN], qtype_buf[16];
+    wire_name_to_str(buf, len, DNS_HEADER_SIZE, qname_str, sizeof(qname_str));
+    log_msg(LOG_WARN, "slow query id=%u client=%s:%u name=%s type=%s source=%s rcode=%u "
+            "total_us=%llu queue_us=%llu parse_us=%llu resolve_us=%llu upstream_us=%llu "
+            "upstream_tries=%d send_us=%llu",
+            wire_get_u16(buf + DNS_OFF_ID), log_addr(client->sin_addr), ntohs(client->sin_port),
+            qname_str, wire_type_str(wire_get_u16(buf + qname_end), qtype_buf, sizeof(qtype_buf)),
+            source_str[source], rcode,
+            (unsigned long long)(total / 1000),
+            (unsigned long long)stage_us(trace.recv, trace.dequeue),
+            (unsigned long long)stage_us(trace.dequeue, trace.parsed),
+            (unsigned long long)stage_us(trace.parsed, resolved),
+            (unsigned long long)stage_us(trace.upstream_send, trace.upstream_recv),
+            trace.upstream_tries,
+            (unsigned long long)stage_us(resolved, trace.reply));
+}
+
+// 处理单个DNS查询
+void process_dns_query(int sockfd, const uint8_t *buf, ssize_t len,
+                        struct sockaddr_in *client, socklen_t client_len, uint64_t recv_ns) {
 
-    char *qname_str = ldns_rdf2str(qname);
-    if (!qname_str) {
-        log_msg(LOG_ERROR, "Failed to convert question name to string");
-        ldns_pkt_free(query_pkt);
+    memset(&trace, 0, sizeof(trace));
+    trace.recv = recv_ns;
+    trace.dequeue = monotonic_ns();
+    PROBE2(query_dequeue, len >= DNS_HEADER_SIZE ? wire_get_u16(buf + DNS_OFF_ID) : 0,
+           trace.dequeue - trace.recv);
+
+    log_msg(LOG_DEBUG, "Processing DNS query from %s:%d (%zd bytes)", 
+                log_addr(client->sin_addr), ntohs(client->sin_port), len);
+
+    size_t qname_end;
+    if (wire_question_end(buf, len, &qname_end, NULL) != 0) {
+        log_msg(LOG_ERROR, "Failed to parse DNS query packet");
         return;
     }
 
-    ldns_pkt *resp_pkt = NULL;
+    // 整个查询使用同一份配置，处理期间重新加载不影响本次查询
+    const snapshot_t *conf = snapshot_enter();
+
+    uint8_t *resp_wire = scratch.resp;
+    size_t resp_len = 0;
+    uint16_t rcode = DNS_RCODE_REFUSED;
+    uint8_t source = QLOG_SRC_REFUSED;
 
     // 防止环路
-    uint16_t hops = get_loop_marker(query_pkt);
-    if (hops < max_hops) {
+    uint16_t hops = get_loop_marker(buf, len);
+    trace.parsed = monotonic_ns();
+
+    // 名称只在会被输出时才格式化，关闭日志时查询路径上没有字符串处理
+    char qname_str[DNS_NAME_STR_LEN] = "";
+    char qtype_buf[16];
+    const char *qtype_str = "";
+    if (log_enabled(hops < conf->max_hops ? LOG_INFO : LOG_WARN)) {
+        wire_name_to_str(buf, len, DNS_HEADER_SIZE, qname_str, sizeof(qname_str));
+        qtype_str = wire_type_str(wire_get_u16(buf + qname_end), qtype_buf, sizeof(qtype_buf));
+    }
 
-        qname_str[strcspn(qname_str, "\n")] = 0;
-        log_msg(LOG_DEBUG, "Query for: '%s', Type: %s, ID: %d", qname_str,
-                    ldns_rr_type2str(ldns_rr_get_type(qrr)), ldns_pkt_id(query_pkt));
+    if (hops < conf->max_hops) {
 
-        // 首先检查是否是配后缀的域名
-        if (!is_match_suffix(qname_str)) {
-            log_msg(LOG_DEBUG, "Not a %s domain, returning REFUSED", suffix_domain);
+        log_msg(LOG_DEBUG, "Query for: '%s', Type: %s, ID: %d", qname_str,
+                    qtype_str, wire_get_u16(buf + DNS_OFF_ID));
+
+        // 本地记录优先，无需转发
+        const route_t *route = NULL;
+        resp_len = handle_local_query(buf, qname_end, resp_wire, sizeof(scratch.resp));
+        if (resp_len) {
+            source = QLOG_SRC_LOCAL;
+            log_msg(LOG_DEBUG, "Answered '%s' from local records", qname_str);
+        }
+        // 其次检查是否是配后缀的域名
+        else if (!(route = match_route(&conf->routes, buf, qname_end))) {
+            log_msg(LOG_DEBUG, "'%s' matches no route, returning REFUSED", qname_str);
         } 
         else {
             // 然后检查是否是网关域名
-            if (gateway_name[0] && is_gateway_domain(qname_str)) {
+            if (route == &conf->routes.routes[0] && is_gateway_domain(conf, buf, qname_end)) {
                 log_msg(LOG_DEBUG, "Handling gateway domain: %s", qname_str);
-                resp_pkt = handle_gateway_query(query_pkt, qrr, client->sin_addr);
+                source = QLOG_SRC_GATEWAY;
+                resp_len = handle_gateway_query(conf, buf, len, resp_wire, sizeof(scratch.resp),
+                                                client->sin_addr);
+            }
+            // 容器表中的名称直接应答，未命中时转发
+            else if (route == &conf->routes.routes[0] &&
+                     (resp_len = handle_docker_query(buf, qname_end, route->suffix_wire_len,
+                                                     resp_wire, sizeof(scratch.resp)))) {
+                source = QLOG_SRC_DOCKER;
+                log_msg(LOG_DEBUG, "Answered '%s' from docker events", qname_str);
             }
             // 其他匹配后缀的域名
             else {
-                char *modified_name = strdup(qname_str);
-                if (modified_name) {
-                    if (!keep_suffix){
-                        strip_suffix(modified_name);
+                if ((resp_len = cache_lookup(buf, len, qname_end, resp_wire, sizeof(scratch.resp)))) {
+                    source = QLOG_SRC_CACHE;
+                    log_msg(LOG_DEBUG, "Answered '%s' from cache", qname_str);
+                } else {
+                    log_msg(LOG_INFO, "Forwarding %s query for '%s' from %s to %s",
+                        qtype_str,
+                        qname_str,
+                        log_addr(client->sin_addr),
+                        route->upstream_str[0]);
+
+                    source = QLOG_SRC_FORWARD;
+                    if (forward_query(route, buf, len, hops, conf->hedge_percent, resp_wire, &resp_len) != 0) {
+                        resp_len = 0;
+                        log_msg(LOG_DEBUG, "No response from forward DNS server for '%s' (this is expected for non-existent record)", qname_str);
                     } else {
-                        strip_dot(modified_name);
+                        cache_store(buf, len, qname_end, resp_wire, resp_len);
                     }
-
-                    ldns_rdf *rdf_name = NULL;
-                    if (ldns_str2rdf_dname(&rdf_name, modified_name) == LDNS_STATUS_OK && rdf_name) {
-                        // 为每个查询创建新的resolver，避免状态污染
-                        ldns_resolver *fresh_resolver = create_fresh_resolver();
-                        if (!fresh_resolver) {
-                            log_msg(LOG_ERROR, "Failed to create fresh resolver for query");
-                            ldns_rdf_deep_free(rdf_name);
-                            free(modified_name);
-                            free(qname_str);
-                            ldns_pkt_free(query_pkt);
-                            return;
-                        }
-                        
-                        ldns_pkt *clone_pkt = modify_query_domain(query_pkt, rdf_name);
-                        add_loop_marker(clone_pkt, hops + 1);
-                        log_msg(LOG_DEBUG, "Add loop marker hops -> %d", hops);
-
-                        log_msg(LOG_INFO, "Forwarding %s query for '%s' from %s to %s",
-                            ldns_rr_type2str(ldns_rr_get_type(qrr)),
-                            modified_name,
-                            inet_ntoa(client->sin_addr),
-                            forward_dns);
-
-                        ldns_pkt *forward_resp = NULL;
-                        ldns_status status = ldns_resolver_send_pkt(&forward_resp, fresh_resolver, clone_pkt);
-                        // ldns_pkt *forward_resp = ldns_resolver_query(fresh_resolver, rdf_name, 
-                        //                             ldns_rr_get_type(qrr), LDNS_RR_CLASS_IN, LDNS_RD);
-                        
-                        if (status == LDNS_STATUS_OK && forward_resp) {
-                            uint8_t rcode = ldns_pkt_get_rcode(forward_resp);
-                            const char* rcode_str = "UNKNOWN";
-                            switch(rcode) {
-                                case LDNS_RCODE_NOERROR:  rcode_str = "NOERROR";  break;
-                                case LDNS_RCODE_FORMERR:  rcode_str = "FORMERR";  break;
-                                case LDNS_RCODE_SERVFAIL: rcode_str = "SERVFAIL"; break;
-                                case LDNS_RCODE_NXDOMAIN: rcode_str = "NXDOMAIN"; break;
-                                case LDNS_RCODE_NOTIMPL:  rcode_str = "NOTIMPL";  break;
-                                case LDNS_RCODE_REFUSED:  rcode_str = "REFUSED";  break;
-                            }
-                            log_msg(LOG_DEBUG, "Forward DNS response: %s (%d answers)", 
-                                    rcode_str,
-                                    ldns_rr_list_rr_count(ldns_pkt_answer(forward_resp)));
-                            
-                            // 创建新的响应包，保持原始Question Section
-                            resp_pkt = ldns_pkt_new();
-                            if (resp_pkt) {
-                                // 复制基本属性
-                                ldns_pkt_set_id(resp_pkt, ldns_pkt_id(query_pkt));
-                                ldns_pkt_set_qr(resp_pkt, 1);
-                                ldns_pkt_set_aa(resp_pkt, ldns_pkt_aa(forward_resp));
-                                ldns_pkt_set_tc(resp_pkt, ldns_pkt_tc(forward_resp));
-                                ldns_pkt_set_rd(resp_pkt, ldns_pkt_rd(forward_resp));
-                                ldns_pkt_set_ra(resp_pkt, ldns_pkt_ra(forward_resp));
-                                ldns_pkt_set_rcode(resp_pkt, ldns_pkt_get_rcode(forward_resp));
-                                
-                                // 使用原始查询的Question Section
-                                ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_QUESTION, ldns_rr_clone(qrr));
-                                
-                                // 复制Answer Section中的记录，但需要修改域名
-                                ldns_rr_list *answers = ldns_pkt_answer(forward_resp);
-                                if (answers) {
-                                    for (size_t i = 0; i < ldns_rr_list_rr_count(answers); i++) {
-                                        ldns_rr *answer_rr = ldns_rr_clone(ldns_rr_list_rr(answers, i));
-                                        if (answer_rr) {
-                                            // 将答案记录的域名改回原始域名
-                                            ldns_rr_set_owner(answer_rr, ldns_rdf_clone(qname));
-                                            ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_ANSWER, answer_rr);
-                                        }
-                                    }
-                                }
-                                
-                                // 复制Authority Section
-                                ldns_rr_list *authority = ldns_pkt_authority(forward_resp);
-                                if (authority) {
-                                    for (size_t i = 0; i < ldns_rr_list_rr_count(authority); i++) {
-                                        ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_AUTHORITY, 
-                                                        ldns_rr_clone(ldns_rr_list_rr(authority, i)));
-                                    }
-                                }
-                                
-                                // 复制Additional Section
-                                ldns_rr_list *additional = ldns_pkt_additional(forward_resp);
-                                if (additional) {
-                                    for (size_t i = 0; i < ldns_rr_list_rr_count(additional); i++) {
-                                        ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_ADDITIONAL, 
-                                                        ldns_rr_clone(ldns_rr_list_rr(additional, i)));
-                                    }
-                                }
-                                
-                                log_msg(LOG_DEBUG, "Created response with original question section");
-                            }
-                            
-                            ldns_pkt_free(forward_resp);
-                        } else {
-                            log_msg(LOG_DEBUG, "No response from forward DNS server for '%s' (this is expected for non-existent record)", modified_name);
-                        }
-                        
-                        // 释放为此查询创建的resolver
-                        ldns_resolver_deep_free(fresh_resolver);
-                        ldns_rdf_deep_free(rdf_name);
-                    } else {
-                        log_msg(LOG_ERROR, "Failed to create RDF name for '%s'", modified_name);
-                    }
-                    free(modified_name);
                 }
             }
         }
         
-        if (!resp_pkt) {
-            log_msg(LOG_DEBUG, "Creating REFUSED response");
-            resp_pkt = ldns_pkt_new();
-            if (resp_pkt) {
-                ldns_pkt_set_id(resp_pkt, ldns_pkt_id(query_pkt));
-                ldns_pkt_set_qr(resp_pkt, 1);
-                ldns_pkt_set_aa(resp_pkt, 1);
-                ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_REFUSED);
-                ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_QUESTION, ldns_rr_clone(qrr));
-            }
-        }
+        if (!resp_len) log_msg(LOG_DEBUG, "Creating REFUSED response");
     }else{
-        log_msg(LOG_WARN, "DNS forwarding loop detected: query for '%s' exceeded maximum hop count (5)", qname_str);
+        log_msg(LOG_WARN, "DNS forwarding loop detected: query for '%s' exceeded maximum hop count (%d)", qname_str, conf->max_hops);
         log_msg(LOG_DEBUG, "Creating SERVFAIL response");
+        rcode = DNS_RCODE_SERVFAIL;
+        source = QLOG_SRC_LOOP;
+    }
 
-        resp_pkt = ldns_pkt_new();
-        if (resp_pkt) {
-            ldns_pkt_set_id(resp_pkt, ldns_pkt_id(query_pkt));
-            ldns_pkt_set_qr(resp_pkt, 1);
-            ldns_pkt_set_aa(resp_pkt, 1);
-            ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_SERVFAIL);
-            ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_QUESTION, ldns_rr_clone(qrr));
-        }
+    // 没有应答时原地生成只含问题段的错误响应
+    if (!resp_len) {
+        memcpy(resp_wire, buf, len);
+        resp_len = wire_make_error(resp_wire, len, rcode);
     }
 
-    if (resp_pkt) {
-        uint8_t *out = NULL;
-        size_t outlen = 0;
-        
-        if (ldns_pkt2wire(&out, resp_pkt, &outlen) == LDNS_STATUS_OK && out) {
-            ssize_t sent = sendto(sockfd, out, outlen, 0, 
-                                (struct sockaddr*)client, client_len);
-            if (sent == -1) {
-                log_msg(LOG_ERROR, "Failed to send response: %s", strerror(errno));
-            } else if (sent != outlen) {
-                log_msg(LOG_WARN, "Partial send: %zd of %zu bytes", sent, outlen);
-            } else {
-                log_msg(LOG_DEBUG, "Sent response (%zd bytes)", sent);
-            }
-            free(out);
-        } else {
-            log_msg(LOG_DEBUG, "Failed to serialize response packet");
-        }
-        
-        ldns_pkt_free(resp_pkt);
+    trace.answer = monotonic_ns();
+    PROBE2(query_resolve, wire_get_u16(buf + DNS_OFF_ID), source);
+    if (resp_len) {
+        // 按客户端通告的UDP大小裁剪响应
+        resp_len = wire_fit_response(resp_wire, resp_len, wire_udp_size(buf, len), conf->minimal_responses);
+        send_response(sockfd, resp_wire, resp_len, client, client_len);
+        if (wire_get_u16(resp_wire + DNS_OFF_FLAGS) & DNS_FLAG_TC) metric_inc(M_TRUNCATED);
+    } else {
+        log_msg(LOG_DEBUG, "Failed to build response packet");
+    }
+    trace.reply = monotonic_ns();
+    PROBE4(query_reply, wire_get_u16(buf + DNS_OFF_ID),
+           resp_len ? wire_get_u16(resp_wire + DNS_OFF_FLAGS) & DNS_RCODE_MASK : rcode,
+           resp_len, trace.reply - trace.recv);
+
+    // 查询结果计数器的顺序与应答来源相同
+    metric_inc(M_QUERIES_LOCAL + source);
+    finish_trace(buf, len, qname_end, conf->slow_query_ms, client, source,
+                 resp_len ? wire_get_u16(resp_wire + DNS_OFF_FLAGS) & DNS_RCODE_MASK : rcode);
+    snapshot_exit();
+    if (querylog_enabled()) {
+        querylog_write(buf, len, resp_wire, resp_len, client, recv_ns, source);
     }
     log_msg(LOG_DEBUG, "Finished processing query for '%s'", qname_str);
-    free(qname_str);
-    ldns_pkt_free(query_pkt);
 }
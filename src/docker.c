@@ -0,0 +1,545 @@
+#include "docker.h"
+#include "logging.h"     // for log_msg, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR
+#include "wire.h"        // for wire_name_from_str, wire_get_u16, wire_set_u16, ...
+#include <arpa/inet.h>   // for inet_pton
+#include <ctype.h>       // for tolower, isxdigit
+#include <errno.h>       // for errno, EINTR
+#include <netinet/in.h>  // for in_addr
+#include <pthread.h>     // for pthread_rwlock_t, pthread_create, pthread_detach
+#include <stdio.h>       // for snprintf
+#include <stdlib.h>      // for malloc, realloc, free
+#include <string.h>      // for memcpy, memchr, memmove, memset, strcmp, strncmp, strstr, ...
+#include <sys/socket.h>  // for socket, connect, AF_UNIX, SOCK_STREAM
+#include <sys/un.h>      // for sockaddr_un
+#include <unistd.h>      // for read, write, close, sleep
+
+// 容器名到IPv4地址的表，事件线程写入，工作线程读取
+typedef struct {
+    char id[DOCKER_ID_LEN];
+    uint8_t name[DNS_MAX_NAME];         // 小写线格式的容器名，不含根标签
+    uint8_t name_len;                   // 0 表示空槽
+    uint8_t num_addrs;
+    struct in_addr addrs[DOCKER_MAX_ADDRS];
+} container_t;
+
+#define CONTAINER_MASK (DOCKER_MAX_CONTAINERS - 1)
+#define HTTP_MAX_RESPONSE (16 * 1024 * 1024)
+
+static container_t containers[DOCKER_MAX_CONTAINERS];
+static int num_containers;
+static pthread_rwlock_t containers_lock = PTHREAD_RWLOCK_INITIALIZER;
+static char docker_socket[108];
+
+// 名称哈希（忽略大小写）
+static uint32_t container_hash(const uint8_t *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)tolower(name[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 按名称查找槽位，name 可以是报文中的原始名称
+static int find_container(const uint8_t *name, size_t len) {
+    uint32_t i = container_hash(name, len) & CONTAINER_MASK;
+    while (containers[i].name_len) {
+        const container_t *c = &containers[i];
+        if (c->name_len == len) {
+            size_t j = 0;
+            while (j < len && c->name[j] == tolower(name[j])) j++;
+            if (j == len) return i;
+        }
+        i = (i + 1) & CONTAINER_MASK;
+    }
+    return -1;
+}
+
+// 删除槽位并回移后续冲突的条目（不使用墓碑）
+static void remove_at(uint32_t i) {
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & CONTAINER_MASK;
+        if (!containers[j].name_len) break;
+        uint32_t home = container_hash(containers[j].name, containers[j].name_len) & CONTAINER_MASK;
+        int in_range = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+        if (!in_range) {
+            containers[i] = containers[j];
+            i = j;
+        }
+    }
+    containers[i].name_len = 0;
+    num_containers--;
+}
+
+static void remove_id(const char *id) {
+    for (uint32_t i = 0; i < DOCKER_MAX_CONTAINERS; i++) {
+        if (containers[i].name_len && strcmp(containers[i].id, id) == 0) {
+            log_msg(LOG_DEBUG, "Docker container %.12s removed", id);
+            remove_at(i);
+            return;
+        }
+    }
+}
+
+// 插入或更新容器，调用方持有写锁
+static void upsert_container(const container_t *c) {
+    remove_id(c->id);
+    if (c->num_addrs == 0) return;
+
+    int i = find_container(c->name, c->name_len);
+    if (i < 0) {
+        if (num_containers >= DOCKER_MAX_CONTAINERS * 3 / 4) {
+            log_msg(LOG_WARN, "Docker container table full, not tracking %.12s", c->id);
+            return;
+        }
+        i = container_hash(c->name, c->name_len) & CONTAINER_MASK;
+        while (containers[i].name_len) i = (i + 1) & CONTAINER_MASK;
+        num_containers++;
+    }
+    containers[i] = *c;
+    log_msg(LOG_DEBUG, "Docker container %.12s tracked (%d addresses)", c->id, c->num_addrs);
+}
+
+static void clear_containers(void) {
+    pthread_rwlock_wrlock(&containers_lock);
+    memset(containers, 0, sizeof(containers));
+    num_containers = 0;
+    pthread_rwlock_unlock(&containers_lock);
+}
+
+/* 只解析 Docker API 用到的 JSON 子集：按键取值、遍历对象和数组、读取字符串 */
+
+static const char* json_ws(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+// 跳过一个值，返回其后的位置，出错返回 NULL
+static const char* json_skip(const char *p) {
+    if (!p) return NULL;
+    p = json_ws(p);
+    if (*p == '"') {
+        for (p++; *p && *p != '"'; p++) {
+            if (*p == '\\' && p[1]) p++;
+        }
+        return *p ? p + 1 : NULL;
+    }
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (*p) {
+            if (*p == '"') {
+                p = json_skip(p);
+                if (!p) return NULL;
+                continue;
+            }
+            if (*p == '{' || *p == '[') depth++;
+            else if ((*p == '}' || *p == ']') && --depth == 0) return p + 1;
+            p++;
+        }
+        return NULL;
+    }
+    while (*p && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\n') p++;
+    return p;
+}
+
+// 逐个取出对象或数组中的值，*cur 首次为 NULL，没有更多值时返回 NULL
+static const char* json_next(const char *p, const char **cur) {
+    if (!p) return NULL;
+    p = json_ws(p);
+    if (*p != '{' && *p != '[') return NULL;
+
+    const char *q;
+    if (!*cur) {
+        q = json_ws(p + 1);
+        if (*q == '}' || *q == ']') return NULL;
+    } else {
+        q = json_skip(*cur);
+        if (!q) return NULL;
+        q = json_ws(q);
+        if (*q != ',') return NULL;
+        q = json_ws(q + 1);
+    }
+
+    // 对象成员跳过键
+    if (*p == '{') {
+        q = json_skip(q);
+        if (!q) return NULL;
+        q = json_ws(q);
+        if (*q != ':') return NULL;
+        q = json_ws(q + 1);
+    }
+    *cur = q;
+    return q;
+}
+
+// 在对象中按键取值
+static const char* json_get(const char *obj, const char *key) {
+    if (!obj) return NULL;
+    obj = json_ws(obj);
+    if (*obj != '{') return NULL;
+
+    size_t klen = strlen(key);
+    const char *p = json_ws(obj + 1);
+    while (*p == '"') {
+        const char *k = p + 1;
+        const char *end = json_skip(p);
+        if (!end) return NULL;
+        p = json_ws(end);
+        if (*p != ':') return NULL;
+        p = json_ws(p + 1);
+        if ((size_t)(end - 1 - k) == klen && memcmp(k, key, klen) == 0) return p;
+
+        p = json_skip(p);
+        if (!p) return NULL;
+        p = json_ws(p);
+        if (*p != ',') return NULL;
+        p = json_ws(p + 1);
+    }
+    return NULL;
+}
+
+// 读取字符串值，不支持的转义替换为 '?'
+static int json_str(const char *p, char *out, size_t cap) {
+    if (!p || *p != '"' || cap == 0) return -1;
+    size_t n = 0;
+    for (p++; *p && *p != '"'; p++) {
+        char c = *p;
+        if (c == '\\') {
+            c = *++p;
+            if (!c) return -1;
+            if (c == 'u') {
+                for (int i = 0; i < 4 && p[1]; i++) p++;
+                c = '?';
+            } else if (c != '"' && c != '\\' && c != '/') {
+                c = '?';
+            }
+        }
+        if (n + 1 >= cap) return -1;
+        out[n++] = c;
+    }
+    if (*p != '"') return -1;
+    out[n] = '\0';
+    return 0;
+}
+
+// 从 /containers/json 的列表项或 /containers/{id}/json 中提取名称和地址
+static int parse_container(const char *obj, container_t *c) {
+    memset(c, 0, sizeof(*c));
+
+    char name[256];
+    const char *names = json_get(obj, "Names");
+    const char *cur = NULL;
+    if (json_str(json_get(obj, "Id"), c->id, sizeof(c->id)) != 0) return -1;
+    if (json_str(names ? json_next(names, &cur) : json_get(obj, "Name"), name, sizeof(name)) != 0) {
+        return -1;
+    }
+
+    uint8_t wire[DNS_MAX_NAME];
+    size_t len = wire_name_from_str(name[0] == '/' ? name + 1 : name, wire);
+    if (len < 2) return -1;
+    memcpy(c->name, wire, len - 1);
+    c->name_len = len - 1;
+
+    const char *networks = json_get(json_get(obj, "NetworkSettings"), "Networks");
+    const char *net;
+    cur = NULL;
+    while (c->num_addrs < DOCKER_MAX_ADDRS && (net = json_next(networks, &cur))) {
+        char ip[INET_ADDRSTRLEN];
+        if (json_str(json_get(net, "IPAddress"), ip, sizeof(ip)) == 0 &&
+            inet_pton(AF_INET, ip, &c->addrs[c->num_addrs]) == 1) {
+            c->num_addrs++;
+        }
+    }
+    return 0;
+}
+
+// 连接 Docker API 并发送 GET 请求（HTTP/1.0，响应结束时服务端关闭连接）
+static int docker_request(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    // 路径长度已在 start_docker_watcher 中检查
+    struct sockaddr_un addr;
+    size_t path_len = strlen(docker_socket);
+    if (path_len >= sizeof(addr.sun_path)) {
+        close(fd);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, docker_socket, path_len + 1);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        log_msg(LOG_DEBUG, "Failed to connect to %s: %s", docker_socket, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    char req[256];
+    int n = snprintf(req, sizeof(req), "GET %s HTTP/1.0\r\nHost: docker\r\n\r\n", path);
+    for (int sent = 0; sent < n; ) {
+        ssize_t w = write(fd, req + sent, n - sent);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            close(fd);
+            return -1;
+        }
+        sent += w;
+    }
+    return fd;
+}
+
+// 读取响应头，返回已读入 buf 的正文长度，状态码不是200时返回-1
+static ssize_t read_headers(int fd, char *buf, size_t cap) {
+    size_t n = 0;
+    while (n + 1 < cap) {
+        ssize_t r = read(fd, buf + n, cap - 1 - n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        n += r;
+        buf[n] = '\0';
+
+        char *end = strstr(buf, "\r\n\r\n");
+        if (!end) continue;
+        if (strncmp(buf, "HTTP/1.", 7) != 0 || strncmp(buf + 8, " 200", 4) != 0) {
+            log_msg(LOG_WARN, "Docker API error: %.*s", (int)strcspn(buf, "\r\n"), buf);
+            return -1;
+        }
+        end += 4;
+        size_t body = n - (end - buf);
+        memmove(buf, end, body + 1);
+        return body;
+    }
+    return -1;
+}
+
+// 请求并读取完整的响应正文，调用方负责释放
+static char* docker_get(const char *path) {
+    int fd = docker_request(path);
+    if (fd < 0) return NULL;
+
+    size_t cap = 64 * 1024;
+    char *buf = malloc(cap);
+    ssize_t n = buf ? read_headers(fd, buf, cap) : -1;
+    if (n < 0) {
+        close(fd);
+        free(buf);
+        return NULL;
+    }
+
+    size_t len = n;
+    while (1) {
+        if (len + 1 == cap) {
+            char *p = cap < HTTP_MAX_RESPONSE ? realloc(buf, cap * 2) : NULL;
+            if (!p) {
+                len = 0;
+                break;
+            }
+            buf = p;
+            cap *= 2;
+        }
+        ssize_t r = read(fd, buf + len, cap - 1 - len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) len = 0;
+        if (r <= 0) break;
+        len += r;
+    }
+    close(fd);
+
+    if (len == 0) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+// 重新查询单个容器，停止运行的容器从表中移除
+static void refresh_container(const char *id) {
+    for (const char *p = id; *p; p++) {
+        if (!isxdigit((unsigned char)*p)) return;
+    }
+
+    char path[128];
+    snprintf(path, sizeof(path), "/containers/%s/json", id);
+    char *body = docker_get(path);
+
+    container_t c;
+    const char *running = json_get(json_get(body, "State"), "Running");
+    int ok = body && parse_container(body, &c) == 0;
+
+    pthread_rwlock_wrlock(&containers_lock);
+    if (ok && running && strncmp(running, "true", 4) == 0) {
+        upsert_container(&c);
+    } else {
+        remove_id(id);
+    }
+    pthread_rwlock_unlock(&containers_lock);
+    free(body);
+}
+
+// 加载所有运行中的容器，替换整张表
+static int load_containers(void) {
+    char *body = docker_get("/containers/json");
+    if (!body) return -1;
+
+    container_t *list = malloc(DOCKER_MAX_CONTAINERS * sizeof(container_t));
+    if (!list) {
+        free(body);
+        return -1;
+    }
+
+    int n = 0;
+    const char *cur = NULL, *item;
+    while (n < DOCKER_MAX_CONTAINERS && (item = json_next(body, &cur))) {
+        if (parse_container(item, &list[n]) == 0) n++;
+    }
+
+    pthread_rwlock_wrlock(&containers_lock);
+    memset(containers, 0, sizeof(containers));
+    num_containers = 0;
+    for (int i = 0; i < n; i++) upsert_container(&list[i]);
+    int tracked = num_containers;
+    pthread_rwlock_unlock(&containers_lock);
+
+    log_msg(LOG_INFO, "Docker watcher tracking %d containers", tracked);
+    free(list);
+    free(body);
+    return 0;
+}
+
+// 处理一条事件
+static void handle_event(const char *ev) {
+    char type[16], action[32], id[DOCKER_ID_LEN];
+    const char *actor = json_get(ev, "Actor");
+    if (json_str(json_get(ev, "Type"), type, sizeof(type)) != 0 ||
+        json_str(json_get(ev, "Action"), action, sizeof(action)) != 0) return;
+
+    if (strcmp(type, "container") == 0) {
+        if (json_str(json_get(actor, "ID"), id, sizeof(id)) != 0) return;
+
+        if (strcmp(action, "die") == 0 || strcmp(action, "stop") == 0 ||
+            strcmp(action, "destroy") == 0) {
+            pthread_rwlock_wrlock(&containers_lock);
+            remove_id(id);
+            pthread_rwlock_unlock(&containers_lock);
+        } else if (strcmp(action, "start") == 0 || strcmp(action, "rename") == 0) {
+            refresh_container(id);
+        }
+    } else if (strcmp(type, "network") == 0) {
+        // 网络连接变化时地址随之变化
+        if (json_str(json_get(json_get(actor, "Attributes"), "container"), id, sizeof(id)) != 0) return;
+        if (strcmp(action, "connect") == 0 || strcmp(action, "disconnect") == 0) {
+            refresh_container(id);
+        }
+    }
+}
+
+// 逐行读取事件流，连接断开时返回
+static void watch_events(int fd, char *buf, size_t cap, size_t len) {
+    while (1) {
+        char *line = buf, *nl;
+        while ((nl = memchr(line, '\n', len - (line - buf)))) {
+            *nl = '\0';
+            // 分块编码的长度行等非JSON内容直接忽略
+            if (*json_ws(line) == '{') handle_event(line);
+            line = nl + 1;
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+        if (len + 1 >= cap) len = 0;   // 单条事件过长，丢弃
+
+        ssize_t r = read(fd, buf + len, cap - 1 - len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return;
+        len += r;
+        buf[len] = '\0';
+    }
+}
+
+// 事件线程：先订阅事件再加载列表，避免遗漏两者之间的变化；断开后清空表并重连
+static void* docker_watcher(void *arg) {
+    (void)arg;
+    static const char events_path[] =
+        "/events?filters=%7B%22type%22%3A%5B%22container%22%2C%22network%22%5D%7D";
+    static char buf[64 * 1024];
+    int delay = 1;
+
+    while (1) {
+        int fd = docker_request(events_path);
+        ssize_t n = fd >= 0 ? read_headers(fd, buf, sizeof(buf)) : -1;
+        if (n >= 0 && load_containers() == 0) {
+            delay = 1;
+            watch_events(fd, buf, sizeof(buf), n);
+        }
+        if (fd >= 0) close(fd);
+
+        clear_containers();
+        log_msg(LOG_WARN, "Docker events unavailable on %s, retrying in %ds", docker_socket, delay);
+        sleep(delay);
+        delay = delay * 2 > DOCKER_RETRY_MAX_SEC ? DOCKER_RETRY_MAX_SEC : delay * 2;
+    }
+    return NULL;
+}
+
+// 启动事件线程
+int start_docker_watcher(const char *socket_path) {
+    size_t len = strlen(socket_path);
+    if (len >= sizeof(docker_socket) || len >= sizeof(((struct sockaddr_un*)0)->sun_path)) {
+        log_msg(LOG_ERROR, "Docker socket path too long: %s", socket_path);
+        return 1;
+    }
+    memcpy(docker_socket, socket_path, len + 1);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, docker_watcher, NULL) != 0) {
+        log_msg(LOG_ERROR, "Failed to create docker watcher thread");
+        return 1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+// 用容器表应答A查询，suffix_len 为路由后缀的线格式长度，未命中时返回0
+size_t handle_docker_query(const uint8_t *query, size_t qname_end, size_t suffix_len,
+                           uint8_t *resp, size_t cap) {
+    if (wire_get_u16(query + qname_end) != DNS_TYPE_A ||
+        wire_get_u16(query + qname_end + 2) != DNS_CLASS_IN) return 0;
+
+    size_t name_len = qname_end - 1 - suffix_len - DNS_HEADER_SIZE;
+    struct in_addr addrs[DOCKER_MAX_ADDRS];
+    int num_addrs = 0;
+
+    pthread_rwlock_rdlock(&containers_lock);
+    int i = num_containers ? find_container(query + DNS_HEADER_SIZE, name_len) : -1;
+    if (i >= 0) {
+        num_addrs = containers[i].num_addrs;
+        memcpy(addrs, containers[i].addrs, num_addrs * sizeof(addrs[0]));
+    }
+    pthread_rwlock_unlock(&containers_lock);
+    if (!num_addrs) return 0;
+
+    size_t n = qname_end + 4;
+    if (n + num_addrs * DOCKER_ANSWER_LEN > cap) return 0;
+
+    memset(resp, 0, DNS_HEADER_SIZE);
+    memcpy(resp + DNS_OFF_ID, query + DNS_OFF_ID, 2);
+    wire_set_u16(resp + DNS_OFF_FLAGS, DNS_FLAG_QR | DNS_FLAG_AA | DNS_FLAG_RA |
+                 (wire_get_u16(query + DNS_OFF_FLAGS) & DNS_FLAG_RD));
+    wire_set_u16(resp + DNS_OFF_QDCOUNT, 1);
+    wire_set_u16(resp + DNS_OFF_ANCOUNT, num_addrs);
+    memcpy(resp + DNS_HEADER_SIZE, query + DNS_HEADER_SIZE, n - DNS_HEADER_SIZE);
+
+    for (int a = 0; a < num_addrs; a++) {
+        uint8_t *rr = resp + n;
+        wire_set_u16(rr, 0xc000 | DNS_HEADER_SIZE);
+        wire_set_u16(rr + 2, DNS_TYPE_A);
+        wire_set_u16(rr + 4, DNS_CLASS_IN);
+        wire_set_u16(rr + 6, 0);
+        wire_set_u16(rr + 8, DOCKER_TTL);
+        wire_set_u16(rr + 10, 4);
+        memcpy(rr + 12, &addrs[a], 4);
+        n += DOCKER_ANSWER_LEN;
+    }
+    return n;
+}
@@ -1,164 +1,299 @@
 
-#include "config.h"         // for gateway_name, keep_suffix, suffix_domain
-#include "dns.h"            // for strip_suffix
+#include "config.h"         // for gateway_name, suffix_domain
 #include "gateway.h"
-#include "logging.h"        // for log_msg, LOG_DEBUG, LOG_ERROR, LOG_WARN
-#include <arpa/inet.h>      // for inet_ntoa
-#include <stdio.h>          // for fclose, NULL, snprintf, fgets, fopen, fscanf
-#include <stdlib.h>         // for free
-#include <string.h>         // for strdup, strcspn, strlen
-#include <strings.h>        // for strcasecmp, size_t
-// #include <ldns/error.h>     // for ldns_get_errorstr_by_id, ldns_enum_status
-// #include <ldns/host2str.h>  // for ldns_rr_type2str, ldns_rdf2str
-#include <ldns/ldns.h>
-
-// 检查是否是网关域名
-int is_gateway_domain(const char *name) {
-    if (!name || !gateway_name[0]) return 0;
-    
-    size_t len = strlen(name);
-    char *temp_name = strdup(name);
-    if (!temp_name) return 0;
-    
-    // 先移除尾部的点（FQDN）
-    strip_dot(temp_name);
-
-    // 构建预期的网关域名格式
-    char expected_gateway[512];
-    snprintf(expected_gateway, sizeof(expected_gateway), "%s%s", gateway_name, suffix_domain);
-    
-    int result = (strcasecmp(temp_name, expected_gateway) == 0);
-    log_msg(LOG_DEBUG, "Checking if '%s' matches gateway domain '%s': %s", 
-              name, expected_gateway, result ? "YES" : "NO");
-    
-    free(temp_name);
-    return result;
+#include "logging.h"        // for log_msg, log_addr, LOG_DEBUG, LOG_ERROR, ...
+#include "wire.h"           // for wire_question_end, wire_set_u16, DNS_TYPE_A, ...
+#include <arpa/inet.h>      // for inet_ntop
+#include <ctype.h>          // for tolower
+#include <errno.h>          // for errno, EINTR, ENOBUFS
+#include <linux/netlink.h>  // for nlmsghdr, sockaddr_nl, NLMSG_OK, NLMSG_NEXT, ...
+#include <linux/rtnetlink.h> // for rtmsg, rtattr, RTM_GETROUTE, RTMGRP_IPV4_ROUTE, ...
+#include <pthread.h>        // for pthread_create, pthread_detach, pthread_t
+#include <stdio.h>          // for NULL, snprintf
+#include <string.h>         // for memcpy, memset, strcspn, strerror
+#include <sys/socket.h>     // for socket, bind, send, recv, AF_NETLINK
+#include <unistd.h>         // for close
+
+// 预先生成的网关A记录（线格式，名称指向问题段），最后4字节的地址在应答时填入
+static uint8_t gateway_answer[GATEWAY_ANSWER_LEN];
+
+// 生成网关A记录模板中固定的部分，地址在应答时填入
+static void init_gateway_answer(void) {
+    uint8_t *p = gateway_answer;
+    wire_set_u16(p, 0xc000 | DNS_HEADER_SIZE);
+    wire_set_u16(p + 2, DNS_TYPE_A);
+    wire_set_u16(p + 4, DNS_CLASS_IN);
+    wire_set_u16(p + 6, 0);
+    wire_set_u16(p + 8, GATEWAY_TTL);
+    wire_set_u16(p + 10, sizeof(gateway_addr.s_addr));
 }
 
-// 获取网关IP地址
+// 初始化网关应答模板
+void init_gateway(void) {
+    init_gateway_answer();
+}
+
+// 由网关名称和后缀生成快照中的网关域名及其线格式
+void build_gateway_name(snapshot_t *s) {
+    snprintf(s->gateway_domain, sizeof(s->gateway_domain), "%s%s", gateway_name, suffix_domain);
+
+    s->gateway_wire_len = 0;
+    if (!gateway_name[0]) return;
+
+    const char *p = s->gateway_domain;
+    while (*p) {
+        size_t label = strcspn(p, ".");
+        if (label > 63 || s->gateway_wire_len + label + 2 > sizeof(s->gateway_wire)) {
+            log_msg(LOG_WARN, "Invalid gateway domain '%s'", s->gateway_domain);
+            s->gateway_wire_len = 0;
+            return;
+        }
+        if (label) {
+            s->gateway_wire[s->gateway_wire_len++] = (uint8_t)label;
+            for (size_t i = 0; i < label; i++) {
+                s->gateway_wire[s->gateway_wire_len++] = (uint8_t)tolower((unsigned char)p[i]);
+            }
+        }
+        p += label;
+        if (*p == '.') p++;
+    }
+    s->gateway_wire[s->gateway_wire_len++] = 0;
+}
+
+// 原子地更新网关地址，工作线程随时可能读取
+void set_gateway_addr(struct in_addr addr) {
+    __atomic_store_n(&gateway_addr.s_addr, addr.s_addr, __ATOMIC_RELEASE);
+}
+
+// 原子地读取网关地址
+struct in_addr get_gateway_addr(void) {
+    struct in_addr addr;
+    addr.s_addr = __atomic_load_n(&gateway_addr.s_addr, __ATOMIC_ACQUIRE);
+    return addr;
+}
+
+// 检查问题名称是否是网关域名，qname_end 指向问题名称之后
+int is_gateway_domain(const snapshot_t *s, const uint8_t *pkt, size_t qname_end) {
+    size_t len = qname_end - DNS_HEADER_SIZE;
+    if (!s->gateway_wire_len || len != s->gateway_wire_len) return 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (tolower(pkt[DNS_HEADER_SIZE + i]) != s->gateway_wire[i]) return 0;
+    }
+    return 1;
+}
+
+// 解析一条 RTM_NEWROUTE/RTM_DELROUTE 消息，是主路由表中的IPv4默认路由时返回1
+static int parse_default_route(const struct nlmsghdr *nh, uint32_t *gateway, uint32_t *metric) {
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct rtmsg))) return 0;
+    const struct rtmsg *rt = NLMSG_DATA(nh);
+    if (rt->rtm_family != AF_INET || rt->rtm_dst_len != 0) return 0;
+
+    uint32_t table = rt->rtm_table;
+    *gateway = 0;
+    *metric = 0;
+
+    int len = RTM_PAYLOAD(nh);
+    for (const struct rtattr *a = RTM_RTA(rt); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+        if (a->rta_type == RTA_GATEWAY && RTA_PAYLOAD(a) == 4) memcpy(gateway, RTA_DATA(a), 4);
+        else if (a->rta_type == RTA_PRIORITY && RTA_PAYLOAD(a) == 4) memcpy(metric, RTA_DATA(a), 4);
+        else if (a->rta_type == RTA_TABLE && RTA_PAYLOAD(a) == 4) memcpy(&table, RTA_DATA(a), 4);
+    }
+    return table == RT_TABLE_MAIN;
+}
+
+// 通过 netlink 获取默认路由的网关，多条默认路由时取 metric 最小的
 int resolve_gateway_ip(void) {
-    log_msg(LOG_DEBUG, "Resolving gateway IP from /proc/net/route");
-    
-    FILE *f = fopen("/proc/net/route", "r");
-    if (!f) {
-        perror("fopen /proc/net/route");
+    log_msg(LOG_DEBUG, "Resolving gateway IP via netlink");
+
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "Failed to open netlink socket: %s", strerror(errno));
         return 1;
     }
 
-    char iface[64];
-    unsigned long dest, gateway, mask;
-    unsigned int flags;
-    int refcnt, use, metric, mtu, window, irtt;
-    char line[256];
+    struct {
+        struct nlmsghdr nh;
+        struct rtmsg rt;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req.nh.nlmsg_type = RTM_GETROUTE;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    req.rt.rtm_family = AF_INET;
 
-    // 跳过表头
-    if (!fgets(line, sizeof(line), f)) {
-        log_msg(LOG_DEBUG, "Failed to read header from /proc/net/route");
-        fclose(f);
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0) {
+        log_msg(LOG_ERROR, "Failed to request routes: %s", strerror(errno));
+        close(fd);
         return 1;
     }
 
-    // 读取每一行
-    while (fscanf(f, "%63s %lx %lx %X %d %d %d %lx %d %d %d\n",
-                  iface, &dest, &gateway, &flags,
-                  &refcnt, &use, &metric, &mask, &mtu, &window, &irtt) == 11) {
-        
-        // 默认路由
-        if (dest == 0) {
-            if (gateway == 0) {
-                log_msg(LOG_DEBUG, "Found default route with gateway 0, skipping");
-                continue;
+    uint32_t best = 0, best_metric = UINT32_MAX;
+    char buf[NETLINK_BUF_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    int done = 0;
+
+    while (!done) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        int len = (int)n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr*)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                done = 1;
+                break;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                done = -1;
+                break;
+            }
+
+            uint32_t gateway, metric;
+            if (nh->nlmsg_type == RTM_NEWROUTE && parse_default_route(nh, &gateway, &metric) &&
+                gateway != 0 && metric < best_metric) {
+                best = gateway;
+                best_metric = metric;
             }
-            
-            struct in_addr gw;
-            gw.s_addr = gateway;
-            gateway_addr.s_addr = gateway;
-            log_msg(LOG_DEBUG, "Found default gateway via interface %s: %s",
-                     iface, inet_ntoa(gw));
-            fclose(f);
-            return 0;
         }
     }
+    close(fd);
 
-    log_msg(LOG_WARN, "No valid default gateway found");
-    fclose(f);
-    return 1;
+    if (done != 1) {
+        log_msg(LOG_ERROR, "Failed to read routes from netlink");
+        return 1;
+    }
+
+    struct in_addr gw;
+    gw.s_addr = best;
+    set_gateway_addr(gw);
+    if (!best) {
+        log_msg(LOG_WARN, "No valid default gateway found");
+        return 1;
+    }
+
+    char gw_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &gw, gw_str, sizeof(gw_str));
+    log_msg(LOG_DEBUG, "Found default gateway %s (metric %u)", gw_str, best_metric);
+    return 0;
+}
+
+// 监听路由变化，默认路由变化时重新获取网关
+static void* gateway_monitor(void *arg) {
+    int fd = *(int*)arg;
+    char buf[NETLINK_BUF_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+    while (1) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        int changed = 0;
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // 缓冲区溢出时丢失了事件，直接重新获取
+            if (errno != ENOBUFS) {
+                log_msg(LOG_ERROR, "Route monitor stopped: %s", strerror(errno));
+                break;
+            }
+            changed = 1;
+        }
+
+        int len = (int)n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr*)buf; n > 0 && NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            uint32_t gateway, metric;
+            if ((nh->nlmsg_type == RTM_NEWROUTE || nh->nlmsg_type == RTM_DELROUTE) &&
+                parse_default_route(nh, &gateway, &metric)) {
+                changed = 1;
+            }
+        }
+        if (!changed) continue;
+
+        struct in_addr old = get_gateway_addr();
+        resolve_gateway_ip();
+        struct in_addr now = get_gateway_addr();
+        if (now.s_addr != old.s_addr) {
+            char gw_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &now, gw_str, sizeof(gw_str));
+            log_msg(LOG_INFO, "Gateway IP changed to %s", gw_str);
+        }
+    }
+    close(fd);
+    return NULL;
 }
 
-// 创建网关域名的DNS响应
-ldns_pkt* handle_gateway_query(ldns_pkt *query_pkt, ldns_rr *qrr, struct in_addr client_addr) {
-    if (!query_pkt || !qrr) {
-        log_msg(LOG_ERROR, "Invalid parameters for create_gateway_response");
-        return NULL;
+// 订阅IPv4路由变化并启动监听线程
+int start_gateway_monitor(void) {
+    static int fd;
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "Failed to open netlink socket: %s", strerror(errno));
+        return 1;
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_IPV4_ROUTE;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        log_msg(LOG_ERROR, "Failed to subscribe to route changes: %s", strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, gateway_monitor, &fd) != 0) {
+        log_msg(LOG_ERROR, "Failed to create route monitor thread");
+        close(fd);
+        return 1;
     }
+    pthread_detach(tid);
+    return 0;
+}
 
-    log_msg(LOG_DEBUG, "Creating gateway response for query type %s",
-            ldns_rr_type2str(ldns_rr_get_type(qrr)));
-    
-    char *qname_str = ldns_rdf2str(ldns_rr_owner(qrr));
-    if (!qname_str) {
-        log_msg(LOG_ERROR, "Failed to get query name string");
-        return NULL;
+// 创建网关域名的DNS响应：复制报头模板和原始问题段，再追加预生成的A记录
+size_t handle_gateway_query(const snapshot_t *s, const uint8_t *query, size_t len,
+                            uint8_t *resp, size_t cap, struct in_addr client_addr) {
+    size_t qname_end, qend;
+    if (wire_question_end(query, len, &qname_end, &qend) != 0) {
+        log_msg(LOG_ERROR, "Invalid question for gateway query");
+        return 0;
     }
-    qname_str[strcspn(qname_str, "\n")] = 0;
 
-    ldns_pkt *resp_pkt = ldns_pkt_new();
-    if (!resp_pkt) {
-        log_msg(LOG_ERROR, "Failed to create response packet");
-        return NULL;
+    size_t n = qend;
+    if (n + GATEWAY_ANSWER_LEN > cap) {
+        log_msg(LOG_ERROR, "Gateway response buffer too small");
+        return 0;
     }
-    
-    ldns_pkt_set_id(resp_pkt, ldns_pkt_id(query_pkt));
-    ldns_pkt_set_qr(resp_pkt, 1);
-    ldns_pkt_set_aa(resp_pkt, 1);
-    ldns_pkt_set_rd(resp_pkt, ldns_pkt_rd(query_pkt));  // 保持原始RD标志
-    ldns_pkt_set_ra(resp_pkt, 1);                       // 递归可用
-    ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_NOERROR);
-    ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_QUESTION, ldns_rr_clone(qrr));
+
+    uint16_t qtype = wire_get_u16(query + qname_end);
+    uint16_t flags = DNS_FLAG_QR | DNS_FLAG_AA | DNS_FLAG_RA |
+                     (wire_get_u16(query + DNS_OFF_FLAGS) & DNS_FLAG_RD);  // 保持原始RD标志
+
+    memset(resp, 0, DNS_HEADER_SIZE);
+    memcpy(resp + DNS_OFF_ID, query + DNS_OFF_ID, 2);
+    wire_set_u16(resp + DNS_OFF_QDCOUNT, 1);
+    memcpy(resp + DNS_HEADER_SIZE, query + DNS_HEADER_SIZE, qend - DNS_HEADER_SIZE);
 
     // 只有A记录查询才添加答案
-    if (ldns_rr_get_type(qrr) == LDNS_RR_TYPE_A) {
-        // 确保网关地址有效
-        if (gateway_addr.s_addr == 0) {
-            log_msg(LOG_WARN, "Gateway address is 0, resolving again");
-            if (resolve_gateway_ip() != 0) {
-                log_msg(LOG_ERROR, "Failed to resolve gateway IP, returning SERVFAIL");
-                ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_SERVFAIL);
-                free(qname_str);
-                return resp_pkt;
-            }
-        }
-        
-        // 使用 ldns_rr_new_frm_str 创建A记录
-        char rr_str[512];
-        snprintf(rr_str, sizeof(rr_str), "%s 60 IN A %s", 
-                qname_str, inet_ntoa(gateway_addr));
-
-        log_msg(LOG_DEBUG, "Creating A record: %s", rr_str);
-
-        ldns_rr *answer_rr = NULL;
-        ldns_status status = ldns_rr_new_frm_str(&answer_rr, rr_str, 0, NULL, NULL);
-
-        if (status == LDNS_STATUS_OK && answer_rr) {
-            // 添加到答案段
-            ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_ANSWER, answer_rr);
-            char* modified_name = strdup(qname_str);
-            if (!keep_suffix) strip_suffix(modified_name);
-            log_msg(LOG_DEBUG, "Successfully created gateway A record response");
-            log_msg(LOG_INFO, "Gateway A query '%s' from %s -> %s is gateway", 
-                modified_name, 
-                inet_ntoa(client_addr), 
-                inet_ntoa(gateway_addr));
-        } else {
-            log_msg(LOG_ERROR, "Failed to create A record from string: %s",
-                     ldns_get_errorstr_by_id(status));
-            ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_SERVFAIL);
+    if (qtype == DNS_TYPE_A) {
+        // 网关地址由路由监听线程维护，查询时只读取一次
+        struct in_addr gw = get_gateway_addr();
+        if (gw.s_addr == 0) {
+            log_msg(LOG_ERROR, "No default gateway known, returning SERVFAIL");
+            wire_set_u16(resp + DNS_OFF_FLAGS, flags | DNS_RCODE_SERVFAIL);
+            return n;
         }
+
+        memcpy(resp + n, gateway_answer, GATEWAY_ANSWER_LEN - sizeof(gw.s_addr));
+        memcpy(resp + n + GATEWAY_ANSWER_LEN - sizeof(gw.s_addr), &gw.s_addr, sizeof(gw.s_addr));
+        n += GATEWAY_ANSWER_LEN;
+        wire_set_u16(resp + DNS_OFF_ANCOUNT, 1);
+
+        log_msg(LOG_INFO, "Gateway A query '%s' from %s -> %s is gateway", 
+            s->gateway_domain, log_addr(client_addr), log_addr(gw));
     } else {
-        log_msg(LOG_DEBUG, "Unsupported query type for gateway: %s",
-                 ldns_rr_type2str(ldns_rr_get_type(qrr)));
+        log_msg(LOG_DEBUG, "Unsupported query type for gateway: %u", qtype);
     }
 
-    free(qname_str);
-    return resp_pkt;
+    wire_set_u16(resp + DNS_OFF_FLAGS, flags);
+    return n;
 }
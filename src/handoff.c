@@ -0,0 +1,203 @@
+#include "handoff.h"
+#include "cache.h"       // for cache_save
+#include "config.h"      // for cache_size, cache_file
+#include "logging.h"     // for log_msg, LOG_ERROR, LOG_INFO
+#include <errno.h>       // for errno, EINTR
+#include <fcntl.h>       // for fcntl, F_SETFD, FD_CLOEXEC
+#include <pthread.h>     // for pthread_create, pthread_detach, pthread_t
+#include <stdlib.h>      // for getenv, strtol, unsetenv
+#include <string.h>      // for memset, memcpy, strlen, strcpy, strerror
+#include <sys/socket.h>  // for socket, connect, sendmsg, recvmsg, SCM_RIGHTS, ...
+#include <sys/stat.h>    // for chmod
+#include <sys/time.h>    // for timeval
+#include <sys/uio.h>     // for iovec
+#include <sys/un.h>      // for sockaddr_un
+#include <unistd.h>      // for close, getpid, unlink
+
+volatile sig_atomic_t handed_off = 0;
+
+// 交给新进程的描述符及其说明
+static int handoff_fds[HANDOFF_MAX_FDS];
+static handoff_msg_t handoff_msg;
+
+static int unix_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return 1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static int socket_opt(int fd, int opt) {
+    int val = -1;
+    socklen_t len = sizeof(val);
+    if (getsockopt(fd, SOL_SOCKET, opt, &val, &len) != 0) return -1;
+    return val;
+}
+
+// systemd 套接字激活：LISTEN_PID 为本进程时，从 3 号开始的 LISTEN_FDS 个描述符中
+// 取第一个 IPv4 UDP 套接字用于 DNS，第一个 TCP 套接字用于指标，取得 DNS 套接字时返回 1
+// 守护进程化会改变进程号，需在此之前调用
+int inherit_listen_fds(int *dns_fd, int *metrics_fd) {
+    const char *pid = getenv("LISTEN_PID");
+    const char *fds = getenv("LISTEN_FDS");
+    if (!pid || !fds || strtol(pid, NULL, 10) != getpid()) return 0;
+
+    int n = (int)strtol(fds, NULL, 10);
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    for (int fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + n; fd++) {
+        if (socket_opt(fd, SO_DOMAIN) != AF_INET) continue;
+        int type = socket_opt(fd, SO_TYPE);
+        if (type == SOCK_DGRAM && *dns_fd < 0) *dns_fd = fd;
+        else if (type == SOCK_STREAM && *metrics_fd < 0) *metrics_fd = fd;
+        else continue;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return *dns_fd >= 0;
+}
+
+// 向正在运行的旧进程请求侦听套接字，旧进程收到请求后停止接收并退出
+// 没有旧进程或失败时返回 1，由调用者自行绑定
+int receive_handoff(const char *path, int *dns_fd, int *metrics_fd) {
+    struct sockaddr_un addr;
+    if (unix_addr(path, &addr) != 0) return 1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return 1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return 1;
+    }
+    struct timeval tv = {HANDOFF_TIMEOUT_MS / 1000, (HANDOFF_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    handoff_msg_t msg;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } control;
+    struct iovec iov = {&msg, sizeof(msg)};
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    ssize_t n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+    int err = errno;
+    close(fd);
+
+    int fds[HANDOFF_MAX_FDS];
+    int nfds = 0;
+    for (struct cmsghdr *c = n > 0 ? CMSG_FIRSTHDR(&mh) : NULL; c; c = CMSG_NXTHDR(&mh, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
+    }
+
+    if (n != (ssize_t)sizeof(msg) || msg.magic != HANDOFF_MAGIC || msg.count != (uint32_t)nfds) {
+        log_msg(LOG_ERROR, "Invalid handoff from %s: %s", path, n < 0 ? strerror(err) : "bad message");
+        for (int i = 0; i < nfds; i++) close(fds[i]);
+        return 1;
+    }
+    for (int i = 0; i < nfds; i++) {
+        if (msg.kinds[i] == HANDOFF_DNS && *dns_fd < 0) *dns_fd = fds[i];
+        else if (msg.kinds[i] == HANDOFF_METRICS && *metrics_fd < 0) *metrics_fd = fds[i];
+        else close(fds[i]);
+    }
+    return *dns_fd >= 0 ? 0 : 1;
+}
+
+// 等待新进程连接，发出侦听套接字后通知主循环停止接收
+static void* handoff_server(void *arg) {
+    int lfd = *(int*)arg;
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            log_msg(LOG_ERROR, "Failed to accept handoff connection: %s", strerror(errno));
+            break;
+        }
+
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        } control;
+        memset(&control, 0, sizeof(control));
+        struct iovec iov = {&handoff_msg, sizeof(handoff_msg)};
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control.buf;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * handoff_msg.count);
+
+        struct cmsghdr *c = CMSG_FIRSTHDR(&mh);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * handoff_msg.count);
+        memcpy(CMSG_DATA(c), handoff_fds, sizeof(int) * handoff_msg.count);
+
+        // 交出套接字前保存缓存，新进程收到套接字后再导入；保存期间仍由本进程应答
+        if (cache_size && cache_file[0] && cache_save(cache_file) == 0) {
+            log_msg(LOG_INFO, "Saved answer cache to %s for the new process", cache_file);
+        }
+
+        ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        close(fd);
+        if (n == (ssize_t)sizeof(handoff_msg)) {
+            log_msg(LOG_INFO, "Handed listen sockets to a new process, draining");
+            handed_off = 1;
+            break;
+        }
+        log_msg(LOG_ERROR, "Failed to hand off listen sockets: %s", strerror(errno));
+    }
+    close(lfd);
+    return NULL;
+}
+
+// 在 path 上等待新版本进程接管侦听套接字，只有属主可以连接
+int start_handoff_server(const char *path, int dns_fd, int metrics_fd) {
+    static int lfd;
+    struct sockaddr_un addr;
+    if (unix_addr(path, &addr) != 0) {
+        log_msg(LOG_ERROR, "Upgrade socket path too long: %s", path);
+        return 1;
+    }
+
+    handoff_msg.magic = HANDOFF_MAGIC;
+    handoff_msg.count = 0;
+    handoff_fds[handoff_msg.count] = dns_fd;
+    handoff_msg.kinds[handoff_msg.count++] = HANDOFF_DNS;
+    if (metrics_fd >= 0) {
+        handoff_fds[handoff_msg.count] = metrics_fd;
+        handoff_msg.kinds[handoff_msg.count++] = HANDOFF_METRICS;
+    }
+
+    lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        log_msg(LOG_ERROR, "Failed to create upgrade socket: %s", strerror(errno));
+        return 1;
+    }
+    // 旧进程的套接字文件此时已交接完毕，可以直接替换
+    unlink(path);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || chmod(path, 0600) != 0 ||
+        listen(lfd, 1) != 0) {
+        log_msg(LOG_ERROR, "Failed to listen for upgrades on %s: %s", path, strerror(errno));
+        close(lfd);
+        return 1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, handoff_server, &lfd) != 0) {
+        log_msg(LOG_ERROR, "Failed to create upgrade thread");
+        close(lfd);
+        return 1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
@@ -18,12 +18,26 @@ void print_help(const char *progname) {
     printf("  -K, --keep-suffix  keep suffix forward dns query (default: %s)\n", KEEP_SUFFIX_DEFAULT ? "keep" : "strip");
     printf("  -M, --max-hops     Set maximum hop count (default: %d)\n", MAX_HOPS_DEFAULT);
     printf("  -W, --workers      Set number of worker threads (default: %d)\n", NUM_WORKERS_DEFAULT);
+    printf("  -R, --route        Add suffix route SUFFIX=DNS[,DNS...][:keep|:strip] (repeatable)\n");
+    printf("  -H, --hosts        Load local records from a hosts-format file\n");
+    printf("  -d, --docker-socket  Answer container names from Docker API events on this socket\n");
+    printf("  -m, --minimal-responses  Drop authority/additional records clients do not need\n");
+    printf("  -Q, --query-log    Write a binary query log to this ring file\n");
+    printf("  -Z, --query-log-size  Set query log file size in MB (default: %d)\n", QUERY_LOG_SIZE_DEFAULT);
+    printf("  -e, --metrics      Serve Prometheus metrics on [ADDR:]PORT (default address: 127.0.0.1)\n");
+    printf("  -a, --stats-allow  Addresses allowed to query CH TXT stats, ADDR[/PREFIX][,...] (default: %s)\n", STATS_ALLOW_DEFAULT);
+    printf("  -T, --slow-query-ms  Log a per-stage trace for queries slower than this (default: %d, off)\n", SLOW_QUERY_DEFAULT);
+    printf("  -E, --env-file     Read KEY=VALUE settings from this file, reread on SIGHUP\n");
+    printf("  -U, --upgrade-socket  Hand the listen sockets to a new process connecting to this unix socket\n");
+    printf("  -c, --cache-size   Cache up to this many forwarded answers (default: %d, off)\n", CACHE_SIZE_DEFAULT);
+    printf("  -F, --cache-file   Save the answer cache to this file and load it at startup\n");
+    printf("  -B, --hedge-percent  Resend up to this percent of slow upstream queries to another upstream (default: %d, off)\n", HEDGE_PERCENT_DEFAULT);
     printf("  -f, --foreground   Run in foreground mode (do not daemonize)\n");
     printf("  -h, --help         Show this help message and exit\n");
     printf("  -v, --version      Show version and exit\n");
     printf("\n");
     printf("Environment variable:\n");
-    printf("  Command-line arguments take precedence over environment variables.\n");
+    printf("  Command-line arguments take precedence over the env file, which takes precedence over environment variables.\n");
     printf("  --log-level    =>  LOG_LEVEL\n");
     printf("  --gateway      =>  GATEWAY_NAME\n");
     printf("  --suffix       =>  SUFFIX_DOMAIN\n");
@@ -33,6 +47,20 @@ void print_help(const char *progname) {
     printf("  --keep-suffix  =>  KEEP_SUFFIX\n");
     printf("  --max-hops     =>  MAX_HOPS\n");
     printf("  --workers      =>  NUM_WORKERS\n");
+    printf("  --route        =>  ROUTES (separated by ';')\n");
+    printf("  --hosts        =>  HOSTS_FILE\n");
+    printf("  --docker-socket  =>  DOCKER_SOCKET\n");
+    printf("  --minimal-responses  =>  MINIMAL_RESPONSES\n");
+    printf("  --query-log    =>  QUERY_LOG\n");
+    printf("  --query-log-size  =>  QUERY_LOG_SIZE\n");
+    printf("  --metrics      =>  METRICS_LISTEN\n");
+    printf("  --stats-allow  =>  STATS_ALLOW\n");
+    printf("  --slow-query-ms  =>  SLOW_QUERY_MS\n");
+    printf("  --env-file     =>  ENV_FILE\n");
+    printf("  --upgrade-socket  =>  UPGRADE_SOCKET\n");
+    printf("  --cache-size   =>  CACHE_SIZE\n");
+    printf("  --cache-file   =>  CACHE_FILE\n");
+    printf("  --hedge-percent  =>  HEDGE_PERCENT\n");
     printf("\n");
 }
 
@@ -63,6 +91,20 @@ OptionType get_option_type(const char* arg) {
             case 'K': return OPT_KEEP_SUFFIX;
             case 'M': return OPT_MAX_HOPS;
             case 'W': return OPT_NUM_WORKERS;
+            case 'R': return OPT_ROUTE;
+            case 'H': return OPT_HOSTS;
+            case 'd': return OPT_DOCKER_SOCKET;
+            case 'm': return OPT_MINIMAL_RESPONSES;
+            case 'Q': return OPT_QUERY_LOG;
+            case 'Z': return OPT_QUERY_LOG_SIZE;
+            case 'e': return OPT_METRICS;
+            case 'a': return OPT_STATS_ALLOW;
+            case 'T': return OPT_SLOW_QUERY;
+            case 'E': return OPT_ENV_FILE;
+            case 'U': return OPT_UPGRADE_SOCKET;
+            case 'c': return OPT_CACHE_SIZE;
+            case 'F': return OPT_CACHE_FILE;
+            case 'B': return OPT_HEDGE_PERCENT;
             case 'f': return OPT_FOREGROUND;
             case 'h': return OPT_HELP;
             case 'v': return OPT_VERSION;
@@ -79,6 +121,20 @@ OptionType get_option_type(const char* arg) {
         if (strcmp(opt, "keep-suffix") == 0)  return OPT_KEEP_SUFFIX;
         if (strcmp(opt, "max-hops") == 0)     return OPT_MAX_HOPS;
         if (strcmp(opt, "workers") == 0)      return OPT_NUM_WORKERS;
+        if (strcmp(opt, "route") == 0)        return OPT_ROUTE;
+        if (strcmp(opt, "hosts") == 0)        return OPT_HOSTS;
+        if (strcmp(opt, "docker-socket") == 0) return OPT_DOCKER_SOCKET;
+        if (strcmp(opt, "minimal-responses") == 0) return OPT_MINIMAL_RESPONSES;
+        if (strcmp(opt, "query-log") == 0)    return OPT_QUERY_LOG;
+        if (strcmp(opt, "query-log-size") == 0) return OPT_QUERY_LOG_SIZE;
+        if (strcmp(opt, "metrics") == 0)      return OPT_METRICS;
+        if (strcmp(opt, "stats-allow") == 0)  return OPT_STATS_ALLOW;
+        if (strcmp(opt, "slow-query-ms") == 0) return OPT_SLOW_QUERY;
+        if (strcmp(opt, "env-file") == 0)     return OPT_ENV_FILE;
+        if (strcmp(opt, "upgrade-socket") == 0) return OPT_UPGRADE_SOCKET;
+        if (strcmp(opt, "cache-size") == 0)   return OPT_CACHE_SIZE;
+        if (strcmp(opt, "cache-file") == 0)   return OPT_CACHE_FILE;
+        if (strcmp(opt, "hedge-percent") == 0) return OPT_HEDGE_PERCENT;
         if (strcmp(opt, "foreground") == 0)   return OPT_FOREGROUND;
         if (strcmp(opt, "help") == 0)         return OPT_HELP;
         if (strcmp(opt, "version") == 0)      return OPT_VERSION;
@@ -1,49 +1,293 @@
 
-#include "config.h"   // for str2int
+#include "config.h"      // for str2int
 #include "logging.h"
-#include <stdarg.h>   // for va_end, va_start
-#include <stdio.h>    // for printf, fflush, vprintf, NULL, stdout
-#include <stdlib.h>   // for free
-#include <string.h>   // for strlen
-#include <strings.h>  // for strcasecmp
-#include <time.h>     // for ctime, time, time_t
-#include <pthread.h>  // for pthread_mutex_lock
+#include <arpa/inet.h>   // for inet_ntop, INET_ADDRSTRLEN
+#include <errno.h>       // for errno, EINTR
+#include <pthread.h>     // for pthread_create, pthread_join, pthread_key_create, ...
+#include <stdarg.h>      // for va_end, va_start
+#include <stdint.h>      // for uint32_t, uint64_t
+#include <stdio.h>       // for snprintf, vsnprintf, NULL
+#include <stdlib.h>      // for free, aligned_alloc, atexit
+#include <string.h>      // for memset, strlen
+#include <strings.h>     // for strcasecmp
+#include <sys/eventfd.h> // for eventfd, EFD_CLOEXEC
+#include <sys/uio.h>     // for writev, iovec
+#include <time.h>        // for clock_gettime, localtime_r, strftime
+#include <unistd.h>      // for write, read, STDOUT_FILENO
 
 log_level_t log_level = LOG_INFO;
 const char *level_str[] = {"DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
-// 定义全局互斥锁，保护日志输出
-static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// 每个线程一个单生产者环形缓冲区，由写线程统一输出
+typedef struct {
+    uint32_t len;
+    char data[LOG_LINE_MAX];
+} log_slot_t;
+
+typedef struct {
+    uint32_t head __attribute__((aligned(64)));   // 生产者写入的位置
+    uint32_t tail __attribute__((aligned(64)));   // 写线程读取的位置
+    uint64_t dropped;
+    int in_use;                                   // 线程退出后置 0，可由新线程接管
+    log_slot_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+static log_ring_t *rings[LOG_MAX_RINGS];
+static uint32_t num_rings;
+static __thread log_ring_t *thread_ring;
+static __thread int ring_failed;                 // 注册失败后不再重试，直接同步输出
+static pthread_key_t ring_key;
+
+static pthread_t writer_tid;
+static int writer_running;
+static int writer_stop;
+static int writer_sleeping;
+static int wake_fd = -1;
+
+// 时间戳按秒缓存，同一秒内的日志不再格式化时间
+static __thread time_t cached_sec = -1;
+static __thread char cached_time[32];
+
+static const char* log_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if (ts.tv_sec != cached_sec) {
+        struct tm tm;
+        localtime_r(&ts.tv_sec, &tm);
+        strftime(cached_time, sizeof(cached_time), "%a %b %e %H:%M:%S %Y", &tm);
+        cached_sec = ts.tv_sec;
+    }
+    return cached_time;
+}
+
+// 格式化一行日志（含换行），超长时截断
+static size_t format_line(char *buf, size_t cap, log_level_t level, const char *format, va_list args) {
+    int n = snprintf(buf, cap, "[%s] %-5s ", log_time(), level_str[level]);
+    if (n < 0 || (size_t)n >= cap - 1) n = 0;
+
+    int m = vsnprintf(buf + n, cap - n - 1, format, args);
+    if (m < 0) m = 0;
+    if ((size_t)m > cap - n - 2) m = cap - n - 2;
+    buf[n + m] = '\n';
+    return n + m + 1;
+}
+
+// 直接写到标准输出，写线程启动前和致命错误时使用
+static void write_line(const char *line, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(STDOUT_FILENO, line, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        line += w;
+        len -= w;
+    }
+}
+
+// 线程退出时归还缓冲区，其中未输出的日志仍由写线程输出
+static void release_ring(void *arg) {
+    log_ring_t *r = arg;
+    thread_ring = NULL;
+    __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+// 获取当前线程的环形缓冲区，首次使用时优先接管已退出线程的缓冲区
+static log_ring_t* get_ring(void) {
+    if (thread_ring) return thread_ring;
+    if (ring_failed) return NULL;
+
+    log_ring_t *r = NULL;
+    uint32_t count = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count && !r; i++) {
+        log_ring_t *c = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        int expected = 0;
+        if (c && __atomic_compare_exchange_n(&c->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            r = c;
+        }
+    }
+
+    if (!r) {
+        // 先占位再分配，计数不会超过上限
+        uint32_t i = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+        do {
+            if (i >= LOG_MAX_RINGS) {
+                ring_failed = 1;
+                return NULL;
+            }
+        } while (!__atomic_compare_exchange_n(&num_rings, &i, i + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+        r = aligned_alloc(64, sizeof(log_ring_t));
+        if (!r) {
+            // 位置已占用，留空即可，写线程会跳过
+            ring_failed = 1;
+            return NULL;
+        }
+        memset(r, 0, sizeof(*r));
+        r->in_use = 1;
+        __atomic_store_n(&rings[i], r, __ATOMIC_RELEASE);
+    }
+
+    pthread_setspecific(ring_key, r);
+    thread_ring = r;
+    return r;
+}
+
+static void wake_writer(void) {
+    if (__atomic_load_n(&writer_sleeping, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        ssize_t w = write(wake_fd, &one, sizeof(one));
+        (void)w;
+    }
+}
 
 // 输出日志
 void vlog_msg(log_level_t level, const char *format, va_list args) {
     if (level < log_level) return;
 
-    // 加互斥锁，确保整个日志打印过程是原子操作
-    pthread_mutex_lock(&log_mutex);
-    time_t now;
-    time(&now);
-    char *timestr = ctime(&now);
-    timestr[strlen(timestr) - 1] = '\0';
-
-    printf("[%s] %-5s ", timestr, level_str[level]);
-    vprintf(format, args);
-    printf("\n");
-    fflush(stdout);
-    // 释放互斥锁，让其他线程可以打印日志
-    pthread_mutex_unlock(&log_mutex);
+    log_ring_t *r = level < LOG_FATAL && __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE) ?
+                    get_ring() : NULL;
+    if (r) {
+        uint32_t head = r->head;
+        if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS) {
+            // 缓冲区已满，丢弃而不阻塞
+            __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        log_slot_t *slot = &r->slots[head & (LOG_RING_SLOTS - 1)];
+        slot->len = format_line(slot->data, sizeof(slot->data), level, format, args);
+        __atomic_store_n(&r->head, head + 1, __ATOMIC_SEQ_CST);
+        wake_writer();
+        return;
+    }
+
+    char line[LOG_LINE_MAX];
+    write_line(line, format_line(line, sizeof(line), level, format, args));
 }
 
-// 输出日志
-void log_msg(log_level_t level, const char *format, ...) {
+// 输出日志，通常通过 log_msg 宏调用
+void log_write(log_level_t level, const char *format, ...) {
     va_list args;
     va_start(args, format);
     vlog_msg(level, format, args);
     va_end(args);
 }
 
+// 格式化IPv4地址，使用线程局部的轮转缓冲区，同一条日志中可以调用多次
+const char* log_addr(struct in_addr addr) {
+    static __thread char bufs[4][INET_ADDRSTRLEN];
+    static __thread unsigned int next;
+    char *buf = bufs[next++ & 3];
+    return inet_ntop(AF_INET, &addr, buf, INET_ADDRSTRLEN);
+}
+
+// 收集所有缓冲区中的日志，批量写出，返回写出的行数
+static int drain_rings(void) {
+    struct iovec iov[LOG_BATCH];
+    uint32_t next_tail[LOG_MAX_RINGS];
+    uint64_t dropped = 0;
+    int n = 0;
+
+    uint32_t count = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+    if (count > LOG_MAX_RINGS) count = LOG_MAX_RINGS;
+
+    for (uint32_t i = 0; i < count; i++) {
+        log_ring_t *r = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (!r) continue;
+
+        uint32_t tail = r->tail;
+        uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        for (; tail != head && n < LOG_BATCH; tail++) {
+            log_slot_t *slot = &r->slots[tail & (LOG_RING_SLOTS - 1)];
+            iov[n].iov_base = slot->data;
+            iov[n].iov_len = slot->len;
+            n++;
+        }
+        next_tail[i] = tail;
+        dropped += __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+    }
+
+    // 部分写入时继续写剩余的部分
+    struct iovec *v = iov;
+    int left = n;
+    while (left > 0) {
+        ssize_t w = writev(STDOUT_FILENO, v, left);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        while (left > 0 && (size_t)w >= v->iov_len) {
+            w -= v->iov_len;
+            v++;
+            left--;
+        }
+        if (left > 0) {
+            v->iov_base = (char*)v->iov_base + w;
+            v->iov_len -= w;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        log_ring_t *r = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (r) __atomic_store_n(&r->tail, next_tail[i], __ATOMIC_RELEASE);
+    }
+
+    if (dropped) {
+        char line[LOG_LINE_MAX];
+        snprintf(line, sizeof(line), "[%s] %-5s Dropped %llu log messages (log buffer full)\n",
+                 log_time(), level_str[LOG_WARN], (unsigned long long)dropped);
+        write_line(line, strlen(line));
+    }
+    return n;
+}
+
+// 是否还有未输出的日志
+static int rings_pending(void) {
+    uint32_t count = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+    if (count > LOG_MAX_RINGS) count = LOG_MAX_RINGS;
+    for (uint32_t i = 0; i < count; i++) {
+        log_ring_t *r = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (r && __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) != r->tail) return 1;
+    }
+    return 0;
+}
+
+// 写线程：没有日志时阻塞在 eventfd 上，由生产者唤醒
+static void* log_writer(void *arg) {
+    (void)arg;
+    while (1) {
+        if (drain_rings() > 0) continue;
+        if (__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) break;
+
+        __atomic_store_n(&writer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (rings_pending() || __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        uint64_t v;
+        ssize_t r = read(wake_fd, &v, sizeof(v));
+        (void)r;
+    }
+    return NULL;
+}
+
+// 启动写线程，之后的日志异步输出
+int start_log_writer(void) {
+    if (writer_running) return 0;
+
+    if (pthread_key_create(&ring_key, release_ring) != 0) return 1;
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) return 1;
+    if (pthread_create(&writer_tid, NULL, log_writer, NULL) != 0) {
+        close(wake_fd);
+        wake_fd = -1;
+        return 1;
+    }
+    __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+    atexit(log_cleanup);
+    return 0;
+}
+
 // 将字符转为日志级别
 int parse_log_level(const char *level_str, int default_val) {
-    if (level_str == NULL) return default_val;    
+    if (level_str == NULL) return default_val;
 
     if (strcasecmp(level_str, "DEBUG") == 0) return LOG_DEBUG;
     if (strcasecmp(level_str, "INFO")  == 0) return LOG_INFO;
@@ -52,18 +296,26 @@ int parse_log_level(const char *level_str, int default_val) {
     if (strcasecmp(level_str, "FATAL") == 0) return LOG_FATAL;
 
     int *intptr = str2int(level_str);
-    
+
     if (intptr != NULL) {
         int conv_level = (int)*intptr;
         free(intptr);
-        if (conv_level >= LOG_DEBUG && 
+        if (conv_level >= LOG_DEBUG &&
             conv_level <= LOG_FATAL) return (int)conv_level;
     }
 
     return default_val;
 }
 
-// 程序退出前建议销毁锁
+// 程序退出前停止写线程，输出剩余的日志
 void log_cleanup() {
-    pthread_mutex_destroy(&log_mutex);
-}
\ No newline at end of file
+    if (!__atomic_exchange_n(&writer_running, 0, __ATOMIC_ACQ_REL)) return;
+
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    ssize_t w = write(wake_fd, &one, sizeof(one));
+    (void)w;
+    pthread_join(writer_tid, NULL);
+    close(wake_fd);
+    wake_fd = -1;
+}
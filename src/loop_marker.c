@@ -1,101 +1,99 @@
-#include "logging.h"    // for log_msg, LOG_ERROR, LOG_DEBUG
+#include "logging.h"    // for log_msg, LOG_ERROR
 #include "loop_marker.h"
-#include <arpa/inet.h>  // for htons, ntohs
+#include "wire.h"       // for wire_find_opt, wire_splice, wire_get_u16, ...
 #include <string.h>     // for size_t, memcpy
-// #include <ldns/edns.h>  // for ldns_edns_deep_free, ldns_edns_get_code, ldns...
-#include <ldns/ldns.h>
 
-// 添加或更新环路检测标识
-void add_loop_marker(ldns_pkt *pkt, uint16_t hop_count)
+// 在OPT RR的线格式中添加或更新环路检测标识
+int add_loop_marker(uint8_t *pkt, size_t *len, size_t cap, uint16_t hop_count)
 {
-    if (!pkt) {
-        log_msg(LOG_ERROR, "Failed for add loopmarker: pkt is NULL");
-        return;
+    uint8_t option[4 + HOP_COUNT_DATA_LEN];
+    wire_set_u16(option, MY_OPTION_CODE);
+    wire_set_u16(option + 2, HOP_COUNT_DATA_LEN);
+    wire_set_u16(option + 4, hop_count);
+
+    size_t opt;
+    int found = wire_find_opt(pkt, *len, &opt);
+    if (found < 0) {
+        log_msg(LOG_ERROR, "Failed for add loop marker: malformed packet");
+        return -1;
     }
 
-    /* 确保 packet 有 EDNS（OPT RR 会自动生成） */
-    ldns_pkt_set_edns_udp_size(pkt, 4096);
-    ldns_pkt_set_edns_version(pkt, 0);
+    /* 没有 OPT RR 则在报文末尾追加一条 */
+    if (!found) {
+        uint8_t rr[11 + sizeof(option)] = {0};
+        wire_set_u16(rr + 1, DNS_TYPE_OPT);
+        wire_set_u16(rr + 3, EDNS_UDP_SIZE);
+        wire_set_u16(rr + 9, sizeof(option));
+        memcpy(rr + 11, option, sizeof(option));
 
-    /* 获取或创建 EDNS option list */
-    ldns_edns_option_list *olist = ldns_pkt_edns_get_option_list(pkt);
-    if (!olist) {
-        olist = ldns_edns_option_list_new();
-        if (!olist) {
-            log_msg(LOG_ERROR, "Failed to create EDNS option list");
-            return;
+        if (*len + sizeof(rr) > cap) {
+            log_msg(LOG_ERROR, "Failed for add loop marker: packet too large");
+            return -1;
         }
-        ldns_pkt_set_edns_option_list(pkt, olist);
+        memcpy(pkt + *len, rr, sizeof(rr));
+        *len += sizeof(rr);
+        wire_set_u16(pkt + DNS_OFF_ARCOUNT, wire_get_u16(pkt + DNS_OFF_ARCOUNT) + 1);
+        return 0;
     }
 
-    /* 构造新的 option 数据 */
-    uint16_t hops_n = htons(hop_count);
-    ldns_edns_option *new_opt = ldns_edns_new_from_data(
-        (ldns_edns_option_code)MY_OPTION_CODE,
-        sizeof(hops_n),
-        &hops_n
-    );
-    if (!new_opt) {
-        log_msg(LOG_ERROR, "Failed to create EDNS option");
-        return;
-    }
+    /* OPT RR 的名称必须是根域 */
+    if (pkt[opt] != 0) return -1;
+    size_t fixed = opt + 1;
+    wire_set_u16(pkt + fixed + 2, EDNS_UDP_SIZE);
+    pkt[fixed + 5] = 0;  // EDNS version
 
-    /* 检查是否已有同样 code 的 option，替换旧的 */
-    size_t count = ldns_edns_option_list_get_count(olist);
-    for (size_t i = 0; i < count; i++) {
-        ldns_edns_option *opt = ldns_edns_option_list_get_option(olist, i);
-        if (!opt) continue;
+    size_t rdlen = wire_get_u16(pkt + fixed + 8);
+    size_t p = fixed + 10;
+    size_t rdend = p + rdlen;
+    if (rdend > *len) {
+        log_msg(LOG_ERROR, "Failed for add loop marker: malformed OPT record");
+        return -1;
+    }
 
-        if (ldns_edns_get_code(opt) == (ldns_edns_option_code)MY_OPTION_CODE) {
-            ldns_edns_option *old = ldns_edns_option_list_set_option(olist, new_opt, i);
-            if (old) {
-                ldns_edns_deep_free(old);
-            }
-            /* new_opt 已被列表接管 */
-            return;
+    /* 已有同样 code 的 option 则原地更新 */
+    while (p + 4 <= rdend) {
+        uint16_t code = wire_get_u16(pkt + p);
+        size_t olen = wire_get_u16(pkt + p + 2);
+        if (p + 4 + olen > rdend) return -1;
+        if (code == MY_OPTION_CODE && olen == HOP_COUNT_DATA_LEN) {
+            wire_set_u16(pkt + p + 4, hop_count);
+            return 0;
         }
+        p += 4 + olen;
     }
 
-    /* 没找到则追加 */
-    if (!ldns_edns_option_list_push(olist, new_opt)) {
-        log_msg(LOG_ERROR, "Failed to push new EDNS option");
-        ldns_edns_deep_free(new_opt);
+    /* 没找到则追加到 OPT RDATA 末尾 */
+    if (rdlen + sizeof(option) > 0xffff ||
+        wire_splice(pkt, len, cap, rdend, 0, option, sizeof(option)) != 0) {
+        log_msg(LOG_ERROR, "Failed to append loop marker option");
+        return -1;
     }
+    wire_set_u16(pkt + fixed + 8, rdlen + sizeof(option));
+    return 0;
 }
 
-// 获取环路检测标识
-uint16_t get_loop_marker(ldns_pkt *pkt)
+// 从OPT RR的线格式中读取环路检测标识，没有标识时返回0
+uint16_t get_loop_marker(const uint8_t *pkt, size_t len)
 {
-    if (!pkt) {
-        log_msg(LOG_ERROR, "Failed for get loop marker: pkt is NULL");
-        return 0;
-    }
+    // 大多数查询没有附加段，无需遍历
+    if (len < DNS_HEADER_SIZE || wire_get_u16(pkt + DNS_OFF_ARCOUNT) == 0) return 0;
 
-    ldns_edns_option_list *olist = ldns_pkt_edns_get_option_list(pkt);
-    if (!olist) {
-        log_msg(LOG_DEBUG, "Failed for get loop marker: no EDNS option list");
-        return 0;
-    }
+    size_t opt;
+    if (wire_find_opt(pkt, len, &opt) != 1 || pkt[opt] != 0) return 0;
 
-    size_t count = ldns_edns_option_list_get_count(olist);
-    for (size_t i = 0; i < count; i++) {
-        ldns_edns_option *opt = ldns_edns_option_list_get_option(olist, i);
-        if (!opt) continue;
+    size_t rdlen = wire_get_u16(pkt + opt + 9);
+    size_t p = opt + 11;
+    size_t rdend = p + rdlen;
+    if (rdend > len) return 0;
 
-        if (ldns_edns_get_code(opt) == (ldns_edns_option_code)MY_OPTION_CODE) {
-            const uint8_t *data = ldns_edns_get_data(opt);
-            size_t datalen = ldns_edns_get_size(opt);
-            if (!data || datalen < HOP_COUNT_DATA_LEN) {
-                log_msg(LOG_ERROR, "Option found but data too short");
-                return 0;
-            }
-
-            uint16_t hops;
-            memcpy(&hops, data, sizeof(uint16_t));
-            return ntohs(hops);
+    while (p + 4 <= rdend) {
+        uint16_t code = wire_get_u16(pkt + p);
+        size_t olen = wire_get_u16(pkt + p + 2);
+        if (p + 4 + olen > rdend) break;
+        if (code == MY_OPTION_CODE && olen >= HOP_COUNT_DATA_LEN) {
+            return wire_get_u16(pkt + p + 4);
         }
+        p += 4 + olen;
     }
-
-    log_msg(LOG_ERROR, "Option code %u not found", MY_OPTION_CODE);
     return 0;
 }
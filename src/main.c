@@ -1,22 +1,37 @@
-#include "config.h"      // for init_config_argc, init_config_env, listen_port
+#include "cache.h"       // for init_cache, cache_flush, cache_save, start_cache_persistence
+#include "chaos.h"       // for init_chaos, handle_chaos_query
+#include "config.h"      // for init_config_argc, init_config_env, reload_config, listen_port
 #include "daemon.h"      // for daemonize
-#include "dns.h"         // for process_dns_query, test_forward_dns
-#include "gateway.h"     // for resolve_gateway_ip
+#include "dns.h"         // for process_dns_query, refuse_unmatched, update_hedge_delay, wire_get_u16
+#include "docker.h"      // for start_docker_watcher
+#include "gateway.h"     // for init_gateway, resolve_gateway_ip, start_gateway_monitor
+#include "handoff.h"     // for inherit_listen_fds, receive_handoff, start_handoff_server, ...
 #include "logging.h"     // for log_msg, LOG_INFO, LOG_FATAL, LOG_WARN, log_...
 #include "queue.h"       // for dns_request_t, dequeue_request, enqueue_request
-#include "sigterm.h"     // for setup_signal_handlers, stop
-#include <arpa/inet.h>   // for inet_ntoa, htons
+#include "metrics.h"     // for start_metrics_server, metric_inc, monotonic_ns
+#include "probes.h"      // for PROBE1, PROBE2, PROBE3
+#include "querylog.h"    // for open_querylog, querylog_write
+#include "records.h"     // for load_records, num_records
+#include "route.h"       // for routes, num_routes
+#include "sigterm.h"     // for setup_signal_handlers, stop, reload
+#include "snapshot.h"    // for build_snapshot, publish_snapshot, reclaim_snapshots, snapshot_idle
+#include <arpa/inet.h>   // for htons, ntohl
 #include <errno.h>       // for errno, EAGAIN, EINTR, EWOULDBLOCK
 #include <netinet/in.h>  // for sockaddr_in, in_addr, INADDR_ANY
 #include <pthread.h>     // for pthread_create, pthread_detach, pthread_t
 #include <stdio.h>       // for perror, ssize_t
 #include <string.h>      // for strerror
-#include <sys/socket.h>  // for setsockopt, bind, recvfrom, socket, AF_INET
+#include <sys/socket.h>  // for setsockopt, bind, recvfrom, sendto, socket, getsockname
 #include <sys/time.h>    // for timeval
+#include <time.h>        // for nanosleep, timespec
 #include <unistd.h>      // for close, NULL
 
 struct in_addr gateway_addr;                // 存储网关IP地址
 
+// 运行中和配置的工作线程数，配置减少后多出的线程处理完下一个查询时退出
+static int running_workers;
+static int target_workers;
+
 // 任务线程
 void* worker_thread(void *arg) {
     int sockfd = *(int*)arg;
@@ -24,22 +39,102 @@ void* worker_thread(void *arg) {
         dns_request_t req;
         dequeue_request(&req);
 
-        process_dns_query(sockfd, req.data, req.len, &req.client_addr, req.client_len);
+        process_dns_query(sockfd, req.data, req.len, &req.client_addr, req.client_len, req.recv_ns);
+
+        int n = __atomic_load_n(&running_workers, __ATOMIC_RELAXED);
+        while (n > __atomic_load_n(&target_workers, __ATOMIC_RELAXED)) {
+            if (__atomic_compare_exchange_n(&running_workers, &n, n - 1, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                snapshot_release();
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+// 调整工作线程数，增加时立即创建
+static void set_workers(int n, int *sockfd) {
+    __atomic_store_n(&target_workers, n, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&running_workers, __ATOMIC_RELAXED) < n) {
+        pthread_t tid;
+        __atomic_add_fetch(&running_workers, 1, __ATOMIC_RELAXED);
+        if (pthread_create(&tid, NULL, worker_thread, sockfd) != 0) {
+            __atomic_sub_fetch(&running_workers, 1, __ATOMIC_RELAXED);
+            log_msg(LOG_ERROR, "Failed to create worker thread");
+            break;
+        }
+        pthread_detach(tid);
+    }
+}
+
+// 测试上游可能要等到超时，放到后台线程，不推迟开始应答
+static void* forward_dns_test(void *arg) {
+    (void)arg;
+    if (!test_forward_dns()) {
+        log_msg(LOG_WARN, "Forward DNS server may not be available");
     }
     return NULL;
 }
 
+// 交出套接字后等待队列中和正在处理的查询完成
+static void drain_queries(void) {
+    struct timespec ts = {0, 10 * 1000000};
+    for (int waited = 0; waited < HANDOFF_DRAIN_MS; waited += 10) {
+        if (queue_depth() == 0 && snapshot_idle()) return;
+        nanosleep(&ts, NULL);
+    }
+    log_msg(LOG_WARN, "Queries still in progress after %d ms, exiting anyway", HANDOFF_DRAIN_MS);
+}
+
+static void log_routes(void) {
+    for (int i = 1; i < num_routes; i++) {
+        log_msg(LOG_INFO, "Route *%s to %s%s (%d upstreams, suffix: %s)",
+                routes[i].suffix, routes[i].upstream_str[0],
+                routes[i].num_upstreams > 1 ? ", ..." : "",
+                routes[i].num_upstreams, routes[i].keep_suffix ? "keep" : "strip");
+    }
+}
+
+// 重新加载配置，套接字、任务队列和其余线程保持运行
+static void handle_reload(int *sockfd) {
+    snapshot_t *conf = reload_config();
+    if (!conf) {
+        log_msg(LOG_ERROR, "Failed to reload configuration, keeping the current one");
+        return;
+    }
+    publish_snapshot(conf);
+    set_workers(num_workers, sockfd);
+    // 上游和路由可能已经改变，缓存的应答不再可信
+    cache_flush();
+
+    log_msg(LOG_INFO, "Reloaded %s: forwarding *%s to %s (suffix: %s, workers: %d, hops: %d)",
+            env_file, suffix_domain, forward_dns, keep_suffix ? "keep" : "strip", num_workers, max_hops);
+    log_routes();
+}
+
 // 主程序入口
 int main(int argc, char *argv[]) {
 
+    init_config_file(argc, argv);
+
     init_config_env();
 
     init_config_argc(argc, argv);
 
+    // systemd 只把套接字交给它启动的进程，需在守护进程化之前检查
+    int sockfd = -1, metrics_fd = -1;
+    int activated = inherit_listen_fds(&sockfd, &metrics_fd);
+
     if (!foreground) daemonize();
 
     setup_signal_handlers();
 
+    // 守护进程化之后再启动日志写线程
+    if (start_log_writer() != 0) {
+        log_msg(LOG_WARN, "Failed to start log writer, logging synchronously");
+    }
+
     log_msg(LOG_INFO, "Welcome to use Sharky DNS forwarder");
     
     log_msg(LOG_INFO, "Version: %s. ldns version: %s", VERSION, LDNS_VERSION);
@@ -50,49 +145,119 @@ int main(int argc, char *argv[]) {
 
     log_msg(LOG_INFO, "Set container name to %s", container_name);
         
-    if (!test_forward_dns()) {
-        log_msg(LOG_WARN, "Forward DNS server may not be available");
-    } 
+    pthread_t test_tid;
+    if (pthread_create(&test_tid, NULL, forward_dns_test, NULL) == 0) pthread_detach(test_tid);
 
-    int sockfd;
     struct sockaddr_in server_addr;
 
+    snapshot_t *conf = build_snapshot();
+    if (!conf) {
+        log_msg(LOG_FATAL, "Invalid forwarding configuration");
+        return 1;
+    }
+    publish_snapshot(conf);
+
+    if (hosts_file[0]) {
+        if (load_records(hosts_file) != 0) {
+            log_msg(LOG_FATAL, "Failed to load records from %s", hosts_file);
+            return 1;
+        }
+        log_msg(LOG_INFO, "Loaded %zu local names from %s", num_records(), hosts_file);
+    }
+
+    if (docker_socket_path[0]) {
+        if (start_docker_watcher(docker_socket_path) != 0) {
+            log_msg(LOG_FATAL, "Failed to start docker watcher on %s", docker_socket_path);
+            return 1;
+        }
+        log_msg(LOG_INFO, "Watching docker events on %s", docker_socket_path);
+    }
+
+    if (query_log_path[0] && open_querylog(query_log_path, query_log_size) != 0) {
+        log_msg(LOG_FATAL, "Failed to open query log %s", query_log_path);
+        return 1;
+    }
+
+    if (init_cache(cache_size) != 0) {
+        log_msg(LOG_FATAL, "Failed to create answer cache");
+        return 1;
+    }
+    if (cache_size) log_msg(LOG_INFO, "Caching up to %d forwarded answers", cache_size);
+
+    if (init_chaos(stats_allow) != 0) {
+        log_msg(LOG_FATAL, "Invalid %s", STATS_ALLOW_ENV);
+        return 1;
+    }
+
     gateway_addr.s_addr = 0;
+    init_gateway();
+    // 先订阅路由变化再读取默认路由，避免遗漏两者之间的变化
+    if (start_gateway_monitor() != 0) {
+        log_msg(LOG_WARN, "Gateway IP will not follow route changes");
+    }
     if (resolve_gateway_ip() != 0) {
         log_msg(LOG_WARN, "Failed to resolve gateway IP at startup");
     } else {
         if (gateway_name[0]) {
-            log_msg(LOG_INFO, "Gateway %s%s IP resolved to: %s",gateway_name ,suffix_domain , inet_ntoa(gateway_addr));
+            log_msg(LOG_INFO, "Gateway %s%s IP resolved to: %s",gateway_name ,suffix_domain , log_addr(gateway_addr));
         } else {
             log_msg(LOG_WARN, "Gateway name undefined");
-            log_msg(LOG_INFO, "Gateway IP resolved to: %s", inet_ntoa(gateway_addr));
+            log_msg(LOG_INFO, "Gateway IP resolved to: %s", log_addr(gateway_addr));
         }
     }
 
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        log_msg(LOG_FATAL, "Failed to create socket: %s", strerror(errno));
-        perror("socket");
-        return 1;
+    // 初始化都完成后再接管旧进程的套接字，避免新进程启动失败时两边都不应答
+    int inherited = activated;
+    if (!inherited && upgrade_socket[0] && receive_handoff(upgrade_socket, &sockfd, &metrics_fd) == 0) {
+        inherited = 1;
+        log_msg(LOG_INFO, "Took over listen sockets from the previous process");
+    } else if (activated) {
+        log_msg(LOG_INFO, "Using listen sockets passed by systemd");
     }
 
-    int reuse = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
-        log_msg(LOG_FATAL, "Failed to set SO_REUSEADDR on socket: %s", strerror(errno));
-        perror("setsockopt SO_REUSEADDR");
-        close(sockfd);
-        return 1;
+    // 旧进程交出套接字前已保存缓存，接管之后再导入；导入在后台进行，不推迟开始应答
+    if (cache_size && cache_file[0] && start_cache_persistence(cache_file) != 0) {
+        log_msg(LOG_WARN, "Answer cache will not be saved to %s", cache_file);
     }
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(listen_port);
+    if (!metrics_listen[0] && metrics_fd >= 0) {
+        close(metrics_fd);
+        metrics_fd = -1;
+    }
+    if (metrics_listen[0]) {
+        if (start_metrics_server(metrics_listen, &metrics_fd) != 0) {
+            log_msg(LOG_FATAL, "Failed to start metrics server on %s", metrics_listen);
+            return 1;
+        }
+        log_msg(LOG_INFO, "Serving metrics on %s", metrics_listen);
+    }
 
-    if (bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        log_msg(LOG_FATAL, "Failed to bind socket to port %d", listen_port);
-        perror("bind"); 
-        close(sockfd);
-        return 1;
+    if (sockfd < 0) {
+        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sockfd < 0) {
+            log_msg(LOG_FATAL, "Failed to create socket: %s", strerror(errno));
+            perror("socket");
+            return 1;
+        }
+
+        int reuse = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+            log_msg(LOG_FATAL, "Failed to set SO_REUSEADDR on socket: %s", strerror(errno));
+            perror("setsockopt SO_REUSEADDR");
+            close(sockfd);
+            return 1;
+        }
+
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_port = htons(listen_port);
+
+        if (bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            log_msg(LOG_FATAL, "Failed to bind socket to port %d", listen_port);
+            perror("bind"); 
+            close(sockfd);
+            return 1;
+        }
     }
 
     struct timeval tv = {1, 0};
@@ -103,17 +268,33 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    log_msg(LOG_INFO, "DNS forwarder listening on port %d, forwarding *%s to %s (suffix: %s)",
+    // 继承来的套接字以实际绑定的端口为准
+    socklen_t addr_len = sizeof(server_addr);
+    if (inherited && getsockname(sockfd, (struct sockaddr*)&server_addr, &addr_len) == 0) {
+        listen_port = ntohs(server_addr.sin_port);
+    }
+
+    if (upgrade_socket[0] && start_handoff_server(upgrade_socket, sockfd, metrics_fd) != 0) {
+        log_msg(LOG_WARN, "A new process will not be able to take over the listen sockets");
+    }
+
+    log_msg(LOG_INFO, "DNS forwarder %s port %d, forwarding *%s to %s (suffix: %s)",
+            inherited ? "serving inherited socket for" : "listening on",
             listen_port, suffix_domain, forward_dns, keep_suffix ? "keep" : "strip");
+    log_routes();
 
+    if (hedge_percent) log_msg(LOG_INFO, "Hedging up to %d%% of slow upstream queries", hedge_percent);
     log_msg(LOG_INFO, "Create DNS pthread (workers: %d, hops: %d)", num_workers, max_hops);
-    for (int i = 0; i < num_workers; i++) {
-        pthread_t tid;
-        pthread_create(&tid, NULL, worker_thread, &sockfd);
-        pthread_detach(tid);
-    }
+    set_workers(num_workers, &sockfd);
+
+    while (!stop && !handed_off) {
+        if (reload) {
+            reload = 0;
+            handle_reload(&sockfd);
+        }
+        reclaim_snapshots();
+        update_hedge_delay();
 
-    while (!stop) {
         dns_request_t req;
         req.client_len = sizeof(req.client_addr);
 
@@ -128,14 +309,53 @@ int main(int argc, char *argv[]) {
         }
 
         req.len = n;
-        enqueue_request(&req);
+        req.recv_ns = monotonic_ns();
+        uint16_t id = n >= 2 ? wire_get_u16(req.data) : 0;
+        PROBE3(query_recv, id, ntohl(req.client_addr.sin_addr.s_addr), n);
+
+        // 不匹配后缀的查询直接在接收线程上拒绝，不进入任务队列
+        // CH 类的状态查询同样直接应答，过载时也能查看
+        if (handle_chaos_query(req.data, &req.len, sizeof(req.data), req.client_addr.sin_addr)) {
+            sendto(sockfd, req.data, req.len, 0,
+                   (struct sockaddr*)&req.client_addr, req.client_len);
+            continue;
+        }
+
+        if (refuse_unmatched(req.data, &req.len)) {
+            sendto(sockfd, req.data, req.len, 0,
+                   (struct sockaddr*)&req.client_addr, req.client_len);
+            metric_inc(M_QUERIES_REFUSED);
+            PROBE1(query_refused, id);
+            metric_observe(H_TOTAL, monotonic_ns() - req.recv_ns);
+            // 拒绝响应保留了原查询的问题段
+            if (querylog_enabled()) {
+                querylog_write(req.data, n, req.data, req.len, &req.client_addr, req.recv_ns, QLOG_SRC_REFUSED);
+            }
+            continue;
+        }
+
+        // 工作线程处理不过来时丢弃，客户端会重试
+        if (enqueue_request(&req) != 0) {
+            metric_inc(M_QUEUE_DROPS);
+            PROBE1(query_drop, id);
+            log_msg(LOG_DEBUG, "Worker queue full, dropped query from %s", log_addr(req.client_addr.sin_addr));
+            continue;
+        }
+        PROBE1(query_enqueue, id);
 
         log_msg(LOG_DEBUG, "Received DNS query from %s:%d (%zd bytes)", 
-            inet_ntoa(req.client_addr.sin_addr),  // 客户端IP字符串
+            log_addr(req.client_addr.sin_addr),   // 客户端IP字符串
             ntohs(req.client_addr.sin_port),      // 客户端端口（网络字节序转主机序）
             n);                                   // 接收的字节数);
     }
 
+    if (handed_off) drain_queries();
+
+    // 交接时已在交出套接字前保存，之后由新进程负责，不再覆盖它正在导入的文件
+    if (!handed_off && cache_size && cache_file[0] && cache_save(cache_file) == 0) {
+        log_msg(LOG_INFO, "Saved answer cache to %s", cache_file);
+    }
+
     log_msg(LOG_INFO, "Shutting down gracefully");
     log_cleanup();
     close(sockfd);
@@ -0,0 +1,340 @@
+#include "cache.h"       // for cache_enabled, cache_entries
+#include "logging.h"     // for log_msg, LOG_ERROR, LOG_INFO
+#include "metrics.h"
+#include "queue.h"       // for queue_depth, QUEUE_SIZE
+#include <arpa/inet.h>   // for inet_pton, htons
+#include <errno.h>       // for errno, EINTR
+#include <netinet/in.h>  // for sockaddr_in, INADDR_LOOPBACK
+#include <pthread.h>     // for pthread_create, pthread_detach, pthread_t
+#include <stdarg.h>      // for va_list, va_start, va_end
+#include <stdio.h>       // for snprintf, vsnprintf
+#include <stdlib.h>      // for atoi
+#include <string.h>      // for memset, strchr, strrchr, strncmp, strerror
+#include <sys/socket.h>  // for socket, bind, listen, accept, recv, send
+#include <sys/time.h>    // for timeval
+#include <unistd.h>      // for close
+
+// 每个线程一份计数器，只由所属线程写入，抓取时汇总
+typedef struct {
+    uint64_t counters[M_COUNTERS];
+    hist_data_t hist[H_COUNT];
+} __attribute__((aligned(64))) metrics_shard_t;
+
+static metrics_shard_t shards[METRICS_MAX_SHARDS];
+static uint32_t num_shards;
+// 线程数超过分片数时共用，需要原子加
+static metrics_shard_t shared_shard;
+static __thread metrics_shard_t *thread_shard;
+
+static const struct {
+    const char *name;
+    const char *help;
+    const char *label;
+} counter_info[M_COUNTERS] = {
+    [M_QUERIES_LOCAL]     = {"queries_total", "Queries by outcome", "outcome=\"local\""},
+    [M_QUERIES_GATEWAY]   = {"queries_total", NULL, "outcome=\"gateway\""},
+    [M_QUERIES_DOCKER]    = {"queries_total", NULL, "outcome=\"docker\""},
+    [M_QUERIES_FORWARDED] = {"queries_total", NULL, "outcome=\"forwarded\""},
+    [M_QUERIES_REFUSED]   = {"queries_total", NULL, "outcome=\"refused\""},
+    [M_QUERIES_LOOP]      = {"queries_total", NULL, "outcome=\"loop\""},
+    [M_QUERIES_CACHED]    = {"queries_total", NULL, "outcome=\"cached\""},
+    [M_UPSTREAM_TIMEOUTS] = {"upstream_timeouts_total", "Upstream exchanges that timed out", NULL},
+    [M_UPSTREAM_ERRORS]   = {"upstream_errors_total", "Upstream exchanges that failed to send or poll", NULL},
+    [M_QUEUE_DROPS]       = {"queue_drops_total", "Queries dropped because the worker queue was full", NULL},
+    [M_TRUNCATED]         = {"truncated_total", "Responses sent with the TC bit set", NULL},
+    [M_CACHE_MISSES]      = {"cache_misses_total", "Forwarded queries not found in the answer cache", NULL},
+    [M_HEDGES]            = {"hedged_total", "Upstream queries sent a second time after the hedge delay", NULL},
+    [M_HEDGE_WINS]        = {"hedge_wins_total", "Hedged queries answered by the second copy first", NULL},
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} hist_info[H_COUNT] = {
+    [H_TOTAL]    = {"query_duration_seconds", "Time from receiving a query to sending the response"},
+    [H_UPSTREAM] = {"upstream_duration_seconds", "Round trip time of a single upstream exchange"},
+    [H_QUEUE]    = {"queue_wait_seconds", "Time a query waited in the worker queue"},
+    [H_PARSE]    = {"parse_duration_seconds", "Time spent parsing the question"},
+    [H_RESOLVE]  = {"resolve_duration_seconds", "Time spent building the answer, upstream included"},
+    [H_SEND]     = {"send_duration_seconds", "Time spent fitting and sending the response"},
+};
+
+static metrics_shard_t* get_shard(void) {
+    if (thread_shard) return thread_shard;
+    uint32_t i = __atomic_fetch_add(&num_shards, 1, __ATOMIC_RELAXED);
+    thread_shard = i < METRICS_MAX_SHARDS ? &shards[i] : &shared_shard;
+    return thread_shard;
+}
+
+// 只有所属线程写入时普通的读加写即可，共用分片需要原子加
+static inline void add(metrics_shard_t *s, uint64_t *p, uint64_t v) {
+    if (s == &shared_shard) __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+    else __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
+
+// 微秒值所在的桶
+static unsigned int hist_index(uint64_t us) {
+    if (us < (1u << HIST_SUB_BITS)) return us;
+    unsigned int e = 63 - __builtin_clzll(us);
+    unsigned int sub = (us >> (e - HIST_SUB_BITS)) - (1u << HIST_SUB_BITS);
+    unsigned int i = ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+    return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+// 桶内的最大值（微秒，含）
+static uint64_t hist_upper(unsigned int i) {
+    if (i < (1u << HIST_SUB_BITS)) return i;
+    unsigned int e = (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t sub = i & ((1u << HIST_SUB_BITS) - 1);
+    uint64_t lo = ((1ULL << HIST_SUB_BITS) + sub) << (e - HIST_SUB_BITS);
+    return lo + (1ULL << (e - HIST_SUB_BITS)) - 1;
+}
+
+void metric_inc(metric_t m) {
+    metrics_shard_t *s = get_shard();
+    add(s, &s->counters[m], 1);
+}
+
+// 记录一次耗时（纳秒）
+void metric_observe(histogram_t h, uint64_t ns) {
+    metrics_shard_t *s = get_shard();
+    uint64_t us = ns / 1000;
+    add(s, &s->hist[h].buckets[hist_index(us)], 1);
+    add(s, &s->hist[h].sum_us, us);
+    add(s, &s->hist[h].count, 1);
+}
+
+static uint32_t shard_count(void) {
+    uint32_t n = __atomic_load_n(&num_shards, __ATOMIC_RELAXED);
+    return n < METRICS_MAX_SHARDS ? n : METRICS_MAX_SHARDS;
+}
+
+// 汇总所有线程的计数
+uint64_t metric_total(metric_t m) {
+    uint64_t total = __atomic_load_n(&shared_shard.counters[m], __ATOMIC_RELAXED);
+    for (uint32_t i = 0, n = shard_count(); i < n; i++) {
+        total += __atomic_load_n(&shards[i].counters[m], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+void metric_histogram(histogram_t h, hist_data_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (uint32_t i = 0, n = shard_count(); i <= n; i++) {
+        const hist_data_t *src = i < n ? &shards[i].hist[h] : &shared_shard.hist[h];
+        out->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+        out->sum_us += __atomic_load_n(&src->sum_us, __ATOMIC_RELAXED);
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            out->buckets[b] += __atomic_load_n(&src->buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// 分位数（微秒），取所在桶的上界
+uint64_t hist_quantile(const hist_data_t *data, double q) {
+    uint64_t total = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) total += data->buckets[b];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += data->buckets[b];
+        if (seen > rank) return hist_upper(b);
+    }
+    return hist_upper(HIST_BUCKETS - 1);
+}
+
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+} out_buf_t;
+
+static void out(out_buf_t *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void out(out_buf_t *o, const char *fmt, ...) {
+    if (o->len >= o->cap) return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, args);
+    va_end(args);
+    if (n > 0) o->len += n;
+    if (o->len > o->cap) o->len = o->cap;
+}
+
+// 生成 Prometheus 文本格式，返回长度
+size_t format_metrics(char *buf, size_t cap) {
+    out_buf_t o = { buf, cap, 0 };
+
+    for (int m = 0; m < M_COUNTERS; m++) {
+        if (counter_info[m].help) {
+            out(&o, "# HELP " METRICS_PREFIX "%s %s\n", counter_info[m].name, counter_info[m].help);
+            out(&o, "# TYPE " METRICS_PREFIX "%s counter\n", counter_info[m].name);
+        }
+        if (counter_info[m].label) {
+            out(&o, METRICS_PREFIX "%s{%s} %llu\n", counter_info[m].name, counter_info[m].label,
+                (unsigned long long)metric_total(m));
+        } else {
+            out(&o, METRICS_PREFIX "%s %llu\n", counter_info[m].name,
+                (unsigned long long)metric_total(m));
+        }
+    }
+
+    out(&o, "# HELP " METRICS_PREFIX "queue_depth Queries waiting for a worker\n");
+    out(&o, "# TYPE " METRICS_PREFIX "queue_depth gauge\n");
+    out(&o, METRICS_PREFIX "queue_depth %d\n", queue_depth());
+    out(&o, "# HELP " METRICS_PREFIX "queue_capacity Size of the worker queue\n");
+    out(&o, "# TYPE " METRICS_PREFIX "queue_capacity gauge\n");
+    out(&o, METRICS_PREFIX "queue_capacity %d\n", QUEUE_SIZE - 1);
+    if (cache_enabled()) {
+        out(&o, "# HELP " METRICS_PREFIX "cache_entries Answers held in the cache, expired ones included\n");
+        out(&o, "# TYPE " METRICS_PREFIX "cache_entries gauge\n");
+        out(&o, METRICS_PREFIX "cache_entries %zu\n", cache_entries());
+    }
+
+    for (int h = 0; h < H_COUNT; h++) {
+        hist_data_t data;
+        metric_histogram(h, &data);
+        const char *name = hist_info[h].name;
+        out(&o, "# HELP " METRICS_PREFIX "%s %s\n", name, hist_info[h].help);
+        out(&o, "# TYPE " METRICS_PREFIX "%s histogram\n", name);
+
+        // 最后一个桶收纳了超出范围的值，只作为 +Inf 输出
+        uint64_t cumulative = 0;
+        for (int b = 0; b < HIST_BUCKETS - 1; b++) {
+            cumulative += data.buckets[b];
+            out(&o, METRICS_PREFIX "%s_bucket{le=\"%.6f\"} %llu\n", name,
+                hist_upper(b) / 1e6, (unsigned long long)cumulative);
+        }
+        // 各字段分别读取，总数以桶的合计为准，保证与 +Inf 一致
+        cumulative += data.buckets[HIST_BUCKETS - 1];
+        out(&o, METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+        out(&o, METRICS_PREFIX "%s_sum %.6f\n", name, data.sum_us / 1e6);
+        out(&o, METRICS_PREFIX "%s_count %llu\n", name, (unsigned long long)cumulative);
+    }
+    return o.len;
+}
+
+static void send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buf += n;
+        len -= n;
+    }
+}
+
+// 处理一个 HTTP 请求，只支持 GET /metrics
+static void serve_client(int fd) {
+    static char body[METRICS_BUF_SIZE];
+    char req[1024];
+    size_t len = 0;
+
+    // 读到请求行结束即可，其余的头部忽略
+    while (len < sizeof(req) - 1) {
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        len += n;
+        req[len] = '\0';
+        if (strchr(req, '\n')) break;
+    }
+
+    char head[256];
+    int n;
+    if (strncmp(req, "GET /metrics ", 13) == 0 || strncmp(req, "GET / ", 6) == 0) {
+        size_t body_len = format_metrics(body, sizeof(body));
+        n = snprintf(head, sizeof(head),
+                     "HTTP/1.0 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Connection: close\r\n\r\n", body_len);
+        send_all(fd, head, n);
+        send_all(fd, body, body_len);
+    } else {
+        n = snprintf(head, sizeof(head),
+                     "HTTP/1.0 404 Not Found\r\n"
+                     "Content-Length: 0\r\n"
+                     "Connection: close\r\n\r\n");
+        send_all(fd, head, n);
+    }
+}
+
+static void* metrics_server(void *arg) {
+    int lfd = *(int*)arg;
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) log_msg(LOG_ERROR, "Failed to accept metrics connection: %s", strerror(errno));
+            continue;
+        }
+        // 避免慢客户端阻塞抓取
+        struct timeval tv = {2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        serve_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+// 按 [ADDR:]PORT 绑定指标侦听套接字，默认只监听本机，失败时返回 -1
+static int bind_metrics(const char *listen_addr) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    const char *colon = strrchr(listen_addr, ':');
+    const char *port_str = colon ? colon + 1 : listen_addr;
+    if (colon) {
+        char host[INET_ADDRSTRLEN];
+        size_t host_len = colon - listen_addr;
+        if (host_len >= sizeof(host)) return -1;
+        memcpy(host, listen_addr, host_len);
+        host[host_len] = '\0';
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            log_msg(LOG_ERROR, "Invalid metrics address '%s'", host);
+            return -1;
+        }
+    }
+    int port = atoi(port_str);
+    if (port <= 0 || port > 65535) {
+        log_msg(LOG_ERROR, "Invalid metrics port '%s'", port_str);
+        return -1;
+    }
+    addr.sin_port = htons(port);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "Failed to create metrics socket: %s", strerror(errno));
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        log_msg(LOG_ERROR, "Failed to listen for metrics on %s: %s", listen_addr, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// *fd 为继承来的侦听套接字时直接使用，否则按 listen_addr 绑定并通过 *fd 返回
+int start_metrics_server(const char *listen_addr, int *fd) {
+    static int lfd;
+    if (*fd < 0 && (*fd = bind_metrics(listen_addr)) < 0) return 1;
+    lfd = *fd;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, metrics_server, &lfd) != 0) {
+        log_msg(LOG_ERROR, "Failed to create metrics thread");
+        close(lfd);
+        *fd = -1;
+        return 1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "logging.h"     // for log_msg, LOG_ERROR, LOG_INFO
+#include "metrics.h"     // for monotonic_ns
+#include "querylog.h"
+#include "wire.h"        // for wire_skip_name, wire_get_u16, DNS_HEADER_SIZE
+#include <arpa/inet.h>   // for ntohs
+#include <errno.h>       // for errno
+#include <fcntl.h>       // for open, O_RDWR, O_CREAT, O_CLOEXEC
+#include <string.h>      // for memcpy, strerror
+#include <sys/mman.h>    // for mmap, PROT_READ, PROT_WRITE, MAP_SHARED
+#include <sys/stat.h>    // for fstat, stat
+#include <time.h>        // for clock_gettime, timespec
+#include <unistd.h>      // for close, ftruncate, pread
+
+qlog_header_t *qlog = NULL;
+static qlog_record_t *qlog_records;
+static uint64_t qlog_mask;
+
+// 映射环形日志文件，格式相同的已有文件接着写
+int open_querylog(const char *path, size_t size_mb) {
+    if (size_mb == 0 || size_mb > QLOG_SIZE_MAX) {
+        log_msg(LOG_ERROR, "Invalid query log size %zu MB", size_mb);
+        return 1;
+    }
+
+    uint64_t capacity = 1;
+    while (capacity * 2 <= (size_mb * 1024 * 1024 - QLOG_HEADER_SIZE) / QLOG_RECORD_SIZE) capacity *= 2;
+    size_t size = QLOG_HEADER_SIZE + capacity * QLOG_RECORD_SIZE;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "Failed to open query log %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    // 先读出已有文件头，判断能否沿用
+    struct stat st;
+    qlog_header_t old = {0};
+    if (fstat(fd, &st) != 0) st.st_size = 0;
+    if ((size_t)st.st_size == size && pread(fd, &old, sizeof(old), 0) != (ssize_t)sizeof(old)) {
+        old.magic = 0;
+    }
+    int reuse = (size_t)st.st_size == size && old.magic == QLOG_MAGIC &&
+                old.version == QLOG_VERSION && old.record_size == QLOG_RECORD_SIZE &&
+                old.capacity == capacity;
+
+    // 格式不同时清空重建
+    if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+        log_msg(LOG_ERROR, "Failed to size query log %s: %s", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_msg(LOG_ERROR, "Failed to map query log %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    qlog_header_t *h = (qlog_header_t*)map;
+    if (!reuse) {
+        h->magic = QLOG_MAGIC;
+        h->version = QLOG_VERSION;
+        h->record_size = QLOG_RECORD_SIZE;
+        h->capacity = capacity;
+        h->head = 0;
+    }
+    qlog_records = (qlog_record_t*)(map + QLOG_HEADER_SIZE);
+    qlog_mask = capacity - 1;
+    __atomic_store_n(&qlog, h, __ATOMIC_RELEASE);
+
+    log_msg(LOG_INFO, "Query log %s: %llu records%s", path, (unsigned long long)capacity,
+            reuse ? ", appending" : "");
+    return 0;
+}
+
+// 记录一次查询和应答，只写映射内存，不进行系统调用
+void querylog_write(const uint8_t *query, size_t query_len, const uint8_t *resp, size_t resp_len,
+                    const struct sockaddr_in *client, uint64_t start, uint8_t source) {
+    if (!qlog) return;
+
+    struct timespec now;
+    uint64_t latency = monotonic_ns() - start;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    // 多个线程同时写入时各自占用一个槽位
+    uint64_t seq = __atomic_fetch_add(&qlog->head, 1, __ATOMIC_RELAXED);
+    qlog_record_t *rec = &qlog_records[seq & qlog_mask];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rec->ts_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec - latency;
+    rec->latency_us = latency / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(latency / 1000);
+    rec->client_addr = client->sin_addr.s_addr;
+    rec->client_port = ntohs(client->sin_port);
+    rec->id = query_len >= DNS_HEADER_SIZE ? wire_get_u16(query + DNS_OFF_ID) : 0;
+    rec->query_len = query_len;
+    rec->resp_len = resp_len;
+    rec->source = source;
+    rec->flags = 0;
+    rec->rcode = 0xff;
+    if (resp_len >= DNS_HEADER_SIZE) {
+        uint16_t flags = wire_get_u16(resp + DNS_OFF_FLAGS);
+        rec->rcode = flags & DNS_RCODE_MASK;
+        if (flags & DNS_FLAG_TC) rec->flags |= QLOG_FLAG_TC;
+    }
+
+    size_t name_end;
+    if (query_len >= DNS_HEADER_SIZE &&
+        wire_skip_name(query, query_len, DNS_HEADER_SIZE, &name_end) == 0 &&
+        name_end + 2 <= query_len) {
+        size_t name_len = name_end - DNS_HEADER_SIZE;
+        rec->qname_len = name_len;
+        rec->qtype = wire_get_u16(query + name_end);
+        if (name_len > QLOG_NAME_MAX) {
+            name_len = QLOG_NAME_MAX;
+            rec->flags |= QLOG_FLAG_NAME_TRUNC;
+        }
+        memcpy(rec->qname, query + DNS_HEADER_SIZE, name_len);
+    } else {
+        rec->qname_len = 0;
+        rec->qtype = 0;
+    }
+
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+}
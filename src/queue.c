@@ -5,13 +5,18 @@ int q_head = 0, q_tail = 0;
 pthread_mutex_t q_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t q_cond = PTHREAD_COND_INITIALIZER;
 
-// 加入任务队列
-void enqueue_request(dns_request_t *req) {
+// 加入任务队列，队列已满时丢弃并返回 1
+int enqueue_request(dns_request_t *req) {
     pthread_mutex_lock(&q_mutex);
+    if ((q_tail + 1) % QUEUE_SIZE == q_head) {
+        pthread_mutex_unlock(&q_mutex);
+        return 1;
+    }
     queue[q_tail] = *req;
     q_tail = (q_tail + 1) % QUEUE_SIZE;
     pthread_cond_signal(&q_cond);
     pthread_mutex_unlock(&q_mutex);
+    return 0;
 }
 
 // 从任务队列取出
@@ -23,3 +28,11 @@ void dequeue_request(dns_request_t *req) {
     q_head = (q_head + 1) % QUEUE_SIZE;
     pthread_mutex_unlock(&q_mutex);
 }
+
+// 等待处理的请求数
+int queue_depth(void) {
+    pthread_mutex_lock(&q_mutex);
+    int depth = (q_tail - q_head + QUEUE_SIZE) % QUEUE_SIZE;
+    pthread_mutex_unlock(&q_mutex);
+    return depth;
+}
@@ -0,0 +1,390 @@
+#include "logging.h"     // for log_msg, LOG_ERROR, LOG_DEBUG
+#include "records.h"
+#include "wire.h"        // for wire_name_from_str, wire_get_u16, DNS_HEADER_SIZE, ...
+#include <arpa/inet.h>   // for inet_pton
+#include <ctype.h>       // for tolower
+#include <errno.h>       // for errno
+#include <stdio.h>       // for fopen, fgets, fclose, FILE
+#include <stdlib.h>      // for malloc, calloc, realloc, free, qsort
+#include <string.h>      // for memcpy, memcmp, memset, strcspn, strerror, strtok_r
+#include <sys/mman.h>    // for mmap, mprotect, munmap
+
+// 映射区布局：records_table_t | seeds[num_buckets] | slots[num_slots] | 名称和答案数据
+// 所有偏移都相对于映射区起始，启动时构建完成后只读
+typedef struct {
+    uint32_t num_names;
+    uint32_t num_slots;
+    uint32_t num_buckets;
+} records_table_t;
+
+typedef struct {
+    uint32_t name_off;      // 小写线格式名称（含根标签）
+    uint32_t answer_off;    // 预生成的答案记录，A 在前 AAAA 在后
+    uint16_t name_len;      // 0 表示空槽
+    uint16_t num_a;
+    uint16_t num_aaaa;
+    uint16_t reserved;
+} record_slot_t;
+
+// 每个桶平均的名称数和槽位冗余，决定构建速度和表大小
+#define NAMES_PER_BUCKET 4
+#define MAX_SEED (1u << 20)
+
+static const uint8_t *table;
+static size_t table_size;
+
+typedef struct {
+    uint8_t name[DNS_MAX_NAME];
+    uint16_t name_len;
+    uint16_t type;
+    uint8_t addr[16];
+} host_entry_t;
+
+// 名称哈希（忽略大小写）
+static uint64_t name_hash(const uint8_t *name, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)tolower(name[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static uint32_t bucket_of(uint64_t h, uint32_t num_buckets) {
+    return (uint32_t)((h ^ (h >> 32)) % num_buckets);
+}
+
+// 用种子对名称哈希再混合一次，得到槽位
+static uint32_t slot_of(uint64_t h, uint32_t seed, uint32_t num_slots) {
+    uint64_t x = h + (uint64_t)seed * 0x9e3779b97f4a7c15ull;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return (uint32_t)(x % num_slots);
+}
+
+static int compare_entry(const void *a, const void *b) {
+    const host_entry_t *x = a, *y = b;
+    if (x->name_len != y->name_len) return x->name_len - y->name_len;
+    int c = memcmp(x->name, y->name, x->name_len);
+    if (c) return c;
+    if (x->type != y->type) return x->type - y->type;
+    return memcmp(x->addr, y->addr, sizeof(x->addr));
+}
+
+// 读取 hosts 格式的记录文件：IP 名称 [名称...]
+static int read_hosts(const char *path, host_entry_t **out, size_t *count) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        log_msg(LOG_ERROR, "Failed to open records file %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    host_entry_t *entries = NULL;
+    size_t n = 0, cap = 0;
+    char line[1024];
+    int line_no = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        line[strcspn(line, "#")] = '\0';
+
+        char *save = NULL;
+        char *ip = strtok_r(line, " \t\r\n", &save);
+        if (!ip) continue;
+
+        uint8_t addr[16] = {0};
+        uint16_t type;
+        if (inet_pton(AF_INET, ip, addr) == 1) type = DNS_TYPE_A;
+        else if (inet_pton(AF_INET6, ip, addr) == 1) type = DNS_TYPE_AAAA;
+        else {
+            log_msg(LOG_ERROR, "Invalid address '%s' at %s:%d", ip, path, line_no);
+            goto fail;
+        }
+
+        int names = 0;
+        for (char *name = strtok_r(NULL, " \t\r\n", &save); name; name = strtok_r(NULL, " \t\r\n", &save)) {
+            if (n == cap) {
+                cap = cap ? cap * 2 : 64;
+                host_entry_t *p = realloc(entries, cap * sizeof(*entries));
+                if (!p) goto fail;
+                entries = p;
+            }
+            host_entry_t *e = &entries[n];
+            e->name_len = wire_name_from_str(name, e->name);
+            if (e->name_len == 0) {
+                log_msg(LOG_ERROR, "Invalid name '%s' at %s:%d", name, path, line_no);
+                goto fail;
+            }
+            e->type = type;
+            memcpy(e->addr, addr, sizeof(addr));
+            n++;
+            names++;
+        }
+        if (!names) {
+            log_msg(LOG_ERROR, "Missing name at %s:%d", path, line_no);
+            goto fail;
+        }
+    }
+
+    fclose(f);
+    *out = entries;
+    *count = n;
+    return 0;
+
+fail:
+    fclose(f);
+    free(entries);
+    return 1;
+}
+
+// 为每个桶寻找种子，使所有名称落到互不冲突的槽位（CHD 完美哈希）
+static int build_seeds(const uint64_t *hashes, uint32_t num_names, uint32_t num_buckets,
+                       uint32_t num_slots, uint32_t *seeds, uint32_t *slot_of_name) {
+    uint32_t *start = calloc(num_buckets + 1, sizeof(uint32_t));
+    uint32_t *members = malloc(num_names * sizeof(uint32_t));
+    uint32_t *order = malloc(num_buckets * sizeof(uint32_t));
+    uint8_t *taken = calloc(num_slots, 1);
+    int ret = 1;
+    if (!start || !members || !order || !taken) goto out;
+
+    // 按桶分组
+    for (uint32_t i = 0; i < num_names; i++) start[bucket_of(hashes[i], num_buckets) + 1]++;
+    for (uint32_t b = 0; b < num_buckets; b++) start[b + 1] += start[b];
+    memcpy(order, start, num_buckets * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_names; i++) members[order[bucket_of(hashes[i], num_buckets)]++] = i;
+
+    // 大桶优先放置（按桶大小计数排序）
+    uint32_t max_size = 0, k = 0;
+    for (uint32_t b = 0; b < num_buckets; b++) {
+        if (start[b + 1] - start[b] > max_size) max_size = start[b + 1] - start[b];
+    }
+    for (uint32_t size = max_size; size > 0; size--) {
+        for (uint32_t b = 0; b < num_buckets; b++) {
+            if (start[b + 1] - start[b] == size) order[k++] = b;
+        }
+    }
+
+    for (uint32_t i = 0; i < k; i++) {
+        uint32_t b = order[i];
+        uint32_t first = start[b], last = start[b + 1];
+
+        uint32_t seed;
+        for (seed = 0; seed < MAX_SEED; seed++) {
+            uint32_t m;
+            for (m = first; m < last; m++) {
+                uint32_t s = slot_of(hashes[members[m]], seed, num_slots);
+                if (taken[s]) break;
+                taken[s] = 1;
+                slot_of_name[members[m]] = s;
+            }
+            if (m == last) break;
+            while (m-- > first) taken[slot_of_name[members[m]]] = 0;
+        }
+        if (seed == MAX_SEED) goto out;
+        seeds[b] = seed;
+    }
+    ret = 0;
+
+out:
+    free(start);
+    free(members);
+    free(order);
+    free(taken);
+    return ret;
+}
+
+// 生成单条答案记录，名称指向问题段
+static size_t write_answer(uint8_t *p, const host_entry_t *e) {
+    size_t addr_len = e->type == DNS_TYPE_A ? 4 : 16;
+    wire_set_u16(p, 0xc000 | DNS_HEADER_SIZE);
+    wire_set_u16(p + 2, e->type);
+    wire_set_u16(p + 4, DNS_CLASS_IN);
+    wire_set_u16(p + 6, RECORDS_TTL >> 16);
+    wire_set_u16(p + 8, RECORDS_TTL & 0xffff);
+    wire_set_u16(p + 10, addr_len);
+    memcpy(p + 12, e->addr, addr_len);
+    return 12 + addr_len;
+}
+
+// 加载记录文件，构建只读的完美哈希表
+int load_records(const char *path) {
+    host_entry_t *entries;
+    size_t count;
+    if (read_hosts(path, &entries, &count) != 0) return 1;
+    if (count == 0) {
+        free(entries);
+        return 0;
+    }
+    qsort(entries, count, sizeof(*entries), compare_entry);
+
+    // 合并相同名称和重复地址
+    uint32_t num_names = 0;
+    size_t data_size = 0;
+    size_t uniq = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (uniq && compare_entry(&entries[uniq - 1], &entries[i]) == 0) continue;
+        if (!uniq || entries[uniq - 1].name_len != entries[i].name_len ||
+            memcmp(entries[uniq - 1].name, entries[i].name, entries[i].name_len) != 0) {
+            num_names++;
+            data_size += entries[i].name_len;
+        }
+        data_size += entries[i].type == DNS_TYPE_A ? RECORD_A_LEN : RECORD_AAAA_LEN;
+        entries[uniq++] = entries[i];
+    }
+    count = uniq;
+
+    uint32_t num_buckets = num_names / NAMES_PER_BUCKET + 1;
+    uint32_t num_slots = num_names + num_names / 4 + 1;
+    size_t header = sizeof(records_table_t) + num_buckets * sizeof(uint32_t) +
+                    num_slots * sizeof(record_slot_t);
+    size_t size = header + data_size;
+
+    uint64_t *hashes = malloc(num_names * sizeof(uint64_t));
+    uint32_t *first = malloc(num_names * sizeof(uint32_t));
+    uint32_t *slot_of_name = malloc(num_names * sizeof(uint32_t));
+    uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    int ret = 1;
+    if (!hashes || !first || !slot_of_name || map == MAP_FAILED) {
+        log_msg(LOG_ERROR, "Failed to allocate records table: %s", strerror(errno));
+        goto out;
+    }
+
+    // 每个名称的第一条记录
+    uint32_t k = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || entries[i - 1].name_len != entries[i].name_len ||
+            memcmp(entries[i - 1].name, entries[i].name, entries[i].name_len) != 0) {
+            first[k] = i;
+            hashes[k] = name_hash(entries[i].name, entries[i].name_len);
+            k++;
+        }
+    }
+
+    records_table_t *t = (records_table_t*)map;
+    uint32_t *seeds = (uint32_t*)(map + sizeof(*t));
+    record_slot_t *slots = (record_slot_t*)(seeds + num_buckets);
+    t->num_names = num_names;
+    t->num_slots = num_slots;
+    t->num_buckets = num_buckets;
+
+    if (build_seeds(hashes, num_names, num_buckets, num_slots, seeds, slot_of_name) != 0) {
+        log_msg(LOG_ERROR, "Failed to build records hash table");
+        goto out;
+    }
+
+    size_t off = header;
+    for (uint32_t i = 0; i < num_names; i++) {
+        size_t j = first[i];
+        size_t end = i + 1 < num_names ? first[i + 1] : count;
+        record_slot_t *s = &slots[slot_of_name[i]];
+
+        s->name_off = off;
+        s->name_len = entries[j].name_len;
+        memcpy(map + off, entries[j].name, entries[j].name_len);
+        off += entries[j].name_len;
+
+        // 排序后同名记录中 A 在 AAAA 之前
+        s->answer_off = off;
+        for (; j < end; j++) {
+            if (entries[j].type == DNS_TYPE_A) s->num_a++;
+            else s->num_aaaa++;
+            off += write_answer(map + off, &entries[j]);
+        }
+    }
+
+    if (mprotect(map, size, PROT_READ) != 0) {
+        log_msg(LOG_ERROR, "Failed to protect records table: %s", strerror(errno));
+        goto out;
+    }
+    if (table) munmap((void*)table, table_size);
+    table = map;
+    table_size = size;
+    map = MAP_FAILED;
+    ret = 0;
+
+out:
+    if (map != MAP_FAILED) munmap(map, size);
+    free(hashes);
+    free(first);
+    free(slot_of_name);
+    free(entries);
+    return ret;
+}
+
+// 已加载的名称数
+size_t num_records(void) {
+    return table ? ((const records_table_t*)table)->num_names : 0;
+}
+
+// 按问题名称查找记录槽
+static const record_slot_t* find_record(const uint8_t *pkt, size_t qname_end) {
+    if (!table) return NULL;
+
+    const records_table_t *t = (const records_table_t*)table;
+    const uint32_t *seeds = (const uint32_t*)(table + sizeof(*t));
+    const record_slot_t *slots = (const record_slot_t*)(seeds + t->num_buckets);
+
+    const uint8_t *name = pkt + DNS_HEADER_SIZE;
+    size_t len = qname_end - DNS_HEADER_SIZE;
+    uint64_t h = name_hash(name, len);
+    const record_slot_t *s = &slots[slot_of(h, seeds[bucket_of(h, t->num_buckets)], t->num_slots)];
+
+    if (s->name_len != len) return NULL;
+    const uint8_t *key = table + s->name_off;
+    for (size_t i = 0; i < len; i++) {
+        if ((uint8_t)tolower(name[i]) != key[i]) return NULL;
+    }
+    return s;
+}
+
+// 检查是否是本地记录中的名称
+int is_local_name(const uint8_t *pkt, size_t qname_end) {
+    return find_record(pkt, qname_end) != NULL;
+}
+
+// 用本地记录应答，名称不在记录中时返回0
+size_t handle_local_query(const uint8_t *query, size_t qname_end, uint8_t *resp, size_t cap) {
+    const record_slot_t *s = find_record(query, qname_end);
+    if (!s) return 0;
+
+    size_t n = qname_end + 4;
+    if (n > cap) return 0;
+
+    uint16_t qtype = wire_get_u16(query + qname_end);
+    uint16_t qclass = wire_get_u16(query + qname_end + 2);
+    uint16_t flags = DNS_FLAG_QR | DNS_FLAG_AA | DNS_FLAG_RA |
+                     (wire_get_u16(query + DNS_OFF_FLAGS) & DNS_FLAG_RD);
+
+    memset(resp, 0, DNS_HEADER_SIZE);
+    memcpy(resp + DNS_OFF_ID, query + DNS_OFF_ID, 2);
+    wire_set_u16(resp + DNS_OFF_QDCOUNT, 1);
+    memcpy(resp + DNS_HEADER_SIZE, query + DNS_HEADER_SIZE, n - DNS_HEADER_SIZE);
+
+    // 其他类型返回 NODATA
+    const uint8_t *answers = table + s->answer_off;
+    size_t num = 0, len = 0;
+    if (qclass == DNS_CLASS_IN || qclass == DNS_CLASS_ANY) {
+        if (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY) {
+            num += s->num_a;
+            len += s->num_a * RECORD_A_LEN;
+        }
+        if (qtype == DNS_TYPE_AAAA) answers += s->num_a * RECORD_A_LEN;
+        if (qtype == DNS_TYPE_AAAA || qtype == DNS_TYPE_ANY) {
+            num += s->num_aaaa;
+            len += s->num_aaaa * RECORD_AAAA_LEN;
+        }
+    }
+
+    if (n + len > cap) {
+        log_msg(LOG_DEBUG, "Local answer does not fit in %zu bytes, setting TC", cap);
+        flags |= DNS_FLAG_TC;
+        num = len = 0;
+    }
+    memcpy(resp + n, answers, len);
+    wire_set_u16(resp + DNS_OFF_ANCOUNT, num);
+    wire_set_u16(resp + DNS_OFF_FLAGS, flags);
+    return n + len;
+}
@@ -0,0 +1,249 @@
+#include "config.h"      // for suffix_domain, forward_dns, keep_suffix, str2int
+#include "logging.h"     // for log_msg, LOG_WARN, LOG_ERROR
+#include "route.h"
+#include "wire.h"        // for DNS_HEADER_SIZE, DNS_MAX_NAME
+#include <arpa/inet.h>   // for inet_pton, inet_ntop, htons
+#include <ctype.h>       // for tolower
+#include <stdio.h>       // for snprintf
+#include <stdlib.h>      // for free
+#include <string.h>      // for strchr, strcspn, strlen, strtok_r, memset, memcpy, ...
+#include <strings.h>     // for strcasecmp
+
+// 配置中的路由，0 号为默认路由（SUFFIX_DOMAIN / FORWARD_DNS / KEEP_SUFFIX），构建路由表时生成
+route_t routes[MAX_ROUTES];
+int num_routes = 1;
+
+// 标签哈希（忽略大小写）
+static uint32_t label_hash(uint16_t parent, const uint8_t *label) {
+    uint32_t h = 2166136261u ^ parent;
+    h *= 16777619u;
+    h ^= label[0];
+    h *= 16777619u;
+    for (int i = 1; i <= label[0]; i++) {
+        h ^= (uint8_t)tolower(label[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 查找子节点，label 为报文中的原始标签（大小写不限）
+static int trie_find(const route_table_t *t, uint16_t parent, const uint8_t *label, uint32_t *slot) {
+    uint32_t i = label_hash(parent, label) & (TRIE_HASH_SIZE - 1);
+    while (t->trie_edges[i].child) {
+        const trie_edge_t *e = &t->trie_edges[i];
+        if (e->parent == parent && e->label[0] == label[0]) {
+            int j = 1;
+            while (j <= label[0] && e->label[j] == tolower(label[j])) j++;
+            if (j > label[0]) return e->child;
+        }
+        i = (i + 1) & (TRIE_HASH_SIZE - 1);
+    }
+    if (slot) *slot = i;
+    return 0;
+}
+
+// 把路由后缀插入后缀树
+static int trie_insert(route_table_t *t, int index) {
+    const route_t *r = &t->routes[index];
+    size_t offs[ROUTE_SUFFIX_LEN];
+    int n = 0;
+    for (size_t off = 0; off < r->suffix_wire_len; off += r->suffix_wire[off] + 1) {
+        offs[n++] = off;
+    }
+    if (n == 0) {
+        if (t->trie_fallback < 0) t->trie_fallback = index;
+        return 0;
+    }
+
+    uint16_t node = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        const uint8_t *label = r->suffix_wire + offs[i];
+        uint32_t slot;
+        int child = trie_find(t, node, label, &slot);
+        if (!child) {
+            if (t->trie_nodes >= TRIE_MAX_NODES) return 1;
+            child = t->trie_nodes++;
+            t->trie_route[child] = -1;
+            t->trie_edges[slot].label = label;
+            t->trie_edges[slot].parent = node;
+            t->trie_edges[slot].child = child;
+        }
+        node = child;
+    }
+
+    if (t->trie_route[node] >= 0) {
+        log_msg(LOG_WARN, "Duplicate route for *%s ignored", r->suffix);
+        return 0;
+    }
+    t->trie_route[node] = index;
+    return 0;
+}
+
+// 设置路由后缀并生成线格式
+static int set_route_suffix(route_t *r, const char *suffix) {
+    if (suffix[0] == '.') suffix++;
+    if (strlen(suffix) + 2 > sizeof(r->suffix)) return 1;
+    snprintf(r->suffix, sizeof(r->suffix), ".%s", suffix);
+
+    r->suffix_wire_len = 0;
+    const char *p = suffix;
+    while (*p) {
+        size_t label = strcspn(p, ".");
+        if (label == 0 || label > 63) return 1;
+        r->suffix_wire[r->suffix_wire_len++] = (uint8_t)label;
+        for (size_t i = 0; i < label; i++) {
+            r->suffix_wire[r->suffix_wire_len++] = (uint8_t)tolower((unsigned char)p[i]);
+        }
+        p += label;
+        if (*p == '.') p++;
+    }
+    return 0;
+}
+
+// 添加上游地址，格式 IP 或 IP#端口
+static int add_upstream(route_t *r, const char *str, size_t len) {
+    if (r->num_upstreams >= MAX_UPSTREAMS || len >= UPSTREAM_STR_LEN) return 1;
+
+    char buf[UPSTREAM_STR_LEN];
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+
+    int port = 53;
+    char *hash = strchr(buf, '#');
+    if (hash) {
+        *hash = '\0';
+        int *p = str2int(hash + 1);
+        if (!p) return 1;
+        port = *p;
+        free(p);
+        if (port <= 0 || port > 65535) return 1;
+    }
+
+    struct sockaddr_in *addr = &r->upstreams[r->num_upstreams];
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (inet_pton(AF_INET, buf, &addr->sin_addr) != 1) return 1;
+
+    // 使用规范形式的地址，长度有上限
+    char ip[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip))) return 1;
+    if (port == 53) {
+        snprintf(r->upstream_str[r->num_upstreams], UPSTREAM_STR_LEN, "%s", ip);
+    } else {
+        snprintf(r->upstream_str[r->num_upstreams], UPSTREAM_STR_LEN, "%s#%d", ip, port);
+    }
+    r->num_upstreams++;
+    return 0;
+}
+
+// 解析一条路由：后缀=DNS[,DNS...][:keep|:strip]
+int add_route(const char *spec) {
+    if (!spec || num_routes >= MAX_ROUTES) return 1;
+
+    const char *eq = strchr(spec, '=');
+    if (!eq || eq == spec || (size_t)(eq - spec) >= ROUTE_SUFFIX_LEN) return 1;
+
+    route_t r;
+    memset(&r, 0, sizeof(r));
+    r.keep_suffix = KEEP_SUFFIX_DEFAULT;
+
+    char suffix[ROUTE_SUFFIX_LEN];
+    memcpy(suffix, spec, eq - spec);
+    suffix[eq - spec] = '\0';
+    if (set_route_suffix(&r, suffix) != 0 || r.suffix_wire_len == 0) return 1;
+
+    const char *p = eq + 1;
+    const char *mode = strchr(p, ':');
+    const char *end = mode ? mode : p + strlen(p);
+    while (p < end) {
+        size_t len = strcspn(p, ",:");
+        if (len == 0 || add_upstream(&r, p, len) != 0) return 1;
+        p += len;
+        if (*p == ',') p++;
+    }
+    if (r.num_upstreams == 0) return 1;
+
+    if (mode) {
+        if (strcasecmp(mode + 1, "keep") == 0) r.keep_suffix = 1;
+        else if (strcasecmp(mode + 1, "strip") == 0) r.keep_suffix = 0;
+        else return 1;
+    }
+
+    routes[num_routes++] = r;
+    return 0;
+}
+
+// 解析以分号分隔的多条路由
+int add_routes(const char *specs) {
+    if (!specs) return 0;
+    // 截断后最后一条路由仍可能合法（如 10.0.0.12 变成 10.0.0.1），超长时直接报错
+    char buf[ROUTES_MAX_LEN];
+    size_t len = strlen(specs);
+    if (len >= sizeof(buf)) {
+        log_msg(LOG_ERROR, "Routes too long (%zu bytes, maximum %d)", len, ROUTES_MAX_LEN - 1);
+        return 1;
+    }
+    memcpy(buf, specs, len + 1);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ";", &save); tok; tok = strtok_r(NULL, ";", &save)) {
+        if (add_route(tok) != 0) {
+            log_msg(LOG_ERROR, "Invalid route '%s'", tok);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 清空配置中的额外路由，重新加载配置前调用
+void reset_routes(void) {
+    num_routes = 1;
+}
+
+// 复制配置中的路由，生成默认路由并构建后缀树，出错时返回 1
+int build_route_table(route_table_t *t) {
+    memset(t, 0, sizeof(*t));
+    memcpy(t->routes, routes, sizeof(routes[0]) * num_routes);
+    t->num_routes = num_routes;
+
+    route_t *def = &t->routes[0];
+    def->keep_suffix = keep_suffix;
+    if (suffix_domain[0] && set_route_suffix(def, suffix_domain) != 0) {
+        log_msg(LOG_ERROR, "Invalid suffix '%s'", suffix_domain);
+        return 1;
+    }
+    if (add_upstream(def, forward_dns, strlen(forward_dns)) != 0) {
+        log_msg(LOG_ERROR, "Invalid forward DNS server '%s'", forward_dns);
+        return 1;
+    }
+
+    t->trie_route[0] = -1;
+    t->trie_nodes = 1;
+    t->trie_fallback = -1;
+    for (int i = 0; i < t->num_routes; i++) {
+        if (trie_insert(t, i) != 0) {
+            log_msg(LOG_ERROR, "Too many route labels");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 按最长后缀匹配路由，问题名称必须比后缀至少多一个标签
+const route_t* match_route(const route_table_t *t, const uint8_t *pkt, size_t qname_end) {
+    size_t offs[DNS_MAX_NAME / 2 + 1];
+    int n = 0;
+    for (size_t off = DNS_HEADER_SIZE; off < qname_end - 1; off += pkt[off] + 1) {
+        offs[n++] = off;
+    }
+
+    uint16_t node = 0;
+    int best = t->trie_fallback;
+    for (int i = n - 1; i >= 1; i--) {
+        node = trie_find(t, node, pkt + offs[i], NULL);
+        if (!node) break;
+        if (t->trie_route[node] >= 0) best = t->trie_route[node];
+    }
+    return best >= 0 ? &t->routes[best] : NULL;
+}
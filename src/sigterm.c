@@ -1,17 +1,26 @@
-#include "logging.h"  // for log_msg, LOG_DEBUG
 #include "sigterm.h"
-#include <signal.h>   // for signal, SIGINT, SIGTERM
-#include <stdlib.h>   // for exit
+#include <signal.h>   // for signal, SIGINT, SIGTERM, SIGHUP
+#include <unistd.h>   // for _exit
 
 volatile sig_atomic_t stop = 0;
+volatile sig_atomic_t reload = 0;
 
+// 第一次只设置标志，由主循环退出并保存状态；再次收到时立即退出
+// 信号处理函数中只调用异步信号安全的函数，不写日志
 void handle_sigterm(int sig) {
-    log_msg(LOG_DEBUG, "Received signal %d", sig);
+    (void)sig;
+    if (stop) _exit(1);
     stop = 1;
-    exit(0);
+}
+
+// 只设置标志，由主循环重新加载配置
+void handle_sighup(int sig) {
+    (void)sig;
+    reload = 1;
 }
 
 void setup_signal_handlers(void) {
     signal(SIGINT, handle_sigterm);
     signal(SIGTERM, handle_sigterm);
+    signal(SIGHUP, handle_sighup);
 }
@@ -0,0 +1,123 @@
+#include "config.h"      // for max_hops, minimal_responses, slow_query_ms, hedge_percent
+#include "gateway.h"     // for build_gateway_name
+#include "logging.h"     // for log_msg, LOG_ERROR
+#include "route.h"       // for build_route_table
+#include "snapshot.h"
+#include <stdlib.h>      // for calloc, free
+
+// 当前配置快照，读者不加锁，替换时用原子交换
+// 回收采用纪元方式：读者进入时记下全局纪元，退出时清零；
+// 被替换的快照记下替换后的纪元，所有读者的纪元都不小于它时才释放
+typedef struct {
+    uint64_t epoch;     // 读取中看到的纪元，0 表示不在读取
+    int used;
+} __attribute__((aligned(64))) reader_t;
+
+static snapshot_t *current;
+static uint64_t epoch = 1;
+static reader_t readers[SNAPSHOT_MAX_READERS];
+// 读者槽用完后的线程共用，有读者时不回收任何快照
+static uint64_t shared_readers;
+static __thread int reader_index = -1;
+
+// 待回收的快照，只由重新加载配置的主线程访问
+static snapshot_t *retired;
+
+// 由当前配置生成快照，出错时返回 NULL
+snapshot_t* build_snapshot(void) {
+    snapshot_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        log_msg(LOG_ERROR, "Failed to allocate config snapshot");
+        return NULL;
+    }
+    if (build_route_table(&s->routes) != 0) {
+        free(s);
+        return NULL;
+    }
+    build_gateway_name(s);
+    s->max_hops = max_hops;
+    s->minimal_responses = minimal_responses;
+    s->slow_query_ms = slow_query_ms;
+    s->hedge_percent = hedge_percent;
+    return s;
+}
+
+// 发布新快照，旧快照在没有读者之后释放
+void publish_snapshot(snapshot_t *s) {
+    snapshot_t *old = __atomic_exchange_n(&current, s, __ATOMIC_SEQ_CST);
+    if (!old) return;
+    old->retired = __atomic_add_fetch(&epoch, 1, __ATOMIC_SEQ_CST);
+    old->next = retired;
+    retired = old;
+    reclaim_snapshots();
+}
+
+static int get_reader(void) {
+    if (reader_index >= 0) return reader_index;
+    for (int i = 0; i < SNAPSHOT_MAX_READERS; i++) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&readers[i].used, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return reader_index = i;
+        }
+    }
+    return reader_index = SNAPSHOT_MAX_READERS;
+}
+
+// 开始读取快照，返回的指针在 snapshot_exit 之前有效
+const snapshot_t* snapshot_enter(void) {
+    int i = get_reader();
+    if (i < SNAPSHOT_MAX_READERS) {
+        __atomic_store_n(&readers[i].epoch, __atomic_load_n(&epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    } else {
+        __atomic_add_fetch(&shared_readers, 1, __ATOMIC_SEQ_CST);
+    }
+    return __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+}
+
+void snapshot_exit(void) {
+    if (reader_index < SNAPSHOT_MAX_READERS) {
+        __atomic_store_n(&readers[reader_index].epoch, 0, __ATOMIC_RELEASE);
+    } else {
+        __atomic_sub_fetch(&shared_readers, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// 线程退出前归还读者槽
+void snapshot_release(void) {
+    if (reader_index >= 0 && reader_index < SNAPSHOT_MAX_READERS) {
+        __atomic_store_n(&readers[reader_index].used, 0, __ATOMIC_RELEASE);
+    }
+    reader_index = -1;
+}
+
+// 没有线程在读取快照，即没有正在处理的查询时返回 1
+int snapshot_idle(void) {
+    if (__atomic_load_n(&shared_readers, __ATOMIC_SEQ_CST)) return 0;
+    for (int i = 0; i < SNAPSHOT_MAX_READERS; i++) {
+        if (__atomic_load_n(&readers[i].epoch, __ATOMIC_SEQ_CST)) return 0;
+    }
+    return 1;
+}
+
+// 释放已没有读者的旧快照，由主线程定期调用
+void reclaim_snapshots(void) {
+    if (!retired || __atomic_load_n(&shared_readers, __ATOMIC_SEQ_CST)) return;
+
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < SNAPSHOT_MAX_READERS; i++) {
+        uint64_t e = __atomic_load_n(&readers[i].epoch, __ATOMIC_SEQ_CST);
+        if (e && e < oldest) oldest = e;
+    }
+
+    snapshot_t **p = &retired;
+    while (*p) {
+        snapshot_t *s = *p;
+        if (s->retired <= oldest) {
+            *p = s->next;
+            free(s);
+        } else {
+            p = &s->next;
+        }
+    }
+}
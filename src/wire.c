@@ -0,0 +1,420 @@
+#include "wire.h"
+#include "loop_marker.h"  // for EDNS_UDP_SIZE
+#include <ctype.h>   // for tolower
+#include <stdio.h>   // for snprintf
+#include <string.h>  // for memmove, memcpy, memcmp, strcspn
+
+#define PTR_MASK 0xc0
+#define PTR_MAX  0x3fff
+
+// 遍历名称时跟随指针的最大次数
+#define MAX_PTR_FOLLOW 64
+
+// 跳过一个域名（不跟随压缩指针）
+int wire_skip_name(const uint8_t *pkt, size_t len, size_t off, size_t *end) {
+    size_t total = 0;
+    while (off < len) {
+        uint8_t b = pkt[off];
+        if (b == 0) {
+            *end = off + 1;
+            return 0;
+        }
+        if ((b & PTR_MASK) == PTR_MASK) {
+            if (off + 2 > len) return -1;
+            *end = off + 2;
+            return 0;
+        }
+        if (b & PTR_MASK) return -1;
+        total += b + 1;
+        if (total > DNS_MAX_NAME) return -1;
+        off += b + 1;
+    }
+    return -1;
+}
+
+// 跳过一条资源记录
+int wire_skip_rr(const uint8_t *pkt, size_t len, size_t off, size_t *end) {
+    if (wire_skip_name(pkt, len, off, &off) != 0) return -1;
+    if (off + 10 > len) return -1;
+    size_t rdlen = wire_get_u16(pkt + off + 8);
+    if (off + 10 + rdlen > len) return -1;
+    *end = off + 10 + rdlen;
+    return 0;
+}
+
+// 定位唯一问题段的结尾，qname_end 指向问题名称之后
+int wire_question_end(const uint8_t *pkt, size_t len, size_t *qname_end, size_t *end) {
+    if (len < DNS_HEADER_SIZE) return -1;
+    if (wire_get_u16(pkt + DNS_OFF_QDCOUNT) != 1) return -1;
+
+    size_t off = DNS_HEADER_SIZE;
+    size_t total = 0;
+    while (off < len && pkt[off] != 0) {
+        // 问题名称是报文中的第一个名称，不能被压缩
+        if (pkt[off] & PTR_MASK) return -1;
+        total += pkt[off] + 1;
+        if (total > DNS_MAX_NAME) return -1;
+        off += pkt[off] + 1;
+    }
+    if (off >= len) return -1;
+    off++;
+    if (off + 4 > len) return -1;
+    if (qname_end) *qname_end = off;
+    if (end) *end = off + 4;
+    return 0;
+}
+
+// 读取下一个标签，必要时跟随压缩指针，返回标签长度
+static int next_label(const uint8_t *pkt, size_t len, size_t *off, int *follow) {
+    while (*off < len) {
+        uint8_t b = pkt[*off];
+        if ((b & PTR_MASK) == PTR_MASK) {
+            if (*off + 2 > len || ++(*follow) > MAX_PTR_FOLLOW) return -1;
+            *off = wire_get_u16(pkt + *off) & PTR_MAX;
+            continue;
+        }
+        if (b & PTR_MASK) return -1;
+        if (*off + 1 + b > len) return -1;
+        return b;
+    }
+    return -1;
+}
+
+// 比较报文中两个域名是否相同（忽略大小写）
+int wire_name_equal(const uint8_t *pkt, size_t len, size_t a, size_t b) {
+    int follow_a = 0, follow_b = 0;
+    while (1) {
+        int la = next_label(pkt, len, &a, &follow_a);
+        int lb = next_label(pkt, len, &b, &follow_b);
+        if (la < 0 || lb < 0 || la != lb) return 0;
+        if (la == 0) return 1;
+        for (int i = 1; i <= la; i++) {
+            if (tolower(pkt[a + i]) != tolower(pkt[b + i])) return 0;
+        }
+        a += la + 1;
+        b += lb + 1;
+    }
+}
+
+// 比较两个报文的问题段（名称忽略大小写，类型和类别逐字节比较）
+int wire_question_equal(const uint8_t *a, size_t alen, const uint8_t *b, size_t blen) {
+    size_t a_name, a_end, b_name, b_end;
+    if (wire_question_end(a, alen, &a_name, &a_end) != 0) return 0;
+    if (wire_question_end(b, blen, &b_name, &b_end) != 0) return 0;
+    if (a_end != b_end) return 0;
+
+    for (size_t i = DNS_HEADER_SIZE; i < a_name; i++) {
+        if (tolower(a[i]) != tolower(b[i])) return 0;
+    }
+    return memcmp(a + a_name, b + b_name, 4) == 0;
+}
+
+// 把文本域名（如 web.docker）转为小写线格式，返回长度（含根标签），出错返回0
+size_t wire_name_from_str(const char *str, uint8_t *out) {
+    size_t n = 0;
+    while (*str) {
+        size_t label = strcspn(str, ".");
+        if (label == 0 || label > 63 || n + label + 2 > DNS_MAX_NAME) return 0;
+        out[n++] = (uint8_t)label;
+        for (size_t i = 0; i < label; i++) {
+            out[n++] = (uint8_t)tolower((unsigned char)str[i]);
+        }
+        str += label;
+        if (*str == '.') str++;
+    }
+    if (n == 0) return 0;
+    out[n++] = 0;
+    return n;
+}
+
+// 把报文中的域名转换为文本（如 web.docker.），不分配内存
+size_t wire_name_to_str(const uint8_t *pkt, size_t len, size_t off, char *out, size_t cap) {
+    size_t n = 0;
+    int follow = 0;
+    if (cap == 0) return 0;
+
+    while (1) {
+        int label = next_label(pkt, len, &off, &follow);
+        if (label < 0) {
+            n = 0;
+            break;
+        }
+        if (label == 0) {
+            if (n == 0 && n + 1 < cap) out[n++] = '.';
+            break;
+        }
+        for (int i = 1; i <= label && n + 5 < cap; i++) {
+            uint8_t c = pkt[off + i];
+            if (c == '.' || c == '\\') {
+                out[n++] = '\\';
+                out[n++] = (char)c;
+            } else if (c > 0x20 && c < 0x7f) {
+                out[n++] = (char)c;
+            } else {
+                n += snprintf(out + n, cap - n, "\\%03u", c);
+            }
+        }
+        if (n + 1 < cap) out[n++] = '.';
+        off += label + 1;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// 记录类型名称，未知类型格式化为 TYPEnnn
+const char* wire_type_str(uint16_t type, char *buf, size_t cap) {
+    switch (type) {
+        case 1:   return "A";
+        case 2:   return "NS";
+        case 5:   return "CNAME";
+        case 6:   return "SOA";
+        case 12:  return "PTR";
+        case 15:  return "MX";
+        case 16:  return "TXT";
+        case 28:  return "AAAA";
+        case 33:  return "SRV";
+        case 35:  return "NAPTR";
+        case 41:  return "OPT";
+        case 64:  return "SVCB";
+        case 65:  return "HTTPS";
+        case 255: return "ANY";
+    }
+    snprintf(buf, cap, "TYPE%u", type);
+    return buf;
+}
+
+// 查找附加段中的 OPT 记录
+int wire_find_opt(const uint8_t *pkt, size_t len, size_t *rr_off) {
+    size_t off;
+    if (wire_question_end(pkt, len, NULL, &off) != 0) return -1;
+
+    size_t before = (size_t)wire_get_u16(pkt + DNS_OFF_ANCOUNT) +
+                    wire_get_u16(pkt + DNS_OFF_NSCOUNT);
+    size_t arcount = wire_get_u16(pkt + DNS_OFF_ARCOUNT);
+
+    for (size_t i = 0; i < before + arcount; i++) {
+        size_t name_end;
+        if (wire_skip_name(pkt, len, off, &name_end) != 0) return -1;
+        if (name_end + 10 > len) return -1;
+        if (i >= before && wire_get_u16(pkt + name_end) == DNS_TYPE_OPT) {
+            *rr_off = off;
+            return 1;
+        }
+        if (wire_skip_rr(pkt, len, off, &off) != 0) return -1;
+    }
+    return 0;
+}
+
+// 客户端可以接收的UDP响应大小，来自 OPT 记录的 CLASS 字段
+size_t wire_udp_size(const uint8_t *pkt, size_t len) {
+    size_t opt;
+    if (wire_find_opt(pkt, len, &opt) != 1 || opt + 3 > len) return DNS_UDP_MIN_SIZE;
+
+    size_t class_off;
+    if (wire_skip_name(pkt, len, opt, &class_off) != 0) return DNS_UDP_MIN_SIZE;
+    size_t size = wire_get_u16(pkt + class_off + 2);
+    return size < DNS_UDP_MIN_SIZE ? DNS_UDP_MIN_SIZE : size;
+}
+
+// 按客户端的UDP大小原地裁剪响应，返回新的长度
+// 先去掉附加段（保留OPT），仍然超出时清空答案和授权段并设置TC
+// minimal 为1时总是去掉附加段，有答案时同时去掉授权段（否定应答保留SOA）
+size_t wire_fit_response(uint8_t *pkt, size_t len, size_t max, int minimal) {
+    if (len <= max && !minimal) return len;
+
+    size_t qend;
+    if (wire_question_end(pkt, len, NULL, &qend) != 0) return len;
+
+    size_t an = wire_get_u16(pkt + DNS_OFF_ANCOUNT);
+    size_t ns = wire_get_u16(pkt + DNS_OFF_NSCOUNT);
+    size_t ar = wire_get_u16(pkt + DNS_OFF_ARCOUNT);
+
+    size_t an_end = qend;
+    for (size_t i = 0; i < an; i++) {
+        if (wire_skip_rr(pkt, len, an_end, &an_end) != 0) return len;
+    }
+    size_t ns_end = an_end;
+    for (size_t i = 0; i < ns; i++) {
+        if (wire_skip_rr(pkt, len, ns_end, &ns_end) != 0) return len;
+    }
+
+    // OPT 的名称是根域，移动位置不会影响压缩指针；被截掉的尾部也不会被前面的记录引用
+    size_t opt = 0, opt_len = 0, off = ns_end;
+    for (size_t i = 0; i < ar; i++) {
+        size_t end, name_end;
+        if (wire_skip_rr(pkt, len, off, &end) != 0) return len;
+        wire_skip_name(pkt, len, off, &name_end);
+        if (wire_get_u16(pkt + name_end) == DNS_TYPE_OPT) {
+            opt = off;
+            opt_len = end - off;
+        }
+        off = end;
+    }
+
+    size_t cut = ns_end;
+    if (minimal && an > 0) {
+        cut = an_end;
+        ns = 0;
+    }
+    if (cut + opt_len > max) {
+        cut = qend;
+        an = ns = 0;
+        wire_set_u16(pkt + DNS_OFF_FLAGS, wire_get_u16(pkt + DNS_OFF_FLAGS) | DNS_FLAG_TC);
+    }
+
+    if (opt_len) memmove(pkt + cut, pkt + opt, opt_len);
+    wire_set_u16(pkt + DNS_OFF_ANCOUNT, an);
+    wire_set_u16(pkt + DNS_OFF_NSCOUNT, ns);
+    wire_set_u16(pkt + DNS_OFF_ARCOUNT, opt_len ? 1 : 0);
+    return cut + opt_len;
+}
+
+// 原地把查询改写为只保留问题段的错误响应，返回新的长度
+// 查询带 OPT 时保留一条不含选项的 OPT（RFC 6891），它不比原记录长，无需额外空间
+size_t wire_make_error(uint8_t *pkt, size_t len, uint16_t rcode) {
+    size_t qend, opt;
+    if (wire_question_end(pkt, len, NULL, &qend) != 0) return 0;
+    int edns = wire_find_opt(pkt, len, &opt) == 1 && pkt[opt] == 0;
+    uint16_t edns_flags = edns ? wire_get_u16(pkt + opt + 7) & DNS_EDNS_DO : 0;
+
+    uint16_t flags = wire_get_u16(pkt + DNS_OFF_FLAGS);
+    flags = DNS_FLAG_QR | DNS_FLAG_AA | (flags & (DNS_OPCODE_MASK | DNS_FLAG_RD)) |
+            (rcode & DNS_RCODE_MASK);
+    wire_set_u16(pkt + DNS_OFF_FLAGS, flags);
+    wire_set_u16(pkt + DNS_OFF_ANCOUNT, 0);
+    wire_set_u16(pkt + DNS_OFF_NSCOUNT, 0);
+    wire_set_u16(pkt + DNS_OFF_ARCOUNT, 0);
+    if (!edns) return qend;
+
+    uint8_t *p = pkt + qend;
+    p[0] = 0;
+    wire_set_u16(p + 1, DNS_TYPE_OPT);
+    wire_set_u16(p + 3, EDNS_UDP_SIZE);
+    p[5] = 0;                          // 扩展 RCODE
+    p[6] = 0;                          // EDNS version
+    wire_set_u16(p + 7, edns_flags);
+    wire_set_u16(p + 9, 0);
+    wire_set_u16(pkt + DNS_OFF_ARCOUNT, 1);
+    return qend + DNS_OPT_HEADER_SIZE;
+}
+
+// RDATA 中包含可压缩域名的类型：跳过的前缀长度和域名个数
+static int rdata_names(uint16_t type, size_t *skip) {
+    *skip = 0;
+    switch (type) {
+        case 2:  // NS
+        case 3:  // MD
+        case 4:  // MF
+        case 5:  // CNAME
+        case 7:  // MB
+        case 8:  // MG
+        case 9:  // MR
+        case 12: // PTR
+        case 39: // DNAME
+            return 1;
+        case 6:  // SOA
+        case 14: // MINFO
+        case 17: // RP
+            return 2;
+        case 15: // MX
+        case 18: // AFSDB
+        case 21: // RT
+        case 36: // KX
+            *skip = 2;
+            return 1;
+        case 33: // SRV
+            *skip = 6;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// 修正单个名称中的压缩指针，apply 为 0 时只做校验
+static int fix_name(uint8_t *pkt, size_t len, size_t off, size_t *end,
+                    size_t cut, size_t cut_end, long delta, int apply) {
+    while (off < len) {
+        uint8_t b = pkt[off];
+        if (b == 0) {
+            *end = off + 1;
+            return 0;
+        }
+        if ((b & PTR_MASK) == PTR_MASK) {
+            if (off + 2 > len) return -1;
+            *end = off + 2;
+            // 被替换区域内部的指针会随区域一起丢弃
+            if (off >= cut && off < cut_end) return 0;
+
+            size_t target = wire_get_u16(pkt + off) & PTR_MAX;
+            if (target < cut) return 0;
+            if (target < cut_end) return -1;   // 指向被替换的区域
+
+            long moved = (long)target + delta;
+            if (moved < DNS_HEADER_SIZE || moved > PTR_MAX) return -1;
+            if (apply) wire_set_u16(pkt + off, (uint16_t)(0xc000 | moved));
+            return 0;
+        }
+        if (b & PTR_MASK) return -1;
+        off += b + 1;
+    }
+    return -1;
+}
+
+// 遍历整个报文中的名称并修正指针
+static int fix_pointers(uint8_t *pkt, size_t len, size_t cut, size_t cut_end,
+                        long delta, int apply) {
+    if (len < DNS_HEADER_SIZE) return -1;
+
+    size_t off = DNS_HEADER_SIZE;
+    size_t qdcount = wire_get_u16(pkt + DNS_OFF_QDCOUNT);
+    size_t rrcount = (size_t)wire_get_u16(pkt + DNS_OFF_ANCOUNT) +
+                     wire_get_u16(pkt + DNS_OFF_NSCOUNT) +
+                     wire_get_u16(pkt + DNS_OFF_ARCOUNT);
+
+    for (size_t i = 0; i < qdcount; i++) {
+        if (fix_name(pkt, len, off, &off, cut, cut_end, delta, apply) != 0) return -1;
+        off += 4;
+    }
+
+    for (size_t i = 0; i < rrcount; i++) {
+        if (fix_name(pkt, len, off, &off, cut, cut_end, delta, apply) != 0) return -1;
+        if (off + 10 > len) return -1;
+
+        uint16_t type = wire_get_u16(pkt + off);
+        size_t rdlen = wire_get_u16(pkt + off + 8);
+        size_t rdata = off + 10;
+        size_t rdend = rdata + rdlen;
+        if (rdend > len) return -1;
+
+        size_t skip;
+        int names = rdata_names(type, &skip);
+        size_t p = rdata + skip;
+        for (int n = 0; n < names && p < rdend; n++) {
+            if (fix_name(pkt, rdend, p, &p, cut, cut_end, delta, apply) != 0) return -1;
+        }
+        off = rdend;
+    }
+    return 0;
+}
+
+// 用 data 替换报文中 [off, off + old_len) 的内容，并修正受影响的压缩指针
+// 报头计数和 RDLENGTH 由调用方负责更新
+int wire_splice(uint8_t *pkt, size_t *len, size_t cap, size_t off, size_t old_len,
+                const uint8_t *data, size_t new_len) {
+    if (off < DNS_HEADER_SIZE || off + old_len > *len) return -1;
+    if (*len - old_len + new_len > cap) return -1;
+
+    long delta = (long)new_len - (long)old_len;
+    size_t cut_end = off + old_len;
+
+    if (delta != 0) {
+        // 先校验，避免修正到一半时失败导致报文损坏
+        if (fix_pointers(pkt, *len, off, cut_end, delta, 0) != 0) return -1;
+        fix_pointers(pkt, *len, off, cut_end, delta, 1);
+    }
+
+    memmove(pkt + off + new_len, pkt + cut_end, *len - cut_end);
+    if (new_len) memcpy(pkt + off, data, new_len);
+    *len = *len - old_len + new_len;
+    return 0;
+}
@@ -0,0 +1,517 @@
+// 压测工具：按固定速率（开环）或固定并发（闭环）发送混合查询，统计 QPS、丢包和延迟分位数
+//
+// 编译：gcc -O2 -I include -o dnsbench tools/dnsbench.c
+// 用法：dnsbench [选项] [SERVER[:PORT]]      默认 127.0.0.1:53
+//   -r QPS     开环模式，按固定速率发送，不等待响应（默认 0：闭环）
+//   -c N       闭环模式下保持在途的查询数（默认 64）
+//   -d SEC     发送持续时间（默认 10）
+//   -t MS      超时，超过即计为丢失（默认 1000）
+//   -b N       每次 sendmmsg/recvmmsg 的报文数（默认 32）
+//   -m MIX     docker,gateway,other,loop 四类查询的比例（默认 70,10,15,5）
+//   -n NAMES   容器名称，逗号分隔（默认 docker-dns）
+//   -s SUFFIX  后缀域名（默认 .docker）
+//   -g NAME    网关名称（默认 gateway）
+//   -o NAMES   不匹配后缀的名称，逗号分隔（默认 example.com）
+//   -H HOPS    环路标记中的跳数（默认 3，等于 --max-hops 的默认值，服务直接返回 SERVFAIL）
+//
+// 比较改动前后的性能时，在同一台机器上用相同参数各运行几次。
+// 开环模式下 ID 空间按 速率×超时 自动分到多个源端口，避免在途查询 ID 重复。
+// 开环模式的延迟从计划发送时间算起，发送端落后造成的等待也计入延迟，不会掩盖尾部延迟。
+
+#define _GNU_SOURCE       // for sendmmsg, recvmmsg
+#include "loop_marker.h"  // for MY_OPTION_CODE, HOP_COUNT_DATA_LEN, EDNS_UDP_SIZE
+#include "wire.h"         // for wire_set_u16, wire_get_u16, DNS_*
+#include <arpa/inet.h>    // for inet_pton, htons
+#include <errno.h>        // for errno, EAGAIN, EINTR
+#include <poll.h>         // for poll, pollfd, POLLIN
+#include <stdio.h>        // for printf, fprintf, perror
+#include <stdlib.h>       // for calloc, realloc, free, qsort, strtol
+#include <string.h>       // for memcpy, memset, strchr, strcspn, strlen
+#include <sys/socket.h>   // for socket, connect, sendmmsg, recvmmsg, mmsghdr
+#include <time.h>         // for clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>       // for close, getopt
+
+#define MAX_BATCH 256
+#define MAX_SOCKETS 64
+#define MAX_TEMPLATES 64
+#define PKT_SIZE 512
+#define RESP_SIZE 4096
+
+enum { Q_DOCKER, Q_GATEWAY, Q_OTHER, Q_LOOP, Q_CLASSES };
+static const char *class_str[Q_CLASSES] = {"docker", "gateway", "other", "loop"};
+static const char *rcode_str[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
+
+typedef struct {
+    uint8_t data[PKT_SIZE];
+    size_t len;
+    uint8_t cls;
+} template_t;
+
+// 每个源端口一张表，以 ID 为下标
+typedef struct {
+    uint64_t sent_ns;        // 0 表示空闲
+    uint16_t tmpl;
+} slot_t;
+
+// 按发送顺序记录，用于超时回收
+typedef struct {
+    uint64_t sent_ns;
+    uint16_t sock;
+    uint16_t id;
+} pending_t;
+
+static template_t templates[MAX_TEMPLATES];
+static int num_templates;
+static int by_class[Q_CLASSES][MAX_TEMPLATES];
+static int class_count[Q_CLASSES];
+static int mix[Q_CLASSES] = {70, 10, 15, 5};
+
+static int socks[MAX_SOCKETS];
+static int num_socks = 1;
+static slot_t *slots[MAX_SOCKETS];
+static uint16_t next_id[MAX_SOCKETS];
+
+static pending_t *ring;
+static size_t ring_cap, ring_head, ring_tail;
+
+static uint32_t *latency;        // 微秒
+static size_t latency_len, latency_cap;
+
+static uint64_t sent[Q_CLASSES], received[Q_CLASSES], lost[Q_CLASSES];
+static uint64_t rcodes[Q_CLASSES][17];
+static uint64_t stray, send_stalls;
+static long inflight;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift，只用于挑选查询类型
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 32);
+}
+
+// 文本域名转线格式，失败返回 0
+static size_t encode_name(const char *name, uint8_t *out) {
+    size_t n = 0;
+    while (*name) {
+        size_t l = strcspn(name, ".");
+        if (l == 0 || l > 63 || n + l + 2 > DNS_MAX_NAME) return 0;
+        out[n++] = l;
+        memcpy(out + n, name, l);
+        n += l;
+        name += l;
+        if (*name == '.') name++;
+    }
+    out[n++] = 0;
+    return n;
+}
+
+// 生成 A 查询，loop 类附带环路标记
+static int add_template(const char *name, int cls, uint16_t hops) {
+    if (num_templates >= MAX_TEMPLATES) {
+        fprintf(stderr, "too many names (max %d)\n", MAX_TEMPLATES);
+        return 1;
+    }
+    template_t *t = &templates[num_templates];
+    memset(t->data, 0, DNS_HEADER_SIZE);
+    wire_set_u16(t->data + DNS_OFF_FLAGS, DNS_FLAG_RD);
+    wire_set_u16(t->data + DNS_OFF_QDCOUNT, 1);
+
+    size_t n = encode_name(name, t->data + DNS_HEADER_SIZE);
+    if (!n) {
+        fprintf(stderr, "invalid name '%s'\n", name);
+        return 1;
+    }
+    n += DNS_HEADER_SIZE;
+    wire_set_u16(t->data + n, DNS_TYPE_A);
+    wire_set_u16(t->data + n + 2, DNS_CLASS_IN);
+    n += 4;
+
+    if (cls == Q_LOOP) {
+        uint8_t *rr = t->data + n;
+        memset(rr, 0, 11);
+        wire_set_u16(rr + 1, DNS_TYPE_OPT);
+        wire_set_u16(rr + 3, EDNS_UDP_SIZE);
+        wire_set_u16(rr + 9, 4 + HOP_COUNT_DATA_LEN);
+        wire_set_u16(rr + 11, MY_OPTION_CODE);
+        wire_set_u16(rr + 13, HOP_COUNT_DATA_LEN);
+        wire_set_u16(rr + 15, hops);
+        n += 11 + 4 + HOP_COUNT_DATA_LEN;
+        wire_set_u16(t->data + DNS_OFF_ARCOUNT, 1);
+    }
+    t->len = n;
+    t->cls = cls;
+    by_class[cls][class_count[cls]++] = num_templates++;
+    return 0;
+}
+
+// 逗号分隔的名称列表，后缀为空时原样使用
+static int add_names(const char *list, const char *suffix, int cls, uint16_t hops) {
+    while (*list) {
+        size_t l = strcspn(list, ",");
+        char name[DNS_MAX_NAME + 1];
+        if (l && l + strlen(suffix) < sizeof(name)) {
+            memcpy(name, list, l);
+            strcpy(name + l, suffix);
+            if (add_template(name, cls, hops) != 0) return 1;
+        }
+        list += l;
+        if (*list == ',') list++;
+    }
+    return 0;
+}
+
+static int parse_mix(const char *s) {
+    for (int i = 0; i < Q_CLASSES; i++) {
+        char *end;
+        long v = strtol(s, &end, 10);
+        if (end == s || v < 0) return 1;
+        mix[i] = v;
+        s = end;
+        if (i < Q_CLASSES - 1 && *s++ != ',') return 1;
+    }
+    return *s != '\0';
+}
+
+static int pick_template(void) {
+    int total = 0;
+    for (int i = 0; i < Q_CLASSES; i++) total += mix[i];
+    int r = rng() % total, cls = 0;
+    while (r >= mix[cls]) r -= mix[cls++];
+    return by_class[cls][rng() % class_count[cls]];
+}
+
+static void record_latency(uint64_t ns) {
+    if (latency_len == latency_cap) {
+        size_t cap = latency_cap ? latency_cap * 2 : 1 << 20;
+        uint32_t *p = realloc(latency, cap * sizeof(uint32_t));
+        if (!p) return;
+        latency = p;
+        latency_cap = cap;
+    }
+    latency[latency_len++] = ns / 1000;
+}
+
+// 回收超时的查询；ring 满时强制回收最早的一条
+static void expire(uint64_t now, uint64_t timeout_ns, int force) {
+    while (ring_head != ring_tail) {
+        pending_t *p = &ring[ring_head % ring_cap];
+        slot_t *s = &slots[p->sock][p->id];
+        if (s->sent_ns == p->sent_ns) {
+            if (!force && now - p->sent_ns < timeout_ns) break;
+            lost[templates[s->tmpl].cls]++;
+            s->sent_ns = 0;
+            inflight--;
+        }
+        ring_head++;
+        force = 0;
+    }
+}
+
+// 在一个源端口上批量发送 count 个查询，返回实际发出的数量
+// rate 非 0 时第 seq 个查询按计划时间 start + seq/rate 计时，否则按实际发送时间
+static int send_batch(int si, int count, uint64_t timeout_ns, uint64_t start, long rate, uint64_t seq) {
+    static uint8_t bufs[MAX_BATCH][PKT_SIZE];
+    static struct mmsghdr msgs[MAX_BATCH];
+    static struct iovec iovs[MAX_BATCH];
+    uint16_t ids[MAX_BATCH];
+    int tmpls[MAX_BATCH];
+
+    for (int i = 0; i < count; i++) {
+        uint16_t id = next_id[si]++;
+        // 还在途的 ID 不复用，开环模式下端口数按在途量分配，正常不会发生
+        if (slots[si][id].sent_ns) {
+            count = i;
+            break;
+        }
+        int t = pick_template();
+        memcpy(bufs[i], templates[t].data, templates[t].len);
+        wire_set_u16(bufs[i] + DNS_OFF_ID, id);
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = templates[t].len;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        ids[i] = id;
+        tmpls[i] = t;
+    }
+    if (count == 0) return 0;
+
+    int n = sendmmsg(socks[si], msgs, count, MSG_DONTWAIT);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR && errno != ECONNREFUSED) perror("sendmmsg");
+        n = 0;
+    }
+    // 没发出去的 ID 退回
+    next_id[si] -= count - n;
+    if (n < count) send_stalls++;
+
+    uint64_t now = now_ns();
+    for (int i = 0; i < n; i++) {
+        uint64_t sent_ns = rate ? start + (seq + i) * 1000000000ULL / rate : now;
+        if (ring_tail - ring_head == ring_cap) expire(now, timeout_ns, 1);
+        slots[si][ids[i]].sent_ns = sent_ns;
+        slots[si][ids[i]].tmpl = tmpls[i];
+        ring[ring_tail++ % ring_cap] = (pending_t){sent_ns, si, ids[i]};
+        sent[templates[tmpls[i]].cls]++;
+        inflight++;
+    }
+    return n;
+}
+
+static void recv_batch(int si, int batch, uint64_t timeout_ns) {
+    static uint8_t bufs[MAX_BATCH][RESP_SIZE];
+    static struct mmsghdr msgs[MAX_BATCH];
+    static struct iovec iovs[MAX_BATCH];
+
+    for (;;) {
+        for (int i = 0; i < batch; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = RESP_SIZE;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(socks[si], msgs, batch, MSG_DONTWAIT, NULL);
+        if (n <= 0) return;
+
+        uint64_t now = now_ns();
+        for (int i = 0; i < n; i++) {
+            uint8_t *p = bufs[i];
+            if (msgs[i].msg_len < DNS_HEADER_SIZE || !(wire_get_u16(p + DNS_OFF_FLAGS) & DNS_FLAG_QR)) {
+                stray++;
+                continue;
+            }
+            slot_t *s = &slots[si][wire_get_u16(p + DNS_OFF_ID)];
+            // 超时后才到的响应按丢失计算
+            if (!s->sent_ns) {
+                stray++;
+                continue;
+            }
+            int cls = templates[s->tmpl].cls;
+            if (now - s->sent_ns >= timeout_ns) {
+                stray++;
+                continue;
+            }
+            received[cls]++;
+            rcodes[cls][wire_get_u16(p + DNS_OFF_FLAGS) & DNS_RCODE_MASK]++;
+            record_latency(now - s->sent_ns);
+            s->sent_ns = 0;
+            inflight--;
+        }
+        if (n < batch) return;
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(double q) {
+    size_t i = latency_len * q;
+    return latency[i < latency_len ? i : latency_len - 1];
+}
+
+static void report(double elapsed) {
+    uint64_t total_sent = 0, total_recv = 0, total_lost = 0;
+    for (int c = 0; c < Q_CLASSES; c++) {
+        total_sent += sent[c];
+        total_recv += received[c];
+        total_lost += lost[c];
+    }
+
+    printf("sent %llu, answered %llu, lost %llu (%.3f%%), late or stray %llu, send stalls %llu\n",
+           (unsigned long long)total_sent, (unsigned long long)total_recv,
+           (unsigned long long)total_lost, total_sent ? 100.0 * total_lost / total_sent : 0.0,
+           (unsigned long long)stray, (unsigned long long)send_stalls);
+    printf("duration %.3f s, %.0f qps sent, %.0f qps answered\n",
+           elapsed, total_sent / elapsed, total_recv / elapsed);
+
+    if (latency_len) {
+        qsort(latency, latency_len, sizeof(uint32_t), compare_u32);
+        printf("latency (us): min %u  p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+               latency[0], percentile(0.5), percentile(0.9), percentile(0.99),
+               percentile(0.999), latency[latency_len - 1]);
+    }
+
+    printf("\n%-8s %10s %10s %10s  rcodes\n", "class", "sent", "answered", "lost");
+    for (int c = 0; c < Q_CLASSES; c++) {
+        if (!sent[c]) continue;
+        printf("%-8s %10llu %10llu %10llu ", class_str[c], (unsigned long long)sent[c],
+               (unsigned long long)received[c], (unsigned long long)lost[c]);
+        for (int r = 0; r < 16; r++) {
+            if (!rcodes[c][r]) continue;
+            if (r < 6) printf(" %s=%llu", rcode_str[r], (unsigned long long)rcodes[c][r]);
+            else printf(" RCODE%d=%llu", r, (unsigned long long)rcodes[c][r]);
+        }
+        printf("\n");
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-r QPS] [-c N] [-d SEC] [-t MS] [-b N] [-m MIX] [-n NAMES]\n"
+                    "       [-s SUFFIX] [-g NAME] [-o NAMES] [-H HOPS] [SERVER[:PORT]]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    long rate = 0, concurrency = 64, duration = 10, timeout_ms = 1000, batch = 32, hops = 3;
+    const char *docker_names = "docker-dns", *suffix = ".docker", *gateway = "gateway";
+    const char *other_names = "example.com";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:c:d:t:b:m:n:s:g:o:H:")) != -1) {
+        switch (opt) {
+            case 'r': rate = strtol(optarg, NULL, 10); break;
+            case 'c': concurrency = strtol(optarg, NULL, 10); break;
+            case 'd': duration = strtol(optarg, NULL, 10); break;
+            case 't': timeout_ms = strtol(optarg, NULL, 10); break;
+            case 'b': batch = strtol(optarg, NULL, 10); break;
+            case 'm':
+                if (parse_mix(optarg) != 0) {
+                    fprintf(stderr, "invalid mix '%s', expected docker,gateway,other,loop\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'n': docker_names = optarg; break;
+            case 's': suffix = optarg; break;
+            case 'g': gateway = optarg; break;
+            case 'o': other_names = optarg; break;
+            case 'H': hops = strtol(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind < argc - 1 || rate < 0 || concurrency < 1 || concurrency > 65535 || duration < 1 ||
+        timeout_ms < 1 || timeout_ms > 60000 || batch < 1 || batch > MAX_BATCH || hops < 0 || hops > 65535) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // 服务器地址
+    char host[64] = "127.0.0.1";
+    struct sockaddr_in server = {.sin_family = AF_INET, .sin_port = htons(53)};
+    if (optind < argc) {
+        const char *colon = strchr(argv[optind], ':');
+        size_t l = colon ? (size_t)(colon - argv[optind]) : strlen(argv[optind]);
+        if (l >= sizeof(host)) l = sizeof(host) - 1;
+        memcpy(host, argv[optind], l);
+        host[l] = '\0';
+        if (colon) server.sin_port = htons(strtol(colon + 1, NULL, 10));
+    }
+    if (inet_pton(AF_INET, host, &server.sin_addr) != 1) {
+        fprintf(stderr, "invalid server address '%s'\n", host);
+        return 2;
+    }
+
+    // 查询模板，比例为 0 的类型不需要名称
+    if (add_names(docker_names, suffix, Q_DOCKER, 0) != 0 ||
+        add_names(gateway, suffix, Q_GATEWAY, 0) != 0 ||
+        add_names(other_names, "", Q_OTHER, 0) != 0 ||
+        add_names(docker_names, suffix, Q_LOOP, hops) != 0) return 2;
+    int total_mix = 0;
+    for (int c = 0; c < Q_CLASSES; c++) {
+        if (!class_count[c]) mix[c] = 0;
+        total_mix += mix[c];
+    }
+    if (total_mix == 0) {
+        fprintf(stderr, "empty query mix\n");
+        return 2;
+    }
+
+    // 开环模式下一个超时窗口内的查询数可能超过 65536，按在途量分配源端口
+    uint64_t timeout_ns = timeout_ms * 1000000ULL;
+    uint64_t window = rate ? (uint64_t)rate * timeout_ms / 1000 + 1 : (uint64_t)concurrency;
+    num_socks = window / 32768 + 1;
+    if (num_socks > MAX_SOCKETS) {
+        fprintf(stderr, "rate too high for the timeout, lower -r or -t\n");
+        return 2;
+    }
+    ring_cap = (size_t)num_socks * 65536;
+    ring = calloc(ring_cap, sizeof(pending_t));
+    if (!ring) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < num_socks; i++) {
+        slots[i] = calloc(65536, sizeof(slot_t));
+        socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        if (!slots[i] || socks[i] < 0 || connect(socks[i], (struct sockaddr*)&server, sizeof(server)) != 0) {
+            perror("socket");
+            return 1;
+        }
+        int size = 4 << 20;
+        setsockopt(socks[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(socks[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        next_id[i] = rng();
+    }
+
+    if (rate) printf("open loop at %ld qps for %ld s against %s:%d, %d source ports\n",
+                     rate, duration, host, ntohs(server.sin_port), num_socks);
+    else printf("closed loop with %ld in flight for %ld s against %s:%d\n",
+                concurrency, duration, host, ntohs(server.sin_port));
+    printf("mix: docker %d, gateway %d, other %d, loop %d\n\n", mix[0], mix[1], mix[2], mix[3]);
+
+    struct pollfd pfds[MAX_SOCKETS];
+    for (int i = 0; i < num_socks; i++) pfds[i] = (struct pollfd){.fd = socks[i], .events = POLLIN};
+
+    uint64_t start = now_ns(), end = start + duration * 1000000000ULL, total_sent = 0;
+    int next_sock = 0;
+    for (;;) {
+        uint64_t now = now_ns();
+        int sending = now < end;
+        if (!sending && inflight == 0) break;
+        // 停止发送后最多再等一个超时
+        if (!sending && now >= end + timeout_ns) {
+            expire(now + timeout_ns, timeout_ns, 0);
+            break;
+        }
+
+        // 每轮最多发送几批，落后时也要及时收取响应，否则测到的是发送端的排队
+        long want = 0;
+        if (sending) {
+            if (rate) want = (long)((now - start) * rate / 1000000000ULL + 1 - total_sent);
+            else want = concurrency - inflight;
+            for (int round = 0; want > 0 && round < 8; round++) {
+                int n = send_batch(next_sock, want < batch ? want : batch, timeout_ns, start, rate, total_sent);
+                next_sock = (next_sock + 1) % num_socks;
+                if (n == 0) {
+                    want = 0;
+                    break;
+                }
+                want -= n;
+                total_sent += n;
+            }
+        }
+
+        // 开环模式按 1ms 粒度发送，闭环模式等到有响应或超时
+        int wait = want > 0 ? 0 : rate && sending ? 1 : 10;
+        if (poll(pfds, num_socks, wait) > 0) {
+            for (int i = 0; i < num_socks; i++) {
+                if (pfds[i].revents & POLLIN) recv_batch(i, batch, timeout_ns);
+            }
+        }
+        expire(now_ns(), timeout_ns, 0);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    // 发送结束后等待的时间不计入 QPS
+    if (elapsed > duration) elapsed = duration;
+
+    report(elapsed);
+
+    for (int i = 0; i < num_socks; i++) {
+        close(socks[i]);
+        free(slots[i]);
+    }
+    free(ring);
+    free(latency);
+    return 0;
+}
@@ -0,0 +1,593 @@
+// 回放工具：读取抓包文件中的客户端查询，按原始节奏（可加速）发给转发器，
+// 并与抓包中的应答率、rcode 和延迟对比
+//
+// 编译：gcc -O2 -I include -o dnsreplay tools/dnsreplay.c
+// 用法：dnsreplay [选项] FILE.pcap [SERVER[:PORT]]      默认 127.0.0.1:53
+//   -s SPEED   时间缩放：1 为原速，10 为十倍速，0 为尽快发送（默认 1）
+//   -c N       -s 0 时保持在途的查询数（默认 64）
+//   -t MS      超时，超过即计为未应答（默认 2000）
+//   -p PORT    抓包中 DNS 服务的端口（默认 53）
+//   -b N       每次 sendmmsg/recvmmsg 的报文数（默认 32）
+//
+// 抓包示例：tcpdump -i any -w dns.pcap udp port 53
+// 只支持 pcap 格式（不支持 pcapng，可用 editcap -F pcap 转换），链路层支持 Ethernet、
+// Linux cooked (SLL/SLL2)、loopback 和 raw IP，IPv6 的查询也通过 IPv4 回放。
+// 抓包中目的端口为 PORT 的查询按原样发送（只替换 ID），包括重试；源端口为 PORT 的响应
+// 按客户端地址、端口和 ID 与最近的查询配对，作为对比的基准。
+
+#define _GNU_SOURCE       // for sendmmsg, recvmmsg
+#include "wire.h"         // for wire_get_u16, wire_set_u16, DNS_*
+#include <arpa/inet.h>    // for inet_pton, htons, ntohs
+#include <poll.h>         // for poll, pollfd, POLLIN
+#include <stdio.h>        // for printf, fprintf, perror, fopen, fread
+#include <stdlib.h>       // for calloc, realloc, free, qsort, strtol, strtod
+#include <string.h>       // for memcpy, memset, memcmp, strchr, strlen
+#include <sys/socket.h>   // for socket, connect, sendmmsg, recvmmsg, mmsghdr
+#include <time.h>         // for clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>       // for close, getopt
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAPNG_MAGIC  0x0a0d0d0a
+
+#define LINKTYPE_NULL   0
+#define LINKTYPE_EN10MB 1
+#define LINKTYPE_RAW    101
+#define LINKTYPE_SLL    113
+#define LINKTYPE_SLL2   276
+
+#define MAX_BATCH 256
+#define NUM_SOCKETS 4
+#define MATCH_TABLE_SIZE (1 << 20)   // 必须是2的幂
+#define NO_RCODE 0xff
+
+typedef struct {
+    uint64_t ts_ns;          // 抓包时间
+    uint32_t off;            // 在 payload 中的偏移
+    uint16_t len;
+    uint8_t cap_rcode;       // 抓包中的 rcode，NO_RCODE 表示没有应答
+    uint8_t rep_rcode;       // 回放得到的 rcode
+    uint32_t cap_us;
+    uint32_t rep_us;
+} query_t;
+
+// 配对抓包中的查询和响应：客户端地址、端口和 ID
+typedef struct {
+    uint8_t addr[16];
+    uint16_t port;
+    uint16_t id;
+    uint32_t query;          // 查询下标 + 1，0 表示空
+} match_t;
+
+typedef struct {
+    uint64_t sent_ns;        // 0 表示空闲
+    uint32_t query;
+} slot_t;
+
+static query_t *queries;
+static size_t num_queries, queries_cap;
+static uint8_t *payload;
+static size_t payload_len, payload_cap;
+static match_t *matches;
+static uint64_t skipped_packets, unmatched_responses;
+
+static int socks[NUM_SOCKETS];
+static slot_t *slots[NUM_SOCKETS];
+static uint16_t next_id[NUM_SOCKETS];
+static long inflight;
+static uint64_t late;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t get_u32(const uint8_t *p, int swap) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t get_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint64_t match_hash(const uint8_t *addr, uint16_t port, uint16_t id) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < 16; i++) h = (h ^ addr[i]) * 1099511628211ULL;
+    h = (h ^ port) * 1099511628211ULL;
+    return (h ^ id) * 1099511628211ULL;
+}
+
+// 查找或插入配对表项，表满时返回 NULL
+static match_t* match_slot(const uint8_t *addr, uint16_t port, uint16_t id, int insert) {
+    size_t i = match_hash(addr, port, id) & (MATCH_TABLE_SIZE - 1);
+    for (size_t probes = 0; probes < MATCH_TABLE_SIZE; probes++) {
+        match_t *m = &matches[i];
+        if (!m->query) return insert ? m : NULL;
+        if (m->port == port && m->id == id && !memcmp(m->addr, addr, 16)) return m;
+        i = (i + 1) & (MATCH_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+static int add_query(uint64_t ts_ns, const uint8_t *dns, size_t len) {
+    if (num_queries == queries_cap) {
+        size_t cap = queries_cap ? queries_cap * 2 : 65536;
+        query_t *q = realloc(queries, cap * sizeof(query_t));
+        if (!q) return 1;
+        queries = q;
+        queries_cap = cap;
+    }
+    while (payload_len + len > payload_cap) {
+        size_t cap = payload_cap ? payload_cap * 2 : 1 << 22;
+        uint8_t *p = realloc(payload, cap);
+        if (!p) return 1;
+        payload = p;
+        payload_cap = cap;
+    }
+    memcpy(payload + payload_len, dns, len);
+    queries[num_queries] = (query_t){.ts_ns = ts_ns, .off = payload_len, .len = len,
+                                     .cap_rcode = NO_RCODE, .rep_rcode = NO_RCODE};
+    payload_len += len;
+    num_queries++;
+    return 0;
+}
+
+// 处理一个 UDP 报文：查询记入回放列表，响应与最近的查询配对
+static void handle_udp(uint64_t ts_ns, const uint8_t *src, const uint8_t *dst,
+                       const uint8_t *udp, size_t len, uint16_t dns_port) {
+    if (len < 8 + DNS_HEADER_SIZE) {
+        skipped_packets++;
+        return;
+    }
+    uint16_t sport = get_be16(udp), dport = get_be16(udp + 2);
+    size_t ulen = get_be16(udp + 4);
+    if (ulen >= 8 && ulen < len) len = ulen;
+    const uint8_t *dns = udp + 8;
+    len -= 8;
+    uint16_t id = wire_get_u16(dns + DNS_OFF_ID);
+    int qr = (wire_get_u16(dns + DNS_OFF_FLAGS) & DNS_FLAG_QR) != 0;
+
+    if (dport == dns_port && !qr) {
+        if (len > DNS_UDP_MIN_SIZE * 8 || add_query(ts_ns, dns, len) != 0) {
+            skipped_packets++;
+            return;
+        }
+        match_t *m = match_slot(src, sport, id, 1);
+        if (m) {
+            memcpy(m->addr, src, 16);
+            m->port = sport;
+            m->id = id;
+            m->query = num_queries;
+        }
+    } else if (sport == dns_port && qr) {
+        match_t *m = match_slot(dst, dport, id, 0);
+        query_t *q = m ? &queries[m->query - 1] : NULL;
+        if (!q || q->cap_rcode != NO_RCODE || ts_ns < q->ts_ns) {
+            unmatched_responses++;
+            return;
+        }
+        q->cap_rcode = wire_get_u16(dns + DNS_OFF_FLAGS) & DNS_RCODE_MASK;
+        q->cap_us = (ts_ns - q->ts_ns) / 1000;
+    } else {
+        skipped_packets++;
+    }
+}
+
+// 解析 IP 层，地址统一为 16 字节（IPv4 映射到 ::ffff:a.b.c.d）
+static void handle_ip(uint64_t ts_ns, const uint8_t *p, size_t len, uint16_t dns_port) {
+    uint8_t src[16] = {0}, dst[16] = {0};
+    if (len < 1) goto skip;
+    if ((p[0] >> 4) == 4) {
+        size_t ihl = (p[0] & 0x0f) * 4;
+        if (len < 20 || ihl < 20 || len < ihl || p[9] != 17) goto skip;
+        // 分片不处理
+        if (get_be16(p + 6) & 0x3fff) goto skip;
+        size_t total = get_be16(p + 2);
+        if (total >= ihl && total < len) len = total;
+        src[10] = src[11] = dst[10] = dst[11] = 0xff;
+        memcpy(src + 12, p + 12, 4);
+        memcpy(dst + 12, p + 16, 4);
+        handle_udp(ts_ns, src, dst, p + ihl, len - ihl, dns_port);
+        return;
+    }
+    if ((p[0] >> 4) == 6) {
+        // 不处理扩展头
+        if (len < 40 || p[6] != 17) goto skip;
+        memcpy(src, p + 8, 16);
+        memcpy(dst, p + 24, 16);
+        handle_udp(ts_ns, src, dst, p + 40, len - 40, dns_port);
+        return;
+    }
+skip:
+    skipped_packets++;
+}
+
+static void handle_frame(uint32_t linktype, uint64_t ts_ns, const uint8_t *p, size_t len, uint16_t dns_port) {
+    size_t hdr;
+    uint16_t proto;
+    switch (linktype) {
+        case LINKTYPE_EN10MB:
+            if (len < 14) goto skip;
+            hdr = 14;
+            proto = get_be16(p + 12);
+            while ((proto == 0x8100 || proto == 0x88a8) && len >= hdr + 4) {
+                proto = get_be16(p + hdr + 2);
+                hdr += 4;
+            }
+            if (proto != 0x0800 && proto != 0x86dd) goto skip;
+            break;
+        case LINKTYPE_SLL:
+            if (len < 16) goto skip;
+            hdr = 16;
+            proto = get_be16(p + 14);
+            if (proto != 0x0800 && proto != 0x86dd) goto skip;
+            break;
+        case LINKTYPE_SLL2:
+            if (len < 20) goto skip;
+            hdr = 20;
+            proto = get_be16(p);
+            if (proto != 0x0800 && proto != 0x86dd) goto skip;
+            break;
+        case LINKTYPE_NULL:
+            hdr = 4;
+            break;
+        case LINKTYPE_RAW:
+        case 12:
+        case 14:
+            hdr = 0;
+            break;
+        default:
+            goto skip;
+    }
+    if (len > hdr) handle_ip(ts_ns, p + hdr, len - hdr, dns_port);
+    return;
+skip:
+    skipped_packets++;
+}
+
+static int read_pcap(const char *path, uint16_t dns_port) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return 1;
+    }
+    uint8_t gh[24];
+    if (fread(gh, 1, sizeof(gh), fp) != sizeof(gh)) {
+        fprintf(stderr, "%s: not a pcap file\n", path);
+        fclose(fp);
+        return 1;
+    }
+
+    uint32_t magic = get_u32(gh, 0);
+    int swap = 0, nsec = 0;
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+        nsec = magic == PCAP_MAGIC_NS;
+    } else if (magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+        swap = 1;
+        nsec = magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    } else {
+        fprintf(stderr, "%s: %s\n", path, magic == PCAPNG_MAGIC ?
+                "pcapng is not supported, convert with 'editcap -F pcap'" : "not a pcap file");
+        fclose(fp);
+        return 1;
+    }
+    uint32_t linktype = get_u32(gh + 20, swap) & 0x0fffffff;
+
+    static uint8_t frame[262144];
+    uint8_t rh[16];
+    while (fread(rh, 1, sizeof(rh), fp) == sizeof(rh)) {
+        uint64_t ts_ns = get_u32(rh, swap) * 1000000000ULL +
+                         (uint64_t)get_u32(rh + 4, swap) * (nsec ? 1 : 1000);
+        uint32_t caplen = get_u32(rh + 8, swap);
+        if (caplen > sizeof(frame) || fread(frame, 1, caplen, fp) != caplen) {
+            fprintf(stderr, "%s: truncated or corrupt record\n", path);
+            break;
+        }
+        handle_frame(linktype, ts_ns, frame, caplen, dns_port);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void send_batch(int si, size_t *next, size_t end) {
+    static struct mmsghdr msgs[MAX_BATCH];
+    static struct iovec iovs[MAX_BATCH];
+    static uint8_t bufs[MAX_BATCH][DNS_UDP_MIN_SIZE * 8];
+    uint16_t ids[MAX_BATCH];
+    int count = 0;
+
+    while (*next + count < end && count < MAX_BATCH) {
+        uint16_t id = next_id[si];
+        // 在途的 ID 不复用，留到下一轮
+        if (slots[si][id].sent_ns) break;
+        next_id[si]++;
+        query_t *q = &queries[*next + count];
+        memcpy(bufs[count], payload + q->off, q->len);
+        wire_set_u16(bufs[count] + DNS_OFF_ID, id);
+        iovs[count] = (struct iovec){bufs[count], q->len};
+        memset(&msgs[count].msg_hdr, 0, sizeof(msgs[count].msg_hdr));
+        msgs[count].msg_hdr.msg_iov = &iovs[count];
+        msgs[count].msg_hdr.msg_iovlen = 1;
+        ids[count] = id;
+        count++;
+    }
+    if (count == 0) return;
+
+    int n = sendmmsg(socks[si], msgs, count, MSG_DONTWAIT);
+    if (n < 0) n = 0;
+    next_id[si] -= count - n;
+
+    uint64_t now = now_ns();
+    for (int i = 0; i < n; i++) {
+        slots[si][ids[i]] = (slot_t){now, *next + i};
+        inflight++;
+    }
+    *next += n;
+}
+
+static void recv_batch(int si, int batch, uint64_t timeout_ns) {
+    static uint8_t bufs[MAX_BATCH][4096];
+    static struct mmsghdr msgs[MAX_BATCH];
+    static struct iovec iovs[MAX_BATCH];
+
+    for (;;) {
+        for (int i = 0; i < batch; i++) {
+            iovs[i] = (struct iovec){bufs[i], sizeof(bufs[i])};
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(socks[si], msgs, batch, MSG_DONTWAIT, NULL);
+        if (n <= 0) return;
+
+        uint64_t now = now_ns();
+        for (int i = 0; i < n; i++) {
+            if (msgs[i].msg_len < DNS_HEADER_SIZE) continue;
+            slot_t *s = &slots[si][wire_get_u16(bufs[i] + DNS_OFF_ID)];
+            if (!s->sent_ns || now - s->sent_ns >= timeout_ns) {
+                late++;
+                continue;
+            }
+            query_t *q = &queries[s->query];
+            q->rep_rcode = wire_get_u16(bufs[i] + DNS_OFF_FLAGS) & DNS_RCODE_MASK;
+            q->rep_us = (now - s->sent_ns) / 1000;
+            s->sent_ns = 0;
+            inflight--;
+        }
+        if (n < batch) return;
+    }
+}
+
+// 在途查询按 ID 表扫描回收，查询量不大时足够
+static void expire(uint64_t now, uint64_t timeout_ns) {
+    for (int si = 0; si < NUM_SOCKETS; si++) {
+        for (int id = 0; id < 65536; id++) {
+            slot_t *s = &slots[si][id];
+            if (s->sent_ns && now - s->sent_ns >= timeout_ns) {
+                s->sent_ns = 0;
+                inflight--;
+            }
+        }
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    uint64_t answered;
+    uint64_t rcodes[16];
+    uint32_t p50, p90, p99, p999;
+} summary_t;
+
+static void summarize(int replay, summary_t *s) {
+    uint32_t *lat = calloc(num_queries ? num_queries : 1, sizeof(uint32_t));
+    memset(s, 0, sizeof(*s));
+    if (!lat) return;
+    for (size_t i = 0; i < num_queries; i++) {
+        uint8_t rcode = replay ? queries[i].rep_rcode : queries[i].cap_rcode;
+        if (rcode == NO_RCODE) continue;
+        s->rcodes[rcode & 15]++;
+        lat[s->answered++] = replay ? queries[i].rep_us : queries[i].cap_us;
+    }
+    if (s->answered) {
+        qsort(lat, s->answered, sizeof(uint32_t), compare_u32);
+        s->p50 = lat[s->answered * 50 / 100];
+        s->p90 = lat[s->answered * 90 / 100];
+        s->p99 = lat[s->answered * 99 / 100];
+        s->p999 = lat[s->answered * 999 / 1000];
+    }
+    free(lat);
+}
+
+static const char* rcode_name(int r) {
+    static const char *names[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
+    static char buf[16];
+    if (r < 6) return names[r];
+    snprintf(buf, sizeof(buf), "RCODE%d", r);
+    return buf;
+}
+
+static void report(double cap_span, double rep_span) {
+    summary_t cap, rep;
+    summarize(0, &cap);
+    summarize(1, &rep);
+    double n = num_queries;
+
+    printf("%-16s %14s %14s %12s\n", "", "capture", "replay", "delta");
+    printf("%-16s %14.1f %14.1f %+12.1f\n", "queries/s", n / cap_span, n / rep_span, n / rep_span - n / cap_span);
+    printf("%-16s %13.2f%% %13.2f%% %+11.2f%%\n", "answered", 100.0 * cap.answered / n,
+           100.0 * rep.answered / n, 100.0 * ((double)rep.answered - cap.answered) / n);
+    const struct { const char *name; uint32_t c, r; } rows[] = {
+        {"p50 (us)", cap.p50, rep.p50}, {"p90 (us)", cap.p90, rep.p90},
+        {"p99 (us)", cap.p99, rep.p99}, {"p99.9 (us)", cap.p999, rep.p999},
+    };
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        printf("%-16s %14u %14u %+12lld\n", rows[i].name, rows[i].c, rows[i].r,
+               (long long)rows[i].r - rows[i].c);
+    }
+    for (int r = 0; r < 16; r++) {
+        if (!cap.rcodes[r] && !rep.rcodes[r]) continue;
+        printf("%-16s %14llu %14llu %+12lld\n", rcode_name(r), (unsigned long long)cap.rcodes[r],
+               (unsigned long long)rep.rcodes[r], (long long)rep.rcodes[r] - (long long)cap.rcodes[r]);
+    }
+
+    // 两边都有应答的查询逐条比较 rcode
+    uint64_t both = 0, changed = 0, transitions[16][16] = {{0}};
+    for (size_t i = 0; i < num_queries; i++) {
+        if (queries[i].cap_rcode == NO_RCODE || queries[i].rep_rcode == NO_RCODE) continue;
+        both++;
+        if (queries[i].cap_rcode != queries[i].rep_rcode) {
+            changed++;
+            transitions[queries[i].cap_rcode & 15][queries[i].rep_rcode & 15]++;
+        }
+    }
+    printf("\nanswered in both: %llu, rcode changed: %llu\n", (unsigned long long)both,
+           (unsigned long long)changed);
+    for (int a = 0; a < 16; a++) {
+        for (int b = 0; b < 16; b++) {
+            if (!transitions[a][b]) continue;
+            printf("  %s -> ", rcode_name(a));
+            printf("%s: %llu\n", rcode_name(b), (unsigned long long)transitions[a][b]);
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s SPEED] [-c N] [-t MS] [-p PORT] [-b N] FILE.pcap [SERVER[:PORT]]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    double speed = 1;
+    long concurrency = 64, timeout_ms = 2000, dns_port = 53, batch = 32;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:t:p:b:")) != -1) {
+        switch (opt) {
+            case 's': speed = strtod(optarg, NULL); break;
+            case 'c': concurrency = strtol(optarg, NULL, 10); break;
+            case 't': timeout_ms = strtol(optarg, NULL, 10); break;
+            case 'p': dns_port = strtol(optarg, NULL, 10); break;
+            case 'b': batch = strtol(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc || optind + 2 < argc || speed < 0 || concurrency < 1 || timeout_ms < 1 ||
+        dns_port < 1 || dns_port > 65535 || batch < 1 || batch > MAX_BATCH) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char host[64] = "127.0.0.1";
+    struct sockaddr_in server = {.sin_family = AF_INET, .sin_port = htons(53)};
+    if (optind + 1 < argc) {
+        const char *arg = argv[optind + 1], *colon = strchr(arg, ':');
+        size_t l = colon ? (size_t)(colon - arg) : strlen(arg);
+        if (l >= sizeof(host)) l = sizeof(host) - 1;
+        memcpy(host, arg, l);
+        host[l] = '\0';
+        if (colon) server.sin_port = htons(strtol(colon + 1, NULL, 10));
+    }
+    if (inet_pton(AF_INET, host, &server.sin_addr) != 1) {
+        fprintf(stderr, "invalid server address '%s'\n", host);
+        return 2;
+    }
+
+    matches = calloc(MATCH_TABLE_SIZE, sizeof(match_t));
+    if (!matches) {
+        perror("calloc");
+        return 1;
+    }
+    if (read_pcap(argv[optind], dns_port) != 0) return 1;
+    free(matches);
+    if (num_queries == 0) {
+        fprintf(stderr, "no queries to port %ld found\n", dns_port);
+        return 1;
+    }
+    double cap_span = (queries[num_queries - 1].ts_ns - queries[0].ts_ns) / 1e9;
+    printf("loaded %zu queries spanning %.3f s (%llu other packets, %llu unmatched responses)\n",
+           num_queries, cap_span, (unsigned long long)skipped_packets,
+           (unsigned long long)unmatched_responses);
+    if (speed > 0) printf("replaying at %gx against %s:%d\n\n", speed, host, ntohs(server.sin_port));
+    else printf("replaying as fast as possible with %ld in flight against %s:%d\n\n",
+                concurrency, host, ntohs(server.sin_port));
+
+    struct pollfd pfds[NUM_SOCKETS];
+    for (int i = 0; i < NUM_SOCKETS; i++) {
+        socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        slots[i] = calloc(65536, sizeof(slot_t));
+        if (socks[i] < 0 || !slots[i] || connect(socks[i], (struct sockaddr*)&server, sizeof(server)) != 0) {
+            perror("socket");
+            return 1;
+        }
+        int size = 4 << 20;
+        setsockopt(socks[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        pfds[i] = (struct pollfd){.fd = socks[i], .events = POLLIN};
+    }
+
+    uint64_t timeout_ns = timeout_ms * 1000000ULL;
+    uint64_t start = now_ns(), last_sent = start, last_expire = start;
+    size_t next = 0;
+    int si = 0;
+    while (next < num_queries || inflight > 0) {
+        uint64_t now = now_ns();
+        if (next == num_queries && now - last_sent >= timeout_ns) break;
+
+        // 找出已到发送时间的查询
+        size_t end = next;
+        if (speed > 0) {
+            uint64_t elapsed = (now - start) * speed;
+            while (end < num_queries && end - next < (size_t)batch &&
+                   queries[end].ts_ns - queries[0].ts_ns <= elapsed) end++;
+        } else {
+            long room = concurrency - inflight;
+            end = next + (room < batch ? (room > 0 ? room : 0) : batch);
+            if (end > num_queries) end = num_queries;
+        }
+        if (end > next) {
+            send_batch(si, &next, end);
+            si = (si + 1) % NUM_SOCKETS;
+            last_sent = now_ns();
+        }
+
+        int wait = 1;
+        if (speed > 0 && next < num_queries) {
+            uint64_t due = (queries[next].ts_ns - queries[0].ts_ns) / speed;
+            uint64_t elapsed = now_ns() - start;
+            wait = due > elapsed ? (int)((due - elapsed) / 1000000) : 0;
+            if (wait > 10) wait = 10;
+        } else if (speed == 0 && inflight < concurrency && next < num_queries) {
+            wait = 0;
+        }
+        if (poll(pfds, NUM_SOCKETS, wait) > 0) {
+            for (int i = 0; i < NUM_SOCKETS; i++) {
+                if (pfds[i].revents & POLLIN) recv_batch(i, batch, timeout_ns);
+            }
+        }
+        now = now_ns();
+        if (now - last_expire >= 100000000ULL) {
+            expire(now, timeout_ns);
+            last_expire = now;
+        }
+    }
+    double rep_span = (last_sent - start) / 1e9;
+    if (rep_span <= 0) rep_span = 1e-9;
+    if (cap_span <= 0) cap_span = 1e-9;
+
+    report(cap_span, rep_span);
+    if (late) printf("late responses: %llu\n", (unsigned long long)late);
+
+    for (int i = 0; i < NUM_SOCKETS; i++) {
+        close(socks[i]);
+        free(slots[i]);
+    }
+    free(queries);
+    free(payload);
+    return 0;
+}
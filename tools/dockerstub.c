@@ -0,0 +1,408 @@
+// 模拟 Docker API：在 unix 套接字上提供 docker-dns 用到的三个接口，容器表和事件由标准输入控制，
+// 不依赖 Docker 就能复现容器表的加载、事件处理和断线重连
+//
+// 编译：gcc -O2 -o dockerstub tools/dockerstub.c
+// 用法：dockerstub [-s PATH] [-f FILE] [-v]
+//   -s PATH   监听的 unix 套接字（默认 /tmp/docker-stub.sock）
+//   -f FILE   启动时运行的容器，每行 ID NAME IP [IP...]
+//   -v        打印每个请求
+//
+// 接口（HTTP/1.0，应答后关闭连接，事件流除外）：
+//   GET /containers/json        运行中的容器列表
+//   GET /containers/ID/json     单个容器，不存在时返回 404
+//   GET /events?...             事件流，每行一个 JSON 对象
+//
+// 标准输入的命令，每条命令向所有事件流发送对应的事件：
+//   start ID NAME IP [IP...]    添加或重新启动容器（container start）
+//   stop ID                     停止容器（container die）
+//   rename ID NAME              改名（container rename）
+//   connect ID IP               增加一个网络地址（network connect）
+//   disconnect ID IP            去掉一个网络地址（network disconnect）
+//   close                       断开所有事件流，用于测试重连
+//   list                        打印容器表
+// ID 需为十六进制，与 Docker 相同；docker-dns 会忽略其他形式的 ID。
+//
+// 配合转发器使用：docker-dns -f -d /tmp/docker-stub.sock
+
+#include <errno.h>        // for errno, EINTR
+#include <poll.h>         // for poll, pollfd, POLLIN
+#include <signal.h>       // for signal, SIGPIPE, SIG_IGN
+#include <stdarg.h>       // for va_list, va_start, va_end
+#include <stdio.h>        // for printf, fprintf, perror, fopen, fgets, snprintf
+#include <stdlib.h>       // for exit
+#include <string.h>       // for memcpy, memset, strcmp, strlen, strncmp, strtok, strstr
+#include <sys/socket.h>   // for socket, bind, listen, accept, AF_UNIX, SOCK_STREAM
+#include <sys/un.h>       // for sockaddr_un
+#include <unistd.h>       // for close, read, write, unlink, getopt
+
+#define MAX_CONTAINERS 1024
+#define MAX_ADDRS 8
+#define MAX_CLIENTS 64
+#define REQ_SIZE 2048
+#define OUT_SIZE (1024 * 1024)
+
+typedef struct {
+    char id[65];
+    char name[128];
+    int running;
+    int num_addrs;
+    char addrs[MAX_ADDRS][16];
+} container_t;
+
+typedef struct {
+    int fd;
+    int events;                      // 已进入事件流
+    size_t len;
+    char req[REQ_SIZE];
+} client_t;
+
+static container_t containers[MAX_CONTAINERS];
+static int num_containers;
+static client_t clients[MAX_CLIENTS];
+static int verbose;
+static char out[OUT_SIZE];
+static size_t out_len;
+
+static void out_reset(void) {
+    out_len = 0;
+    out[0] = '\0';
+}
+
+static void outf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void outf(const char *fmt, ...) {
+    if (out_len + 1 >= sizeof(out)) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out + out_len, sizeof(out) - out_len, fmt, ap);
+    va_end(ap);
+    if (n > 0) out_len += (size_t)n < sizeof(out) - out_len ? (size_t)n : sizeof(out) - out_len - 1;
+}
+
+// 阻塞写完整个缓冲区，对端关闭时返回 -1
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+static container_t* find_container(const char *id) {
+    for (int i = 0; i < num_containers; i++) {
+        if (strcmp(containers[i].id, id) == 0) return &containers[i];
+    }
+    return NULL;
+}
+
+static void out_networks(const container_t *c) {
+    outf("\"NetworkSettings\":{\"Networks\":{");
+    for (int a = 0; a < c->num_addrs; a++) {
+        outf("%s\"net%d\":{\"IPAddress\":\"%s\",\"Aliases\":null}", a ? "," : "", a, c->addrs[a]);
+    }
+    outf("}}");
+}
+
+// 生成响应正文，返回 HTTP 状态码
+static int build_response(const char *path) {
+    out_reset();
+    if (strcmp(path, "/containers/json") == 0 || strncmp(path, "/containers/json?", 17) == 0) {
+        outf("[");
+        int first = 1;
+        for (int i = 0; i < num_containers; i++) {
+            const container_t *c = &containers[i];
+            if (!c->running) continue;
+            outf("%s{\"Id\":\"%s\",\"Names\":[\"/%s\"],\"State\":\"running\",", first ? "" : ",", c->id, c->name);
+            out_networks(c);
+            outf("}");
+            first = 0;
+        }
+        outf("]");
+        return 200;
+    }
+
+    char id[65];
+    if (sscanf(path, "/containers/%64[^/]/json", id) == 1) {
+        const container_t *c = find_container(id);
+        if (!c) {
+            outf("{\"message\":\"No such container: %s\"}", id);
+            return 404;
+        }
+        outf("{\"Id\":\"%s\",\"Name\":\"/%s\",\"State\":{\"Running\":%s},", c->id, c->name,
+             c->running ? "true" : "false");
+        out_networks(c);
+        outf("}");
+        return 200;
+    }
+
+    outf("{\"message\":\"page not found\"}");
+    return 404;
+}
+
+// 处理完整的请求头，事件流保持连接，其余请求应答后关闭
+static int handle_request(client_t *cl) {
+    char method[8], path[512];
+    if (sscanf(cl->req, "%7s %511s", method, path) != 2 || strcmp(method, "GET") != 0) {
+        static const char bad[] = "HTTP/1.0 400 Bad Request\r\n\r\n";
+        write_all(cl->fd, bad, sizeof(bad) - 1);
+        return -1;
+    }
+    if (verbose) printf("GET %s\n", path);
+
+    if (strncmp(path, "/events", 7) == 0) {
+        static const char ok[] = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\n\r\n";
+        if (write_all(cl->fd, ok, sizeof(ok) - 1) != 0) return -1;
+        cl->events = 1;
+        return 0;
+    }
+
+    int status = build_response(path);
+    char head[128];
+    int n = snprintf(head, sizeof(head), "HTTP/1.0 %d %s\r\nContent-Type: application/json\r\n\r\n",
+                     status, status == 200 ? "OK" : "Not Found");
+    write_all(cl->fd, head, n);
+    write_all(cl->fd, out, out_len);
+    return -1;
+}
+
+static void close_client(client_t *cl) {
+    close(cl->fd);
+    cl->fd = -1;
+    cl->events = 0;
+    cl->len = 0;
+}
+
+// 向所有事件流发送一行事件
+static void broadcast(void) {
+    outf("\n");
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0 && clients[i].events && write_all(clients[i].fd, out, out_len) != 0) {
+            close_client(&clients[i]);
+        }
+    }
+}
+
+static void container_event(const container_t *c, const char *action) {
+    out_reset();
+    outf("{\"Type\":\"container\",\"Action\":\"%s\",\"Actor\":{\"ID\":\"%s\",\"Attributes\":{\"name\":\"%s\"}}}",
+         action, c->id, c->name);
+    broadcast();
+}
+
+static void network_event(const container_t *c, const char *action) {
+    out_reset();
+    outf("{\"Type\":\"network\",\"Action\":\"%s\",\"Actor\":{\"ID\":\"stubnet\",\"Attributes\":"
+         "{\"container\":\"%s\",\"name\":\"net\"}}}", action, c->id);
+    broadcast();
+}
+
+// 添加或更新容器，参数依次为 ID NAME IP...
+static container_t* set_container(char *args) {
+    char *id = strtok(args, " \t\r\n");
+    char *name = strtok(NULL, " \t\r\n");
+    if (!id || !name || strlen(id) >= sizeof(containers[0].id) ||
+        strlen(name) >= sizeof(containers[0].name)) return NULL;
+
+    container_t *c = find_container(id);
+    if (!c) {
+        if (num_containers >= MAX_CONTAINERS) return NULL;
+        c = &containers[num_containers++];
+    }
+    memset(c, 0, sizeof(*c));
+    snprintf(c->id, sizeof(c->id), "%s", id);
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    char *ip;
+    while (c->num_addrs < MAX_ADDRS && (ip = strtok(NULL, " \t\r\n"))) {
+        snprintf(c->addrs[c->num_addrs++], sizeof(c->addrs[0]), "%s", ip);
+    }
+    c->running = 1;
+    return c;
+}
+
+static void load_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+        if (!set_container(line)) fprintf(stderr, "ignoring line: %s", line);
+    }
+    fclose(f);
+}
+
+// 执行一条标准输入的命令
+static void run_command(char *line) {
+    char *cmd = strtok(line, " \t\r\n");
+    if (!cmd) return;
+    char *rest = strtok(NULL, "");
+
+    if (strcmp(cmd, "start") == 0) {
+        container_t *c = rest ? set_container(rest) : NULL;
+        if (!c) {
+            fprintf(stderr, "usage: start ID NAME IP [IP...]\n");
+            return;
+        }
+        container_event(c, "start");
+        return;
+    }
+    if (strcmp(cmd, "close") == 0) {
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0 && clients[i].events) close_client(&clients[i]);
+        }
+        return;
+    }
+    if (strcmp(cmd, "list") == 0) {
+        for (int i = 0; i < num_containers; i++) {
+            const container_t *c = &containers[i];
+            printf("%s %s %s", c->id, c->name, c->running ? "running" : "stopped");
+            for (int a = 0; a < c->num_addrs; a++) printf(" %s", c->addrs[a]);
+            printf("\n");
+        }
+        fflush(stdout);
+        return;
+    }
+
+    char *id = rest ? strtok(rest, " \t\r\n") : NULL;
+    char *arg = id ? strtok(NULL, " \t\r\n") : NULL;
+    container_t *c = id ? find_container(id) : NULL;
+    if (!c) {
+        fprintf(stderr, "unknown container or command: %s\n", cmd);
+        return;
+    }
+
+    if (strcmp(cmd, "stop") == 0) {
+        c->running = 0;
+        container_event(c, "die");
+    } else if (strcmp(cmd, "rename") == 0 && arg && strlen(arg) < sizeof(c->name)) {
+        snprintf(c->name, sizeof(c->name), "%s", arg);
+        container_event(c, "rename");
+    } else if (strcmp(cmd, "connect") == 0 && arg && c->num_addrs < MAX_ADDRS) {
+        snprintf(c->addrs[c->num_addrs++], sizeof(c->addrs[0]), "%s", arg);
+        network_event(c, "connect");
+    } else if (strcmp(cmd, "disconnect") == 0 && arg) {
+        for (int a = 0; a < c->num_addrs; a++) {
+            if (strcmp(c->addrs[a], arg) != 0) continue;
+            memmove(c->addrs[a], c->addrs[a + 1], (c->num_addrs - a - 1) * sizeof(c->addrs[0]));
+            c->num_addrs--;
+            break;
+        }
+        network_event(c, "disconnect");
+    } else {
+        fprintf(stderr, "invalid command: %s\n", cmd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = "/tmp/docker-stub.sock";
+    int opt;
+    while ((opt = getopt(argc, argv, "s:f:v")) != -1) {
+        switch (opt) {
+            case 's': path = optarg; break;
+            case 'f': load_file(optarg); break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s PATH] [-f FILE] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return 1;
+    }
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 16) != 0) {
+        perror(path);
+        return 1;
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) clients[i].fd = -1;
+    printf("docker API stub listening on %s, %d containers\n", path, num_containers);
+    fflush(stdout);
+
+    int stdin_open = 1;
+    char cmd[1024];
+    size_t cmd_len = 0;
+    while (1) {
+        struct pollfd pfd[MAX_CLIENTS + 2];
+        int map[MAX_CLIENTS + 2];
+        int n = 0;
+        pfd[n] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+        map[n++] = -1;
+        if (stdin_open) {
+            pfd[n] = (struct pollfd){ .fd = 0, .events = POLLIN };
+            map[n++] = -2;
+        }
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i].fd < 0) continue;
+            pfd[n] = (struct pollfd){ .fd = clients[i].fd, .events = POLLIN };
+            map[n++] = i;
+        }
+
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return 1;
+        }
+
+        for (int k = 0; k < n; k++) {
+            if (!pfd[k].revents) continue;
+            if (map[k] == -1) {
+                int fd = accept(lfd, NULL, NULL);
+                if (fd < 0) continue;
+                int i = 0;
+                while (i < MAX_CLIENTS && clients[i].fd >= 0) i++;
+                if (i == MAX_CLIENTS) {
+                    close(fd);
+                    continue;
+                }
+                clients[i].fd = fd;
+                clients[i].len = 0;
+                clients[i].events = 0;
+            } else if (map[k] == -2) {
+                ssize_t r = read(0, cmd + cmd_len, sizeof(cmd) - 1 - cmd_len);
+                if (r <= 0) {
+                    stdin_open = 0;   // 标准输入关闭后继续提供接口
+                    continue;
+                }
+                cmd_len += r;
+                cmd[cmd_len] = '\0';
+                char *nl;
+                while ((nl = strchr(cmd, '\n'))) {
+                    *nl = '\0';
+                    run_command(cmd);
+                    cmd_len -= nl + 1 - cmd;
+                    memmove(cmd, nl + 1, cmd_len + 1);
+                }
+                if (cmd_len + 1 >= sizeof(cmd)) cmd_len = 0;
+            } else {
+                client_t *cl = &clients[map[k]];
+                if (cl->fd < 0) continue;
+                ssize_t r = read(cl->fd, cl->req + cl->len, sizeof(cl->req) - 1 - cl->len);
+                // 事件流上客户端不再发送数据，可读只意味着断开
+                if (r <= 0 || cl->events) {
+                    close_client(cl);
+                    continue;
+                }
+                cl->len += r;
+                cl->req[cl->len] = '\0';
+                if (strstr(cl->req, "\r\n\r\n")) {
+                    if (handle_request(cl) != 0) close_client(cl);
+                } else if (cl->len + 1 >= sizeof(cl->req)) {
+                    close_client(cl);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,395 @@
+// 微基准：在样本报文上单独测量查询路径的各个阶段，输出 ns/op 和 allocs/op
+//
+// 编译（与镜像相同的静态链接，ldns 内部的分配也会被计入，命令写在一行）：
+//   gcc -O2 -static -I include -D__TIMEZONE_NAME__='"UTC"' -o microbench tools/microbench.c
+//       $(ls src/*.c | grep -v main.c) -lldns -lssl -lcrypto -lpthread
+//       -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free
+// 用法：microbench [-t MS] [FILTER]
+//   -t MS    每项的目标运行时间（默认 200），每项运行 3 次取最快的一次
+//   FILTER   只运行名称包含该字符串的项
+//
+// 样本报文与 dig 发出的查询相同：web.docker（带 EDNS cookie）、gateway.docker（不带 EDNS）、
+// www.example.com、带环路标记的 web.docker，以及上游对 web 的两条 A 记录应答。
+// 带 "copy" 的项包含复制样本的开销，可与 memcpy 一项对比。
+// 定义 NO_LDNS 时跳过作为参照的 ldns 解析和序列化。
+
+#include "config.h"       // for init_config_env, log_level
+#include "dns.h"          // for process_dns_query, refuse_unmatched
+#include "docker.h"       // for handle_docker_query
+#include "gateway.h"      // for init_gateway, set_gateway_addr, is_gateway_domain, ...
+#include "logging.h"      // for log_level, LOG_ERROR
+#include "loop_marker.h"  // for add_loop_marker, get_loop_marker
+#include "records.h"      // for load_records, handle_local_query
+#include "route.h"        // for match_route, route_t
+#include "snapshot.h"     // for build_snapshot, publish_snapshot, snapshot_t
+#include "wire.h"         // for wire_question_end, wire_splice, wire_fit_response, ...
+#include <arpa/inet.h>    // for inet_pton, htons
+#include <stdio.h>        // for printf, fprintf, perror
+#include <stdlib.h>       // for strtol, mkstemp
+#include <string.h>       // for memcpy, strstr
+#include <sys/socket.h>   // for socket, connect
+#include <time.h>         // for clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>       // for write, close, unlink, getopt
+#ifndef NO_LDNS
+#include <ldns/ldns.h>    // for ldns_wire2pkt, ldns_pkt2wire, ldns_pkt_free
+#endif
+
+struct in_addr gateway_addr;
+
+// 链接时用 --wrap 替换分配函数，统计本程序和静态链接库中的分配次数
+static uint64_t alloc_count;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+void* __wrap_malloc(size_t size) { alloc_count++; return __real_malloc(size); }
+void* __wrap_calloc(size_t n, size_t size) { alloc_count++; return __real_calloc(n, size); }
+void* __wrap_realloc(void *p, size_t size) { alloc_count++; return __real_realloc(p, size); }
+void __wrap_free(void *p) { __real_free(p); }
+
+typedef struct {
+    uint8_t data[BUF_SIZE];
+    size_t len;
+    size_t qname_end;
+} sample_t;
+
+static sample_t q_docker, q_gateway, q_other, q_loop, r_upstream, r_large;
+static uint8_t work[WIRE_BUF_SIZE];
+static uint8_t out[WIRE_BUF_SIZE];
+static volatile uint64_t sink;
+static int udp_fd;
+static snapshot_t *conf;
+static struct sockaddr_in client = {.sin_family = AF_INET};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 组装查询：名称、类型，可选 EDNS cookie 和环路标记
+static void make_query(sample_t *s, const char *name, uint16_t type, int edns, int hops) {
+    uint8_t *p = s->data;
+    memset(p, 0, DNS_HEADER_SIZE);
+    wire_set_u16(p + DNS_OFF_ID, 0x1234);
+    wire_set_u16(p + DNS_OFF_FLAGS, DNS_FLAG_RD);
+    wire_set_u16(p + DNS_OFF_QDCOUNT, 1);
+    size_t n = DNS_HEADER_SIZE + wire_name_from_str(name, p + DNS_HEADER_SIZE);
+    s->qname_end = n;
+    wire_set_u16(p + n, type);
+    wire_set_u16(p + n + 2, DNS_CLASS_IN);
+    n += 4;
+    if (edns) {
+        static const uint8_t cookie[] = {0x00, 0x0a, 0x00, 0x08, 0x5b, 0x2c, 0x91, 0x0e, 0x47, 0xd3, 0x6a, 0x18};
+        memset(p + n, 0, 11);
+        wire_set_u16(p + n + 1, DNS_TYPE_OPT);
+        wire_set_u16(p + n + 3, 1232);
+        wire_set_u16(p + n + 9, sizeof(cookie));
+        memcpy(p + n + 11, cookie, sizeof(cookie));
+        n += 11 + sizeof(cookie);
+        wire_set_u16(p + DNS_OFF_ARCOUNT, 1);
+    }
+    s->len = n;
+    if (hops) add_loop_marker(p, &s->len, sizeof(s->data), hops);
+}
+
+// 上游应答：问题段之后 count 条 A 记录，名称为指向问题的指针
+static void make_response(sample_t *s, const char *name, int count) {
+    make_query(s, name, DNS_TYPE_A, 0, 0);
+    uint8_t *p = s->data;
+    wire_set_u16(p + DNS_OFF_FLAGS, DNS_FLAG_QR | DNS_FLAG_RD | DNS_FLAG_RA);
+    for (int i = 0; i < count && s->len + 16 <= sizeof(s->data); i++) {
+        uint8_t *rr = p + s->len;
+        wire_set_u16(rr, 0xc000 | DNS_HEADER_SIZE);
+        wire_set_u16(rr + 2, DNS_TYPE_A);
+        wire_set_u16(rr + 4, DNS_CLASS_IN);
+        wire_set_u16(rr + 6, 0);
+        wire_set_u16(rr + 8, 600);
+        wire_set_u16(rr + 10, 4);
+        rr[12] = 172; rr[13] = 18; rr[14] = i >> 8; rr[15] = i;
+        s->len += 16;
+    }
+    wire_set_u16(p + DNS_OFF_ANCOUNT, count);
+}
+
+static void bench_memcpy(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        memcpy(work, q_docker.data, q_docker.len);
+        sink += work[i & 31];
+    }
+}
+
+static void bench_question_end(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        size_t qname_end, end;
+        wire_question_end(q_docker.data, q_docker.len, &qname_end, &end);
+        sink += end;
+    }
+}
+
+static void bench_get_loop_marker_none(size_t n) {
+    for (size_t i = 0; i < n; i++) sink += get_loop_marker(q_gateway.data, q_gateway.len);
+}
+
+static void bench_get_loop_marker_opt(size_t n) {
+    for (size_t i = 0; i < n; i++) sink += get_loop_marker(q_loop.data, q_loop.len);
+}
+
+static void bench_add_loop_marker(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        size_t len = q_docker.len;
+        memcpy(work, q_docker.data, len);
+        add_loop_marker(work, &len, sizeof(work), 1);
+        sink += len;
+    }
+}
+
+static void bench_match_route_hit(size_t n) {
+    for (size_t i = 0; i < n; i++) sink += (uintptr_t)match_route(&conf->routes, q_docker.data, q_docker.qname_end);
+}
+
+static void bench_match_route_miss(size_t n) {
+    for (size_t i = 0; i < n; i++) sink += (uintptr_t)match_route(&conf->routes, q_other.data, q_other.qname_end);
+}
+
+static void bench_is_gateway_domain(size_t n) {
+    for (size_t i = 0; i < n; i++) sink += is_gateway_domain(conf, q_gateway.data, q_gateway.qname_end);
+}
+
+// 与 forward_query 相同，去掉后缀的线格式标签（不含根标签）
+static void bench_strip_suffix(size_t n) {
+    const route_t *r = match_route(&conf->routes, q_docker.data, q_docker.qname_end);
+    size_t off = q_docker.qname_end - 1 - r->suffix_wire_len;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = q_docker.len;
+        memcpy(work, q_docker.data, len);
+        wire_splice(work, &len, sizeof(work), off, r->suffix_wire_len, NULL, 0);
+        sink += len;
+    }
+}
+
+// 在上游应答的问题段中恢复后缀
+static void bench_restore_suffix(size_t n) {
+    const route_t *r = match_route(&conf->routes, q_docker.data, q_docker.qname_end);
+    size_t off = q_docker.qname_end - 1 - r->suffix_wire_len;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = r_upstream.len;
+        memcpy(work, r_upstream.data, len);
+        wire_splice(work, &len, sizeof(work), off, 0, q_docker.data + off, r->suffix_wire_len);
+        sink += len;
+    }
+}
+
+static void bench_gateway_answer(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        sink += handle_gateway_query(conf, q_gateway.data, q_gateway.len, out, sizeof(out), client.sin_addr);
+    }
+}
+
+static void bench_local_answer(size_t n) {
+    for (size_t i = 0; i < n; i++) sink += handle_local_query(q_other.data, q_other.qname_end, out, sizeof(out));
+}
+
+static void bench_docker_miss(size_t n) {
+    const route_t *r = match_route(&conf->routes, q_docker.data, q_docker.qname_end);
+    for (size_t i = 0; i < n; i++) {
+        sink += handle_docker_query(q_docker.data, q_docker.qname_end, r->suffix_wire_len, out, sizeof(out));
+    }
+}
+
+static void bench_refuse_unmatched(size_t n) {
+    sample_t q;
+    make_query(&q, "www.example.org.", DNS_TYPE_A, 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        size_t len = q.len;
+        memcpy(work, q.data, len);
+        sink += refuse_unmatched(work, &len);
+    }
+}
+
+static void bench_make_error(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        memcpy(work, q_docker.data, q_docker.len);
+        sink += wire_make_error(work, q_docker.len, DNS_RCODE_SERVFAIL);
+    }
+}
+
+static void bench_fit_response(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        memcpy(work, r_upstream.data, r_upstream.len);
+        sink += wire_fit_response(work, r_upstream.len, DNS_UDP_MIN_SIZE, 0);
+    }
+}
+
+static void bench_fit_truncate(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        memcpy(work, r_large.data, r_large.len);
+        sink += wire_fit_response(work, r_large.len, DNS_UDP_MIN_SIZE, 0);
+    }
+}
+
+static void bench_name_to_str(size_t n) {
+    char name[DNS_NAME_STR_LEN];
+    for (size_t i = 0; i < n; i++) {
+        sink += wire_name_to_str(q_docker.data, q_docker.len, DNS_HEADER_SIZE, name, sizeof(name));
+    }
+}
+
+// 完整的工作线程处理，包括发往本机丢弃端口的 sendto
+static void bench_process_gateway(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        process_dns_query(udp_fd, q_gateway.data, q_gateway.len, &client, sizeof(client), now_ns());
+    }
+}
+
+static void bench_process_loop(size_t n) {
+    sample_t q;
+    make_query(&q, "web.docker.", DNS_TYPE_A, 1, 3);
+    for (size_t i = 0; i < n; i++) {
+        process_dns_query(udp_fd, q.data, q.len, &client, sizeof(client), now_ns());
+    }
+}
+
+#ifndef NO_LDNS
+// 参照：改为线格式处理之前每个查询都要经过的 ldns 解析和序列化
+static void bench_ldns_wire2pkt(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        ldns_pkt *pkt = NULL;
+        if (ldns_wire2pkt(&pkt, q_docker.data, q_docker.len) == LDNS_STATUS_OK) ldns_pkt_free(pkt);
+        sink += (uintptr_t)pkt;
+    }
+}
+
+static void bench_ldns_pkt2wire(size_t n) {
+    ldns_pkt *pkt = NULL;
+    if (ldns_wire2pkt(&pkt, r_upstream.data, r_upstream.len) != LDNS_STATUS_OK) return;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t *wire = NULL;
+        size_t size = 0;
+        if (ldns_pkt2wire(&wire, pkt, &size) == LDNS_STATUS_OK) free(wire);
+        sink += size;
+    }
+    ldns_pkt_free(pkt);
+}
+#endif
+
+static const struct {
+    const char *name;
+    void (*fn)(size_t n);
+} benches[] = {
+    {"memcpy (query copy)", bench_memcpy},
+    {"wire_question_end", bench_question_end},
+    {"get_loop_marker (no OPT)", bench_get_loop_marker_none},
+    {"get_loop_marker (marked)", bench_get_loop_marker_opt},
+    {"add_loop_marker (copy)", bench_add_loop_marker},
+    {"match_route (hit)", bench_match_route_hit},
+    {"match_route (miss)", bench_match_route_miss},
+    {"is_gateway_domain", bench_is_gateway_domain},
+    {"strip suffix (copy)", bench_strip_suffix},
+    {"restore suffix (copy)", bench_restore_suffix},
+    {"handle_gateway_query", bench_gateway_answer},
+    {"handle_local_query", bench_local_answer},
+    {"handle_docker_query (miss)", bench_docker_miss},
+    {"refuse_unmatched (copy)", bench_refuse_unmatched},
+    {"wire_make_error (copy)", bench_make_error},
+    {"wire_fit_response (copy)", bench_fit_response},
+    {"wire_fit_response trunc (copy)", bench_fit_truncate},
+    {"wire_name_to_str", bench_name_to_str},
+    {"process_dns_query gateway", bench_process_gateway},
+    {"process_dns_query loop", bench_process_loop},
+#ifndef NO_LDNS
+    {"ldns_wire2pkt (reference)", bench_ldns_wire2pkt},
+    {"ldns_pkt2wire (reference)", bench_ldns_pkt2wire},
+#endif
+};
+
+// 本地记录需要从文件加载
+static int load_sample_records(void) {
+    char path[] = "/tmp/microbench-hosts-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return 1;
+    static const char hosts[] = "93.184.216.34 www.example.com\n2606:2800:220:1::1 www.example.com\n";
+    int ok = write(fd, hosts, sizeof(hosts) - 1) == (ssize_t)(sizeof(hosts) - 1);
+    close(fd);
+    ok = ok && load_records(path) == 0;
+    unlink(path);
+    return !ok;
+}
+
+static int setup(void) {
+    init_config_env();
+    log_level = LOG_ERROR;
+    conf = build_snapshot();
+    if (!conf) return 1;
+    publish_snapshot(conf);
+    init_gateway();
+    struct in_addr gw;
+    inet_pton(AF_INET, "172.18.0.1", &gw);
+    set_gateway_addr(gw);
+    if (load_sample_records() != 0) {
+        fprintf(stderr, "failed to load sample records\n");
+        return 1;
+    }
+
+    make_query(&q_docker, "web.docker.", DNS_TYPE_A, 1, 0);
+    make_query(&q_gateway, "gateway.docker.", DNS_TYPE_A, 0, 0);
+    make_query(&q_other, "www.example.com.", DNS_TYPE_A, 1, 0);
+    make_query(&q_loop, "web.docker.", DNS_TYPE_A, 1, 1);
+    make_response(&r_upstream, "web.", 2);
+    make_response(&r_large, "web.", 60);
+
+    // 响应发往本机的 discard 端口，没有监听也不影响测量
+    inet_pton(AF_INET, "127.0.0.1", &client.sin_addr);
+    client.sin_port = htons(9);
+    udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long target_ms = 200;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+            case 't': target_ms = strtol(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "Usage: %s [-t MS] [FILTER]\n", argv[0]);
+                return 2;
+        }
+    }
+    const char *filter = optind < argc ? argv[optind] : NULL;
+    if (target_ms < 1 || setup() != 0) return 1;
+
+    printf("%-32s %12s %10s %12s\n", "benchmark", "ns/op", "allocs/op", "iterations");
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        if (filter && !strstr(benches[b].name, filter)) continue;
+
+        // 先用少量迭代估算耗时，再按目标时间确定迭代次数
+        size_t iters = 1000;
+        uint64_t start = now_ns();
+        benches[b].fn(iters);
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed == 0) elapsed = 1;
+        double scaled = (double)iters * target_ms * 1e6 / elapsed;
+        iters = scaled < 1000 ? 1000 : (size_t)scaled;
+
+        double best = 0;
+        uint64_t allocs = 0;
+        for (int run = 0; run < 3; run++) {
+            uint64_t a0 = alloc_count;
+            start = now_ns();
+            benches[b].fn(iters);
+            double ns = (double)(now_ns() - start) / iters;
+            if (run == 0 || ns < best) best = ns;
+            allocs = alloc_count - a0;
+        }
+        printf("%-32s %12.1f %10.2f %12zu\n", benches[b].name, best, (double)allocs / iters, iters);
+    }
+    close(udp_fd);
+    return 0;
+}
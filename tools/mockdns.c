@@ -0,0 +1,465 @@
+// 模拟上游 DNS 服务器：在本机按名称表应答，可配置延迟分布、丢包、TC、NXDOMAIN 和错误 ID，
+// 不依赖 Docker 就能稳定复现转发路径上的超时、重试和故障切换
+//
+// 编译：gcc -O2 -I include -o mockdns tools/mockdns.c src/wire.c -lm
+// 用法：mockdns [选项]
+//   -l ADDR[:PORT]  监听地址（默认 127.0.0.1:5300）
+//   -f FILE         hosts 格式的名称表（IP name [name...]），表外名称返回 NXDOMAIN；
+//                   不指定时所有 A 查询都返回 -A 的地址
+//   -A ADDR         没有名称表时的应答地址（默认 192.0.2.1）
+//   -T TTL          应答 TTL（默认 60）
+//   -d DIST         延迟分布，毫秒：fixed:MS、uniform:MIN:MAX、exp:MEAN、normal:MEAN:SD（默认 fixed:0）
+//   -p RATIO        丢弃查询的比例
+//   -t RATIO        返回只有问题段、带 TC 标志的响应的比例
+//   -x RATIO        表内名称也返回 NXDOMAIN 的比例
+//   -i RATIO        先发一个 ID 错误的响应、再发正确响应的比例
+//   -S SEED         随机数种子，相同种子和相同查询序列得到相同结果（默认 1）
+//   -v              每个查询打印一行
+//
+// 配合转发器使用：docker-dns -f -D 127.0.0.1#5300
+// 收到 SIGINT/SIGTERM 时打印统计后退出。
+
+#include "wire.h"         // for wire_question_end, wire_find_opt, wire_get_u16, DNS_*
+#include <arpa/inet.h>    // for inet_pton, inet_ntop, htons
+#include <ctype.h>        // for tolower
+#include <math.h>         // for log, sqrt, cos, M_PI
+#include <poll.h>         // for poll, pollfd, POLLIN
+#include <signal.h>       // for signal, SIGINT, SIGTERM
+#include <stdio.h>        // for printf, fprintf, perror, fopen, fgets
+#include <stdlib.h>       // for calloc, free, strtod, strtoul, strtoull
+#include <string.h>       // for memcpy, memset, strchr, strcmp, strlen, strtok
+#include <sys/socket.h>   // for socket, bind, recvfrom, sendto
+#include <time.h>         // for clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>       // for close, getopt
+
+#define NAME_TABLE_SIZE 16384        // 必须是2的幂
+#define MAX_ADDRS 8
+#define MAX_PENDING 65536
+#define PKT_SIZE 1232
+
+typedef struct {
+    char name[DNS_MAX_NAME + 1];     // 小写，不带末尾的点
+    int n4, n6;
+    uint8_t a4[MAX_ADDRS][4];
+    uint8_t a6[MAX_ADDRS][16];
+} name_entry_t;
+
+// 等待延迟到期后发送的响应
+typedef struct {
+    uint64_t due_ns;
+    struct sockaddr_in to;
+    uint16_t len;
+    uint8_t data[PKT_SIZE];
+} pending_t;
+
+typedef enum { DIST_FIXED, DIST_UNIFORM, DIST_EXP, DIST_NORMAL } dist_t;
+
+static name_entry_t *names;
+static size_t num_names;
+static uint8_t default_addr[4] = {192, 0, 2, 1};
+static uint32_t ttl = 60;
+
+static dist_t dist = DIST_FIXED;
+static double dist_a, dist_b;
+static double loss_ratio, tc_ratio, nx_ratio, mismatch_ratio;
+static int verbose;
+
+static pending_t *pending;
+static int heap[MAX_PENDING];        // 按到期时间排列的最小堆，元素为 pending 下标
+static int free_list[MAX_PENDING];
+static int heap_len, free_len;
+
+static uint64_t stat_queries, stat_answered, stat_nxdomain, stat_nodata, stat_dropped;
+static uint64_t stat_tc, stat_mismatch, stat_malformed, stat_overflow;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64*，[0, 1) 均匀分布
+static uint64_t rng_state = 1;
+static double rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// 按配置的分布取一个延迟（纳秒）
+static uint64_t sample_delay(void) {
+    double ms = 0;
+    switch (dist) {
+        case DIST_FIXED:   ms = dist_a; break;
+        case DIST_UNIFORM: ms = dist_a + (dist_b - dist_a) * rng(); break;
+        case DIST_EXP:     ms = -dist_a * log(1.0 - rng()); break;
+        case DIST_NORMAL:  ms = dist_a + dist_b * sqrt(-2.0 * log(1.0 - rng())) * cos(2 * M_PI * rng()); break;
+    }
+    return ms > 0 ? (uint64_t)(ms * 1e6) : 0;
+}
+
+static int parse_dist(const char *s) {
+    char *end;
+    if (!strncmp(s, "fixed:", 6)) {
+        dist = DIST_FIXED;
+        dist_a = strtod(s + 6, &end);
+    } else if (!strncmp(s, "uniform:", 8)) {
+        dist = DIST_UNIFORM;
+        dist_a = strtod(s + 8, &end);
+        if (*end != ':') return 1;
+        dist_b = strtod(end + 1, &end);
+        if (dist_b < dist_a) return 1;
+    } else if (!strncmp(s, "exp:", 4)) {
+        dist = DIST_EXP;
+        dist_a = strtod(s + 4, &end);
+    } else if (!strncmp(s, "normal:", 7)) {
+        dist = DIST_NORMAL;
+        dist_a = strtod(s + 7, &end);
+        if (*end != ':') return 1;
+        dist_b = strtod(end + 1, &end);
+    } else {
+        return 1;
+    }
+    return *end != '\0' || dist_a < 0 || dist_b < 0;
+}
+
+static int parse_ratio(const char *s, double *out) {
+    char *end;
+    *out = strtod(s, &end);
+    return *end != '\0' || *out < 0 || *out > 1;
+}
+
+static uint64_t hash_str(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) h = (h ^ (uint8_t)*s++) * 1099511628211ULL;
+    return h;
+}
+
+static name_entry_t* find_name(const char *name, int create) {
+    size_t i = hash_str(name) & (NAME_TABLE_SIZE - 1);
+    while (names[i].name[0]) {
+        if (strcmp(names[i].name, name) == 0) return &names[i];
+        i = (i + 1) & (NAME_TABLE_SIZE - 1);
+    }
+    if (!create || num_names >= NAME_TABLE_SIZE / 2) return NULL;
+    strcpy(names[i].name, name);
+    num_names++;
+    return &names[i];
+}
+
+// 读取 hosts 格式的名称表
+static int load_names(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return 1;
+    }
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *ip = strtok(line, " \t\r\n");
+        if (!ip) continue;
+
+        uint8_t addr[16];
+        int v6 = strchr(ip, ':') != NULL;
+        if (inet_pton(v6 ? AF_INET6 : AF_INET, ip, addr) != 1) {
+            fprintf(stderr, "%s:%d: invalid address '%s'\n", path, lineno, ip);
+            continue;
+        }
+        char *name;
+        while ((name = strtok(NULL, " \t\r\n"))) {
+            size_t len = strlen(name);
+            if (len && name[len - 1] == '.') name[--len] = '\0';
+            if (len == 0 || len > DNS_MAX_NAME - 2) continue;
+            for (size_t i = 0; i < len; i++) name[i] = tolower((unsigned char)name[i]);
+
+            name_entry_t *e = find_name(name, 1);
+            if (!e) {
+                fprintf(stderr, "%s: name table full\n", path);
+                fclose(fp);
+                return 1;
+            }
+            if (v6 && e->n6 < MAX_ADDRS) memcpy(e->a6[e->n6++], addr, 16);
+            else if (!v6 && e->n4 < MAX_ADDRS) memcpy(e->a4[e->n4++], addr, 4);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+// 问题名称转为小写文本，不带末尾的点
+static void qname_to_str(const uint8_t *pkt, size_t qname_end, char *out) {
+    size_t off = DNS_HEADER_SIZE, n = 0;
+    while (off < qname_end && pkt[off]) {
+        uint8_t l = pkt[off++];
+        if (n && n < DNS_MAX_NAME) out[n++] = '.';
+        for (uint8_t i = 0; i < l && n < DNS_MAX_NAME; i++) out[n++] = tolower(pkt[off + i]);
+        off += l;
+    }
+    out[n] = '\0';
+}
+
+static void heap_push(int idx) {
+    int i = heap_len++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (pending[heap[parent]].due_ns <= pending[idx].due_ns) break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = idx;
+}
+
+static int heap_pop(void) {
+    int top = heap[0], last = heap[--heap_len], i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= heap_len) break;
+        if (child + 1 < heap_len && pending[heap[child + 1]].due_ns < pending[heap[child]].due_ns) child++;
+        if (pending[heap[child]].due_ns >= pending[last].due_ns) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_len) heap[i] = last;
+    return top;
+}
+
+static void schedule(const uint8_t *resp, size_t len, const struct sockaddr_in *to, uint64_t due) {
+    if (free_len == 0) {
+        stat_overflow++;
+        return;
+    }
+    int idx = free_list[--free_len];
+    pending[idx].due_ns = due;
+    pending[idx].to = *to;
+    pending[idx].len = len;
+    memcpy(pending[idx].data, resp, len);
+    heap_push(idx);
+}
+
+// 追加一条指向问题名称的资源记录
+static size_t add_answer(uint8_t *resp, size_t n, uint16_t type, const uint8_t *rdata, size_t rdlen) {
+    if (n + 12 + rdlen > PKT_SIZE) return n;
+    uint8_t *p = resp + n;
+    wire_set_u16(p, 0xc000 | DNS_HEADER_SIZE);
+    wire_set_u16(p + 2, type);
+    wire_set_u16(p + 4, DNS_CLASS_IN);
+    wire_set_u16(p + 6, ttl >> 16);
+    wire_set_u16(p + 8, ttl & 0xffff);
+    wire_set_u16(p + 10, rdlen);
+    memcpy(p + 12, rdata, rdlen);
+    wire_set_u16(resp + DNS_OFF_ANCOUNT, wire_get_u16(resp + DNS_OFF_ANCOUNT) + 1);
+    return n + 12 + rdlen;
+}
+
+static void handle_query(const uint8_t *buf, size_t len, const struct sockaddr_in *from, uint64_t now) {
+    size_t qname_end, qend;
+    stat_queries++;
+    if (len < DNS_HEADER_SIZE || (wire_get_u16(buf + DNS_OFF_FLAGS) & DNS_FLAG_QR) ||
+        wire_get_u16(buf + DNS_OFF_QDCOUNT) != 1 ||
+        wire_question_end(buf, len, &qname_end, &qend) != 0 || qend > PKT_SIZE) {
+        stat_malformed++;
+        return;
+    }
+
+    char name[DNS_MAX_NAME + 1];
+    qname_to_str(buf, qname_end, name);
+    uint16_t qtype = wire_get_u16(buf + qname_end);
+    const char *what;
+
+    if (rng() < loss_ratio) {
+        stat_dropped++;
+        what = "drop";
+        goto out;
+    }
+
+    // 响应只保留问题段，查询带 OPT 时附上一个不带选项的 OPT
+    uint8_t resp[PKT_SIZE];
+    memcpy(resp, buf, qend);
+    wire_set_u16(resp + DNS_OFF_FLAGS, DNS_FLAG_QR | DNS_FLAG_RA | (wire_get_u16(buf + DNS_OFF_FLAGS) & DNS_FLAG_RD));
+    wire_set_u16(resp + DNS_OFF_ANCOUNT, 0);
+    wire_set_u16(resp + DNS_OFF_NSCOUNT, 0);
+    wire_set_u16(resp + DNS_OFF_ARCOUNT, 0);
+    size_t n = qend;
+    uint16_t rcode = DNS_RCODE_NOERROR;
+
+    if (rng() < tc_ratio) {
+        wire_set_u16(resp + DNS_OFF_FLAGS, wire_get_u16(resp + DNS_OFF_FLAGS) | DNS_FLAG_TC);
+        stat_tc++;
+        what = "TC";
+    } else {
+        name_entry_t *e = num_names ? find_name(name, 0) : NULL;
+        if ((num_names && !e) || rng() < nx_ratio) {
+            rcode = DNS_RCODE_NXDOMAIN;
+            stat_nxdomain++;
+            what = "NXDOMAIN";
+        } else {
+            if (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY) {
+                if (e) for (int i = 0; i < e->n4; i++) n = add_answer(resp, n, DNS_TYPE_A, e->a4[i], 4);
+                else n = add_answer(resp, n, DNS_TYPE_A, default_addr, 4);
+            }
+            if (e && (qtype == DNS_TYPE_AAAA || qtype == DNS_TYPE_ANY)) {
+                for (int i = 0; i < e->n6; i++) n = add_answer(resp, n, DNS_TYPE_AAAA, e->a6[i], 16);
+            }
+            if (wire_get_u16(resp + DNS_OFF_ANCOUNT)) {
+                stat_answered++;
+                what = "answer";
+            } else {
+                stat_nodata++;
+                what = "NODATA";
+            }
+        }
+        wire_set_u16(resp + DNS_OFF_FLAGS, wire_get_u16(resp + DNS_OFF_FLAGS) | rcode);
+    }
+
+    size_t opt;
+    if (wire_find_opt(buf, len, &opt) == 1 && n + 11 <= PKT_SIZE) {
+        memset(resp + n, 0, 11);
+        wire_set_u16(resp + n + 1, DNS_TYPE_OPT);
+        wire_set_u16(resp + n + 3, PKT_SIZE);
+        n += 11;
+        wire_set_u16(resp + DNS_OFF_ARCOUNT, 1);
+    }
+
+    uint64_t due = now + sample_delay();
+    if (rng() < mismatch_ratio) {
+        uint8_t bogus[PKT_SIZE];
+        memcpy(bogus, resp, n);
+        wire_set_u16(bogus + DNS_OFF_ID, wire_get_u16(resp + DNS_OFF_ID) ^ 0x5a5a);
+        schedule(bogus, n, from, due);
+        stat_mismatch++;
+    }
+    schedule(resp, n, from, due);
+
+out:
+    if (verbose) {
+        char addr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &from->sin_addr, addr, sizeof(addr));
+        fprintf(stderr, "%s:%u id=%u type=%u %s. %s\n", addr, ntohs(from->sin_port),
+                wire_get_u16(buf + DNS_OFF_ID), qtype, name, what);
+    }
+}
+
+// 发送已到期的响应，返回距下一个到期的毫秒数，没有待发响应时返回 -1
+static int flush_due(int fd) {
+    while (heap_len) {
+        uint64_t now = now_ns();
+        pending_t *p = &pending[heap[0]];
+        if (p->due_ns > now) return (int)((p->due_ns - now + 999999) / 1000000);
+        sendto(fd, p->data, p->len, 0, (struct sockaddr*)&p->to, sizeof(p->to));
+        free_list[free_len++] = heap_pop();
+    }
+    return -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-l ADDR[:PORT]] [-f FILE] [-A ADDR] [-T TTL] [-d DIST]\n"
+                    "       [-p RATIO] [-t RATIO] [-x RATIO] [-i RATIO] [-S SEED] [-v]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *listen_addr = "127.0.0.1:5300", *table = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:f:A:T:d:p:t:x:i:S:v")) != -1) {
+        int bad = 0;
+        switch (opt) {
+            case 'l': listen_addr = optarg; break;
+            case 'f': table = optarg; break;
+            case 'A': bad = inet_pton(AF_INET, optarg, default_addr) != 1; break;
+            case 'T': ttl = strtoul(optarg, NULL, 10); break;
+            case 'd': bad = parse_dist(optarg); break;
+            case 'p': bad = parse_ratio(optarg, &loss_ratio); break;
+            case 't': bad = parse_ratio(optarg, &tc_ratio); break;
+            case 'x': bad = parse_ratio(optarg, &nx_ratio); break;
+            case 'i': bad = parse_ratio(optarg, &mismatch_ratio); break;
+            case 'S': rng_state = strtoull(optarg, NULL, 10) | 1; break;
+            case 'v': verbose = 1; break;
+            default: bad = 1; break;
+        }
+        if (bad) {
+            if (opt != '?') fprintf(stderr, "invalid value for -%c: '%s'\n", opt, optarg);
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    names = calloc(NAME_TABLE_SIZE, sizeof(name_entry_t));
+    pending = calloc(MAX_PENDING, sizeof(pending_t));
+    if (!names || !pending) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = MAX_PENDING - 1; i >= 0; i--) free_list[free_len++] = i;
+    if (table && load_names(table) != 0) return 1;
+
+    char host[64];
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(5300)};
+    const char *colon = strchr(listen_addr, ':');
+    size_t l = colon ? (size_t)(colon - listen_addr) : strlen(listen_addr);
+    if (l >= sizeof(host)) l = sizeof(host) - 1;
+    memcpy(host, listen_addr, l);
+    host[l] = '\0';
+    if (colon) addr.sin_port = htons(strtoul(colon + 1, NULL, 10));
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid listen address '%s'\n", listen_addr);
+        return 2;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int size = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("bind");
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    fprintf(stderr, "mock upstream listening on %s:%u, %zu names%s\n", host, ntohs(addr.sin_port),
+            num_names, num_names ? "" : " (answering every A query)");
+
+    while (!stop) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int wait = flush_due(fd);
+        if (poll(&pfd, 1, wait < 0 || wait > 100 ? 100 : wait) <= 0) continue;
+
+        // 一次取完已到达的查询，再统一处理到期的响应
+        for (int i = 0; i < 256; i++) {
+            uint8_t buf[PKT_SIZE];
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &from_len);
+            if (n < 0) break;
+            handle_query(buf, n, &from, now_ns());
+        }
+    }
+
+    printf("queries %llu: answered %llu, nodata %llu, nxdomain %llu, tc %llu, dropped %llu, "
+           "mismatched id %llu, malformed %llu, overflow %llu\n",
+           (unsigned long long)stat_queries, (unsigned long long)stat_answered,
+           (unsigned long long)stat_nodata, (unsigned long long)stat_nxdomain,
+           (unsigned long long)stat_tc, (unsigned long long)stat_dropped,
+           (unsigned long long)stat_mismatch, (unsigned long long)stat_malformed,
+           (unsigned long long)stat_overflow);
+    close(fd);
+    free(names);
+    free(pending);
+    return 0;
+}
@@ -0,0 +1,289 @@
+// 查询日志解码工具：打印或汇总 --query-log 写出的环形文件
+//
+// 编译：gcc -O2 -I include -o qlogdump tools/qlogdump.c
+// 用法：qlogdump [-s] [-n N] FILE
+//   默认按序号顺序逐条打印
+//   -s    只输出汇总：来源、rcode、类型的分布，耗时分位数，查询最多的名称
+//   -n N  汇总中列出的名称数（默认 10）
+//
+// 文件由同一台机器上的进程写入，字段按本机字节序读取。
+// 服务运行时也可以读取，正在写入的记录会被跳过。
+
+#include "querylog.h"
+#include <arpa/inet.h>   // for inet_ntop, INET_ADDRSTRLEN
+#include <fcntl.h>       // for open, O_RDONLY
+#include <stdio.h>       // for printf, fprintf, snprintf, perror
+#include <stdlib.h>      // for calloc, free, qsort, atoi
+#include <string.h>      // for memcpy, strcmp, strcpy
+#include <sys/mman.h>    // for mmap, munmap
+#include <sys/stat.h>    // for fstat, stat
+#include <time.h>        // for localtime_r, strftime
+#include <unistd.h>      // for close, getopt
+
+#define NAME_STR_LEN (QLOG_NAME_MAX * 4 + 8)
+#define NAME_TABLE_SIZE 65536        // 必须是2的幂
+
+static const char *source_str[] = {"local", "gateway", "docker", "forward", "refused", "loop", "cache"};
+static const char *rcode_str[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
+
+typedef struct {
+    char name[NAME_STR_LEN];
+    uint64_t count;
+} name_count_t;
+
+// 线格式名称转为文本，截断的名称以 "..." 结尾
+static void name_to_str(const qlog_record_t *rec, char *out) {
+    size_t len = rec->qname_len < QLOG_NAME_MAX ? rec->qname_len : QLOG_NAME_MAX;
+    size_t off = 0, n = 0;
+
+    if (len == 0) {
+        strcpy(out, "?");
+        return;
+    }
+    while (off < len) {
+        uint8_t l = rec->qname[off++];
+        if (l == 0) break;
+        // 查询中的压缩指针不再展开
+        if (l > 63) {
+            n += sprintf(out + n, "(ptr)");
+            break;
+        }
+        for (uint8_t i = 0; i < l && off < len; i++, off++) {
+            uint8_t c = rec->qname[off];
+            if (c == '.' || c == '\\') n += sprintf(out + n, "\\%c", c);
+            else if (c <= ' ' || c >= 0x7f) n += sprintf(out + n, "\\%03u", c);
+            else out[n++] = c;
+        }
+        out[n++] = '.';
+    }
+    if (n == 0) out[n++] = '.';
+    if (rec->flags & QLOG_FLAG_NAME_TRUNC) n += sprintf(out + n, "...");
+    out[n] = '\0';
+}
+
+static const char* type_to_str(uint16_t type, char *buf, size_t cap) {
+    switch (type) {
+        case 1:   return "A";
+        case 2:   return "NS";
+        case 5:   return "CNAME";
+        case 6:   return "SOA";
+        case 12:  return "PTR";
+        case 15:  return "MX";
+        case 16:  return "TXT";
+        case 28:  return "AAAA";
+        case 33:  return "SRV";
+        case 64:  return "SVCB";
+        case 65:  return "HTTPS";
+        case 255: return "ANY";
+    }
+    snprintf(buf, cap, "TYPE%u", type);
+    return buf;
+}
+
+static const char* rcode_to_str(uint8_t rcode, char *buf, size_t cap) {
+    if (rcode < sizeof(rcode_str) / sizeof(rcode_str[0])) return rcode_str[rcode];
+    if (rcode == 0xff) return "NORESP";
+    snprintf(buf, cap, "RCODE%u", rcode);
+    return buf;
+}
+
+static const char* source_to_str(uint8_t source) {
+    return source < sizeof(source_str) / sizeof(source_str[0]) ? source_str[source] : "?";
+}
+
+// 复制一条完整写入的记录，正在写入或已被覆盖时返回 0
+static int read_record(const qlog_record_t *slot, uint64_t seq, qlog_record_t *rec) {
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq + 1) return 0;
+    memcpy(rec, slot, sizeof(*rec));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+static void print_record(const qlog_record_t *rec) {
+    char name[NAME_STR_LEN], addr[INET_ADDRSTRLEN], tbuf[16], rbuf[16], when[32];
+    time_t sec = rec->ts_ns / 1000000000ULL;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    inet_ntop(AF_INET, &rec->client_addr, addr, sizeof(addr));
+    name_to_str(rec, name);
+
+    printf("%s.%06llu %s:%u %s %s %s %s %uus %u/%uB%s\n",
+           when, (unsigned long long)(rec->ts_ns % 1000000000ULL / 1000),
+           addr, rec->client_port,
+           type_to_str(rec->qtype, tbuf, sizeof(tbuf)), name,
+           rcode_to_str(rec->rcode, rbuf, sizeof(rbuf)), source_to_str(rec->source),
+           rec->latency_us, rec->query_len, rec->resp_len,
+           (rec->flags & QLOG_FLAG_TC) ? " TC" : "");
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_count(const void *a, const void *b) {
+    const name_count_t *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+static uint64_t hash_str(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) h = (h ^ (uint8_t)*s++) * 1099511628211ULL;
+    return h;
+}
+
+// 名称计数表满了以后新的名称不再统计
+static void count_name(name_count_t *table, size_t *used, const char *name) {
+    size_t i = hash_str(name) & (NAME_TABLE_SIZE - 1);
+    while (table[i].count) {
+        if (strcmp(table[i].name, name) == 0) {
+            table[i].count++;
+            return;
+        }
+        i = (i + 1) & (NAME_TABLE_SIZE - 1);
+    }
+    if (*used >= NAME_TABLE_SIZE / 2) return;
+    strcpy(table[i].name, name);
+    table[i].count = 1;
+    (*used)++;
+}
+
+static void print_summary(const qlog_header_t *h, const qlog_record_t *records,
+                          uint64_t first, uint64_t head, int top) {
+    static uint64_t by_type[65536];
+    uint64_t total = 0, by_source[8] = {0}, by_rcode[17] = {0};
+    uint64_t tc = 0, min_ts = UINT64_MAX, max_ts = 0;
+    uint32_t *latency = calloc(head - first + 1, sizeof(uint32_t));
+    name_count_t *names = calloc(NAME_TABLE_SIZE, sizeof(name_count_t));
+    size_t used = 0;
+    if (!latency || !names) {
+        fprintf(stderr, "out of memory\n");
+        free(latency);
+        free(names);
+        return;
+    }
+
+    for (uint64_t seq = first; seq < head; seq++) {
+        qlog_record_t rec;
+        if (!read_record(&records[seq & (h->capacity - 1)], seq, &rec)) continue;
+
+        char name[NAME_STR_LEN];
+        name_to_str(&rec, name);
+        count_name(names, &used, name);
+
+        latency[total++] = rec.latency_us;
+        by_source[rec.source < 7 ? rec.source : 7]++;
+        by_rcode[rec.rcode < 16 ? rec.rcode : 16]++;
+        by_type[rec.qtype]++;
+        if (rec.flags & QLOG_FLAG_TC) tc++;
+        if (rec.ts_ns < min_ts) min_ts = rec.ts_ns;
+        if (rec.ts_ns > max_ts) max_ts = rec.ts_ns;
+    }
+
+    printf("records: %llu (capacity %llu, written %llu)\n", (unsigned long long)total,
+           (unsigned long long)h->capacity, (unsigned long long)head);
+    if (total == 0) goto out;
+
+    double span = (max_ts - min_ts) / 1e9;
+    printf("span: %.3f s", span);
+    if (span > 0) printf(", %.1f queries/s", total / span);
+    printf("\ntruncated (TC): %llu\n", (unsigned long long)tc);
+
+    qsort(latency, total, sizeof(uint32_t), compare_u32);
+    printf("\nlatency (us): p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+           latency[total * 50 / 100], latency[total * 90 / 100],
+           latency[total * 99 / 100], latency[total * 999 / 1000], latency[total - 1]);
+
+    printf("\nsource:\n");
+    for (int i = 0; i < 8; i++) {
+        if (by_source[i]) printf("  %-10s %10llu  %5.1f%%\n", i < 7 ? source_to_str(i) : "?",
+                                 (unsigned long long)by_source[i], 100.0 * by_source[i] / total);
+    }
+
+    printf("\nrcode:\n");
+    for (int i = 0; i < 17; i++) {
+        char buf[16];
+        if (by_rcode[i]) printf("  %-10s %10llu  %5.1f%%\n", i < 16 ? rcode_to_str(i, buf, sizeof(buf)) : "NORESP",
+                                (unsigned long long)by_rcode[i], 100.0 * by_rcode[i] / total);
+    }
+
+    printf("\nqtype:\n");
+    for (int i = 0; i < 65536; i++) {
+        char buf[16];
+        if (by_type[i]) printf("  %-10s %10llu  %5.1f%%\n", type_to_str(i, buf, sizeof(buf)),
+                               (unsigned long long)by_type[i], 100.0 * by_type[i] / total);
+    }
+
+    qsort(names, NAME_TABLE_SIZE, sizeof(name_count_t), compare_count);
+    printf("\ntop names:\n");
+    for (int i = 0; i < top && names[i].count; i++) {
+        printf("  %10llu  %s\n", (unsigned long long)names[i].count, names[i].name);
+    }
+    if (used >= NAME_TABLE_SIZE / 2) printf("  (more than %d distinct names, later ones not counted)\n",
+                                            NAME_TABLE_SIZE / 2);
+
+out:
+    free(latency);
+    free(names);
+}
+
+int main(int argc, char *argv[]) {
+    int summary = 0, top = 10, opt;
+    while ((opt = getopt(argc, argv, "sn:")) != -1) {
+        switch (opt) {
+            case 's': summary = 1; break;
+            case 'n': top = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s] [-n N] FILE\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-s] [-n N] FILE\n", argv[0]);
+        return 2;
+    }
+
+    const char *path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        return 1;
+    }
+    if ((size_t)st.st_size < QLOG_HEADER_SIZE) {
+        fprintf(stderr, "%s: not a query log\n", path);
+        return 1;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    const qlog_header_t *h = (const qlog_header_t*)map;
+    if (h->magic != QLOG_MAGIC || h->version != QLOG_VERSION || h->record_size != QLOG_RECORD_SIZE ||
+        h->capacity == 0 || (h->capacity & (h->capacity - 1)) ||
+        (size_t)st.st_size < QLOG_HEADER_SIZE + h->capacity * QLOG_RECORD_SIZE) {
+        fprintf(stderr, "%s: not a query log or unsupported version\n", path);
+        return 1;
+    }
+
+    const qlog_record_t *records = (const qlog_record_t*)(map + QLOG_HEADER_SIZE);
+    uint64_t head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > h->capacity ? head - h->capacity : 0;
+
+    if (summary) {
+        print_summary(h, records, first, head, top);
+    } else {
+        for (uint64_t seq = first; seq < head; seq++) {
+            qlog_record_t rec;
+            if (read_record(&records[seq & (h->capacity - 1)], seq, &rec)) print_record(&rec);
+        }
+    }
+
+    munmap(map, st.st_size);
+    return 0;
+}